@@ -0,0 +1,96 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_arena.c
+ *
+ * Description:
+ *
+ * Per-thread scratch arena, see sr_arena.h
+ *
+ * The blocks of a thread form a list.  Allocation bumps through the
+ * current block and moves on to the next (emptying it as it enters)
+ * when the current one is full, appending a block at the end of the
+ * list once there is no next.  A reset only goes back to the first.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+
+#include "sr_arena.h"
+
+struct sr_arena_block
+{
+    struct sr_arena_block* next;
+    size_t size;
+    size_t used;
+};
+
+/* the data of a block follows its header, aligned */
+#define SR_ARENA_HDR \
+    ((sizeof(struct sr_arena_block) + SR_ARENA_ALIGN - 1) & ~(size_t)(SR_ARENA_ALIGN - 1))
+#define SR_ARENA_DATA(b) ((char*)(b) + SR_ARENA_HDR)
+
+struct sr_arena
+{
+    struct sr_arena_block* first;
+    struct sr_arena_block* cur;
+};
+
+static __thread struct sr_arena sr_arena_self;
+
+static struct sr_arena_block* sr_arena_block_new(size_t size)
+{
+    struct sr_arena_block* b;
+
+    if ( size < SR_ARENA_BLOCK )
+    { size = SR_ARENA_BLOCK; }
+    if ( (b = (struct sr_arena_block*)malloc(SR_ARENA_HDR + size)) == 0 )
+    { return 0; }
+    b->next = 0;
+    b->size = size;
+    b->used = 0;
+    return b;
+} /* -- sr_arena_block_new -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_arena_alloc(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_arena_alloc(size_t size)
+{
+    struct sr_arena* a = &sr_arena_self;
+    struct sr_arena_block* b;
+    void* p;
+
+    size = (size + SR_ARENA_ALIGN - 1) & ~(size_t)(SR_ARENA_ALIGN - 1);
+
+    if ( a->cur == 0 )
+    {
+        if ( (a->first = a->cur = sr_arena_block_new(size)) == 0 )
+        { return 0; }
+    }
+
+    /* -- on to the next block, or a new one, until it fits -- */
+    for ( b = a->cur; b->used + size > b->size; b = b->next )
+    {
+        if ( b->next == 0 && (b->next = sr_arena_block_new(size)) == 0 )
+        { return 0; }
+        b->next->used = 0;
+    }
+
+    a->cur = b;
+    p = SR_ARENA_DATA(b) + b->used;
+    b->used += size;
+    return p;
+} /* -- sr_arena_alloc -- */
+
+void sr_arena_reset(void)
+{
+    struct sr_arena* a = &sr_arena_self;
+
+    if ( a->first )
+    {
+        a->cur = a->first;
+        a->first->used = 0;
+    }
+} /* -- sr_arena_reset -- */
@@ -0,0 +1,37 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_arena.h
+ *
+ * Description:
+ *
+ * Per-thread scratch memory for what lives no longer than one packet
+ * batch: a bump pointer over blocks the thread keeps for good.  There
+ * is no free; sr_end_batch, which ends every backend poll, worker burst
+ * and ARP sweep, empties the calling thread's arena in O(1) with
+ * sr_arena_reset.  So nothing allocated here can leak, and once the
+ * blocks are there a batch makes no allocator calls.
+ *
+ * What lives here: the command buffer of a VNS read, the ARP requests a
+ * sweep is to resend, and the copies sr_arpcache_lookup hands out.
+ *
+ * Never hold on to arena memory past the batch, or hand it to another
+ * thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ARENA_H
+#define SR_ARENA_H
+
+#include <stddef.h>
+
+#define SR_ARENA_BLOCK  (64 * 1024)     /* bytes per block, unless larger asked */
+#define SR_ARENA_ALIGN  16
+
+/* 'size' bytes from the calling thread's arena, SR_ARENA_ALIGN aligned,
+   or 0 if out of memory */
+void* sr_arena_alloc(size_t size);
+
+/* Give back everything the calling thread has allocated since its last
+   reset. The blocks are kept for the next batch. */
+void  sr_arena_reset(void);
+
+#endif /* -- SR_ARENA_H -- */
@@ -11,48 +11,81 @@
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_worker.h"
+#include "sr_neigh.h"
+#include "sr_arena.h"
 
 /* This function gets called every second. For each request sent out, we keep
   checking whether we should resend an request or destroy the arp request.
   See pseudo-code in sr_arpcache.h
 */
-void sr_arpcache_sweepreqs(struct sr_instance *sr) {
+void sr_arpcache_sweepreqs(struct sr_instance *sr, struct sr_arp_work *work) {
   /* TODO: Fill this in */
 
-  struct sr_arpreq *req = sr->cache.requests;
+  time_t now = time(NULL);
+  struct sr_arpreq *req = sr_neigh_cache(sr)->requests;
   while(req != NULL) {
     struct sr_arpreq *next_req = req->next;
-    handle_arpreq(sr, req);
+    sr_arpreq_collect(sr, req, now, work);
     req = next_req;
   }
 }
 
 /* You should not need to touch the rest of this code. */
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry_t *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+/* Entries are changed under the cache lock between these two, which keep
+   the sequence count odd so that lock-free readers retry. */
+static void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    __atomic_store_n(&cache->seq, cache->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+static void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&cache->seq, cache->seq + 1, __ATOMIC_RELEASE);
+}
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+/* Copies the entry for 'ip' into 'entry' without taking the lock. Returns 1
+   if there is one. */
+int sr_arpcache_get(struct sr_arpcache *cache, uint32_t ip,
+                    struct sr_arpentry *entry) {
+    unsigned int seq;
+    int i, found;
+
+    do {
+        seq = __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
         }
-    }
+
+        found = 0;
+        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+            if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
+                memcpy(entry, &(cache->entries[i]), sizeof(struct sr_arpentry));
+                found = 1;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&cache->seq, __ATOMIC_RELAXED));
+
+    return found;
+}
+
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   The copy returned, if not NULL, is scratch memory good until the end of
+   the batch (see sr_arena.h); it is not to be freed. */
+struct sr_arpentry_t *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arpentry entry, *copy = NULL;
 
     /* Must return a copy b/c another thread could jump in and modify
        table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+    if (sr_arpcache_get(cache, ip, &entry) &&
+        (copy = (struct sr_arpentry *) sr_arena_alloc(sizeof(struct sr_arpentry))) != NULL) {
+        memcpy(copy, &entry, sizeof(struct sr_arpentry));
     }
 
-    pthread_mutex_unlock(&(cache->lock));
-
-    return copy;
+    return (struct sr_arpentry_t *)copy;
 }
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
@@ -67,7 +100,7 @@ struct sr_arpreq_t *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        unsigned int packet_len,
                                        char *iface)
 {
-    pthread_mutex_lock(&(cache->lock));
+    sr_arpcache_lock(cache);
 
     struct sr_arpreq *req;
     for (req = cache->requests; req != NULL; req = req->next) {
@@ -101,7 +134,7 @@ struct sr_arpreq_t *sr_arpcache_queuereq(struct sr_arpcache *cache,
         /*if (first_one==1) new_pkt->next=NULL;*/
     }
 
-    pthread_mutex_unlock(&(cache->lock));
+    sr_arpcache_unlock(cache);
 
     return req;
 }
@@ -114,7 +147,7 @@ struct sr_arpreq_t *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
                                      uint32_t ip)
 {
-    pthread_mutex_lock(&(cache->lock));
+    sr_arpcache_lock(cache);
 
     struct sr_arpreq *req, *prev = NULL, *next = NULL;
     for (req = cache->requests; req != NULL; req = req->next) {
@@ -140,13 +173,15 @@ struct sr_arpreq_t *sr_arpcache_insert(struct sr_arpcache *cache,
     }
 
     if (i != SR_ARPCACHE_SZ) {
+        sr_arpcache_write_begin(cache);
         memcpy(cache->entries[i].mac, mac, 6);
         cache->entries[i].ip = ip;
         cache->entries[i].added = time(NULL);
         cache->entries[i].valid = 1;
+        sr_arpcache_write_end(cache);
     }
 
-    pthread_mutex_unlock(&(cache->lock));
+    sr_arpcache_unlock(cache);
 
     return req;
 }
@@ -154,51 +189,96 @@ struct sr_arpreq_t *sr_arpcache_insert(struct sr_arpcache *cache,
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
-    pthread_mutex_lock(&(cache->lock));
+    sr_arpcache_lock(cache);
 
     if (entry) {
-        struct sr_arpreq *req, *prev = NULL, *next = NULL;
-        for (req = cache->requests; req != NULL; req = req->next) {
-            if (req == entry) {
-                if (prev) {
-                    next = req->next;
-                    prev->next = next;
-                }
-                else {
-                    next = req->next;
-                    cache->requests = next;
-                }
-
-                break;
-            }
-            prev = req;
-        }
+        sr_arpreq_detach(cache, entry);
+        sr_arpreq_free(entry);
+    }
+
+    sr_arpcache_unlock(cache);
+}
 
-        struct sr_packet *pkt, *nxt;
+/* Takes an arp request entry off the queue, if it is there. The cache must
+   be locked. */
+void sr_arpreq_detach(struct sr_arpcache *cache, struct sr_arpreq *entry) {
+    struct sr_arpreq *req, *prev = NULL;
 
-        for (pkt = entry->packets; pkt; pkt = nxt) {
-            nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+    for (req = cache->requests; req != NULL; req = req->next) {
+        if (req == entry) {
+            if (prev)
+                prev->next = req->next;
+            else
+                cache->requests = req->next;
+            break;
         }
+        prev = req;
+    }
+}
 
-        free(entry);
+/* Frees an arp request entry and its packets. It must be off the queue. */
+void sr_arpreq_free(struct sr_arpreq *entry) {
+    struct sr_packet *pkt, *nxt;
+
+    for (pkt = entry->packets; pkt; pkt = nxt) {
+        nxt = pkt->next;
+        if (pkt->buf)
+            free(pkt->buf);
+        if (pkt->iface)
+            free(pkt->iface);
+        free(pkt);
     }
 
-    pthread_mutex_unlock(&(cache->lock));
+    free(entry);
+}
+
+void sr_arp_work_init(struct sr_arp_work *work) {
+    memset(work, 0, sizeof(struct sr_arp_work));
+}
+
+/* Grows the list as needed; called under the cache lock, which is fine
+   since it does no I/O. The list is scratch memory (see sr_arena.h), so
+   growing it leaves the old one to the end of the batch. */
+int sr_arp_work_resend(struct sr_arp_work *work, uint32_t ip) {
+    uint32_t *resend;
+
+    if (work->nresend == work->cap) {
+        resend = (uint32_t *)sr_arena_alloc((work->cap ? 2 * work->cap : 16) * sizeof(uint32_t));
+        if (resend == NULL)
+            return -1;
+        if (work->nresend)
+            memcpy(resend, work->resend, work->nresend * sizeof(uint32_t));
+        work->resend = resend;
+        work->cap = work->cap ? 2 * work->cap : 16;
+    }
+    work->resend[work->nresend++] = ip;
+
+    return 0;
 }
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache) {
+    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    unsigned int seq;
+
+    /* Copy the entries under the sequence count, as sr_arpcache_get reads
+       them, so that any thread can dump any cache (or shard) */
+    do {
+        seq = __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(entries, cache->entries, sizeof(entries));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&cache->seq, __ATOMIC_RELAXED));
+
     fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
 
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        struct sr_arpentry *cur = &(cache->entries[i]);
+        struct sr_arpentry *cur = &(entries[i]);
         unsigned char *mac = cur->mac;
         fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
     }
@@ -206,6 +286,19 @@ void sr_arpcache_dump(struct sr_arpcache *cache) {
     fprintf(stderr, "\n");
 }
 
+/* Take and release the table lock. Both are no-ops when the router runs
+   single-threaded (event loop mode), since nothing else can touch the
+   table then. */
+void sr_arpcache_lock(struct sr_arpcache *cache) {
+    if (!cache->lockless)
+        pthread_mutex_lock(&(cache->lock));
+}
+
+void sr_arpcache_unlock(struct sr_arpcache *cache) {
+    if (!cache->lockless)
+        pthread_mutex_unlock(&(cache->lock));
+}
+
 /* Initialize table + table lock. Returns 0 on success. */
 int sr_arpcache_init(struct sr_arpcache *cache) {
     /* Seed RNG to kick out a random entry if all entries full. */
@@ -214,6 +307,8 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     /* Invalidate all entries */
     memset(cache->entries, 0, sizeof(cache->entries));
     cache->requests = NULL;
+    cache->lockless = 0;
+    cache->seq = 0;
 
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
@@ -228,29 +323,50 @@ int sr_arpcache_destroy(struct sr_arpcache *cache) {
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
-void *sr_arpcache_timeout(void *sr_ptr) {
-    struct sr_instance *sr = sr_ptr;
-    struct sr_arpcache *cache = &(sr->cache);
+/* One housekeeping pass: invalidates entries that were added more than
+   SR_ARPCACHE_TO seconds ago, sweeps the request queue and pushes out
+   whatever the sweep sent. Called every second by the timeout thread or
+   by the event loop's timer. The lock is only held while entries and
+   requests are looked at; the requests and ICMP errors the sweep decided
+   on are sent after it is released. With workers, the timer passes the
+   tick on to every worker, which runs it on its own shard. */
+void sr_arpcache_tick(struct sr_instance *sr) {
+    struct sr_arpcache *cache = sr_neigh_cache(sr);
+    struct sr_arp_work work;
 
-    while (1) {
-        sleep(1.0);
+    sr_arp_work_init(&work);
 
-        pthread_mutex_lock(&(cache->lock));
+    sr_arpcache_lock(cache);
 
-        time_t curtime = time(NULL);
+    time_t curtime = time(NULL);
 
-        int i;
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
+    int i;
+    sr_arpcache_write_begin(cache);
+    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+        if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
+            cache->entries[i].valid = 0;
         }
+    }
+    sr_arpcache_write_end(cache);
 
-        sr_arpcache_sweepreqs(sr);
+    sr_arpcache_sweepreqs(sr, &work);
 
-        pthread_mutex_unlock(&(cache->lock));
+    sr_arpcache_unlock(cache);
+
+    sr_arp_work_run(sr, &work);
+    sr_end_batch(sr);
+
+    if (!sr_worker_self && sr->workers)
+        sr_neigh_tick(sr);
+}
+
+/* Thread which runs sr_arpcache_tick once a second, until sr->stop. */
+void *sr_arpcache_timeout(void *sr_ptr) {
+    struct sr_instance *sr = sr_ptr;
+
+    while (!__atomic_load_n(&sr->stop, __ATOMIC_ACQUIRE)) {
+        sleep(1.0);
+        sr_arpcache_tick(sr);
     }
 
     return NULL;
@@ -107,12 +107,37 @@ struct sr_arpcache {
     struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
+    int lockless;               /* Single-threaded mode, lock is skipped */
+    unsigned int seq;           /* Odd while entries are being changed */
 };
 
+/* Work the sweeper decides on while it holds the cache lock, and carries
+   out after releasing it, so that nothing is built or sent under the lock:
+   ARP requests to send again, and requests given up on (already off the
+   queue) whose packets get an ICMP host unreachable. */
+struct sr_arp_work {
+    uint32_t *resend;           /* IPs to send an ARP request for (arena) */
+    unsigned int nresend;
+    unsigned int cap;
+    struct sr_arpreq *failed;   /* linked through 'next' */
+};
+
+void sr_arp_work_init(struct sr_arp_work *work);
+
+/* Adds 'ip' to the requests to send. Returns 0, or -1 if out of memory. */
+int  sr_arp_work_resend(struct sr_arp_work *work, uint32_t ip);
+
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
+   The returned copy lasts until the end of the batch (sr_arena.h); it is
+   not to be freed. */
 struct sr_arpentry_t *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
+/* Lock-free version of sr_arpcache_lookup for the forwarding path: copies
+   the entry into 'entry' and returns 1, or returns 0 if there is none. Reads
+   retry while a writer holds the sequence count odd. */
+int sr_arpcache_get(struct sr_arpcache *cache, uint32_t ip,
+                    struct sr_arpentry *entry);
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. The packet argument should not be
@@ -126,10 +151,11 @@ struct sr_arpreq_t *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          unsigned int packet_len,
                          char *iface);
 
-/* This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the ARP request.
+/* This function gets called every second, with the cache locked. For each
+  request sent out, it decides whether to resend the request or give up on
+  it, and records that in 'work' for the caller to carry out once unlocked.
   See pseudo-code in sr_arpcache.h*/
-void sr_arpcache_sweepreqs(struct sr_instance *sr);
+void sr_arpcache_sweepreqs(struct sr_instance *sr, struct sr_arp_work *work);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -143,9 +169,21 @@ struct sr_arpreq_t *sr_arpcache_insert(struct sr_arpcache *cache,
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
-/* Prints out the ARP table. */
+/* Takes an arp request entry off the queue without freeing it. The cache
+   must be locked. */
+void sr_arpreq_detach(struct sr_arpcache *cache, struct sr_arpreq *entry);
+
+/* Frees an arp request entry that is no longer on the queue. */
+void sr_arpreq_free(struct sr_arpreq *entry);
+
+/* Prints out the ARP table. Safe from any thread, locks or not. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
+/* Take/release cache->lock unless the cache is in lockless mode. The lock is
+   recursive, so nesting these is fine. */
+void sr_arpcache_lock(struct sr_arpcache *cache);
+void sr_arpcache_unlock(struct sr_arpcache *cache);
+
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
    a destructor, and a cleanup thread times out cache entries every 15
@@ -153,6 +191,7 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 
 int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
+void  sr_arpcache_tick(struct sr_instance *sr);
 void *sr_arpcache_timeout(void *cache_ptr);
 
 #endif
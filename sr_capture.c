@@ -0,0 +1,326 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Asynchronous capture writer, see sr_capture.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <time.h>
+
+#include "sr_router.h"
+#include "sr_dumper.h"
+#include "sr_mpsc.h"
+#include "sr_numa.h"
+#include "sr_pcapng.h"
+#include "sr_filter.h"
+#include "sr_capture.h"
+
+/* A captured frame, as the sending or receiving thread left it */
+struct sr_cap_rec
+{
+    struct timespec ts;
+    unsigned int caplen;
+    unsigned int len;               /* length on the wire */
+    int dir;                        /* SR_CAPTURE_IN or _OUT */
+    char iface[sr_IFACE_NAMELEN];
+    uint8_t data[PACKET_DUMP_SIZE];
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_capture
+ *
+ * 'drops' is counted by the capturing threads, everything else past the
+ * queue belongs to the writer. 'fp' is the legacy pcap file, 'ng' the
+ * pcapng writer, one of the two is set. 'filter' and 'sample' are set
+ * before capturing starts and only read afterwards.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_capture
+{
+    struct sr_mpsc q;
+    struct sr_cap_rec* recs;
+    FILE* fp;
+    struct sr_pcapng* ng;
+    unsigned char* buf;
+    size_t used;
+    pthread_t thread;
+    int stop;
+    unsigned long records;          /* records written */
+    unsigned long writes;           /* write calls */
+    unsigned long drops;            /* records lost to a full ring */
+    struct sr_filter filter;
+    unsigned int sample;            /* keep 1 in 'sample' frames, 0 = all */
+};
+
+/* Frames that passed the filter on this thread, for sampling */
+static __thread unsigned int sr_capture_seen;
+
+/* Hand the gathered records to the file in one call. */
+static void sr_capture_write(struct sr_capture* c)
+{
+    if ( fwrite(c->buf, 1, c->used, c->fp) != c->used )
+    { perror("fwrite(..):sr_capture.c::sr_capture_write"); }
+    c->writes++;
+    c->used = 0;
+} /* -- sr_capture_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_main(..)
+ * Scope:  Local
+ *
+ * Drain the ring into the buffer, writing it whenever it fills up, and
+ * flush once the ring runs dry. pcapng blocks go straight to the
+ * mapped file instead.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_capture_main(void* arg)
+{
+    struct sr_capture* c = (struct sr_capture*)arg;
+    struct sr_cap_rec* r;
+    struct pcap_pkthdr h;
+    struct timespec nap;
+    sigset_t all;
+    unsigned int pos, n;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = SR_CAPTURE_IDLE_US * 1000L;
+
+    while ( 1 )
+    {
+        n = 0;
+        while ( n < SR_CAPTURE_RING && sr_mpsc_peek(&c->q, &pos) == 0 )
+        {
+            r = &c->recs[pos & (SR_CAPTURE_RING - 1)];
+            if ( c->ng )
+            {
+                sr_pcapng_packet(c->ng, r->iface, r->dir,
+                                 (uint64_t)r->ts.tv_sec * 1000000000ULL + r->ts.tv_nsec,
+                                 r->data, r->caplen, r->len);
+                sr_mpsc_release(&c->q);
+                n++;
+                continue;
+            }
+
+            if ( c->used + sizeof(struct pcap_sf_pkthdr) + r->caplen > SR_CAPTURE_BUF )
+            { sr_capture_write(c); }
+
+            h.ts.tv_sec = r->ts.tv_sec;
+            h.ts.tv_usec = r->ts.tv_nsec / 1000;
+            h.caplen = r->caplen;
+            h.len = r->len;
+            c->used += sr_dump_record(c->buf + c->used, &h, r->data);
+
+            sr_mpsc_release(&c->q);
+            n++;
+        }
+        c->records += n;
+        if ( n > 0 )
+        { continue; }
+
+        /* -- caught up: keep the file current -- */
+        if ( c->used > 0 )
+        {
+            sr_capture_write(c);
+            fflush(c->fp);
+        }
+        if ( __atomic_load_n(&c->stop, __ATOMIC_ACQUIRE) )
+        { break; }
+        nanosleep(&nap, 0);
+    }
+
+    return NULL;
+} /* -- sr_capture_main -- */
+
+static void sr_capture_free(struct sr_capture* c)
+{
+    if ( c->ng )
+    {
+        sr_pcapng_close(c->ng);
+        free(c->ng);
+    }
+    sr_mpsc_destroy(&c->q);
+    sr_mem_free(c->recs);
+    free(c->buf);
+    free(c);
+} /* -- sr_capture_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_open(struct sr_instance* sr, const char* spec)
+{
+    struct sr_capture* c;
+    pthread_attr_t attr;
+    int ret;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(spec);
+
+    if ( (c = (struct sr_capture*)calloc(1, sizeof(struct sr_capture))) == 0 )
+    { return -1; }
+
+    if ( sr_mpsc_init(&c->q, SR_CAPTURE_RING) != 0 ||
+         (c->recs = (struct sr_cap_rec*)sr_mem_alloc("capture ring",
+                                                     SR_CAPTURE_RING *
+                                                     sizeof(struct sr_cap_rec),
+                                                     sr_node_for(sr, SR_ROLE_ARP, 0))) == 0 )
+    {
+        sr_capture_free(c);
+        return -1;
+    }
+
+    if ( sr_pcapng_wanted(spec) )
+    {
+        if ( (c->ng = (struct sr_pcapng*)malloc(sizeof(struct sr_pcapng))) == 0 ||
+             sr_pcapng_open(c->ng, sr, spec) != 0 )
+        {
+            free(c->ng);
+            c->ng = 0;
+            sr_capture_free(c);
+            return -1;
+        }
+    }
+    else
+    {
+        if ( (c->buf = (unsigned char*)malloc(SR_CAPTURE_BUF)) == 0 ||
+             (sr->logfile = sr_dump_open(spec, 0, PACKET_DUMP_SIZE)) == 0 )
+        {
+            sr_capture_free(c);
+            return -1;
+        }
+        c->fp = sr->logfile;
+    }
+
+    /* -- the writer keeps the ARP thread company -- */
+    pthread_attr_init(&attr);
+    sr_thread_attr(&attr, "capture", sr_cpu_for(sr, SR_ROLE_ARP, 0));
+    ret = pthread_create(&c->thread, &attr, sr_capture_main, c);
+    pthread_attr_destroy(&attr);
+    if ( ret != 0 )
+    {
+        perror("pthread_create(..):sr_capture.c::sr_capture_open");
+        sr_capture_free(c);
+        if ( sr->logfile )
+        {
+            sr_dump_close(sr->logfile);
+            sr->logfile = 0;
+        }
+        return -1;
+    }
+
+    sr->capture = c;
+    return 0;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_filter(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_filter(struct sr_instance* sr, const char* expr, unsigned int sample)
+{
+    struct sr_capture* c = sr->capture;
+
+    /* -- REQUIRES -- */
+    assert(c);
+
+    if ( expr && sr_filter_compile(&c->filter, expr) != 0 )
+    { return -1; }
+    c->sample = sample > 1 ? sample : 0;
+
+    if ( c->filter.n )
+    {
+        fprintf(stderr, "capture filter \"%s\", %u instructions:\n", expr, c->filter.n);
+        sr_filter_dump(&c->filter, stderr);
+    }
+    if ( c->sample )
+    { fprintf(stderr, "capture: sampling 1 in %u frames\n", c->sample); }
+    return 0;
+} /* -- sr_capture_filter -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope:  Global
+ *
+ * The only cost on the forwarding path: a clock read and a copy, or
+ * less for a frame that is filtered or sampled out. Each thread samples
+ * the frames it sees itself, so the counter needs no atomics.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_instance* sr, const uint8_t* buf, unsigned int len,
+                       const char* iface, int dir)
+{
+    struct sr_capture* c = sr->capture;
+    struct sr_cap_rec* r;
+    unsigned int pos;
+
+    if ( c->filter.n && !sr_filter_run(&c->filter, buf, len, iface, dir) )
+    { return; }
+    if ( c->sample && ++sr_capture_seen % c->sample != 0 )
+    { return; }
+
+    if ( sr_mpsc_claim(&c->q, &pos) != 0 )
+    {
+        __atomic_fetch_add(&c->drops, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    r = &c->recs[pos & (SR_CAPTURE_RING - 1)];
+    clock_gettime(CLOCK_REALTIME, &r->ts);
+    r->caplen = min(PACKET_DUMP_SIZE, len);
+    r->len = len;
+    r->dir = dir;
+    strncpy(r->iface, iface, sr_IFACE_NAMELEN);
+    memcpy(r->data, buf, r->caplen);
+
+    sr_mpsc_publish(&c->q, pos);
+} /* -- sr_capture_packet -- */
+
+void sr_capture_close(struct sr_instance* sr)
+{
+    struct sr_capture* c = sr->capture;
+
+    if ( c == 0 )
+    { return; }
+
+    __atomic_store_n(&c->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(c->thread, NULL);
+
+    fprintf(stderr, "capture: %lu records", c->records);
+    if ( c->ng )
+    {
+        fprintf(stderr, " in %lu files (%lu blocks, %lu without an interface id)",
+                c->ng->files, c->ng->blocks, c->ng->unnamed);
+        if ( c->ng->stopped )
+        { fprintf(stderr, ", %lu after the capture stopped", c->ng->lost); }
+    }
+    else
+    { fprintf(stderr, " in %lu writes", c->writes); }
+    fprintf(stderr, ", %lu dropped\n", __atomic_load_n(&c->drops, __ATOMIC_RELAXED));
+
+    sr_capture_free(c);
+    sr->capture = 0;
+    if ( sr->logfile )
+    {
+        sr_dump_close(sr->logfile);
+        sr->logfile = 0;
+    }
+} /* -- sr_capture_close -- */
@@ -0,0 +1,66 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Asynchronous packet capture (-l logfile).  Threads that receive or send
+ * a frame only stamp it and copy its first PACKET_DUMP_SIZE bytes, with
+ * the interface and direction, into a record of a preallocated ring (an
+ * sr_mpsc queue, so any number of threads can capture at once without a
+ * lock).  A writer thread of its own turns the records into the file.
+ *
+ * For legacy pcap it gathers them into one large buffer and writes that
+ * out in a single call, flushing whenever it catches up so the file
+ * stays current while the router idles.  A name ending in .pcapng, or
+ * rotation options, select the pcapng writer instead (see sr_pcapng.h),
+ * which keeps the interface, direction and nanosecond timestamps.
+ *
+ * A capture that cannot keep up never slows forwarding down: when the
+ * ring is full the record is dropped and counted instead.
+ *
+ * A filter (-F, see sr_filter.h) and 1-in-N sampling (-S) cut what is
+ * recorded before any of that happens: a frame the filter rejects costs
+ * one run of its program, a frame sampled out a counter increment.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_CAPTURE_RING     4096            /* records in flight, a power of two */
+#define SR_CAPTURE_BUF      (1024 * 1024)   /* writer's output buffer */
+#define SR_CAPTURE_IDLE_US  1000            /* writer's nap when it caught up */
+
+/* Direction of a frame, the values pcapng uses in its flags */
+#define SR_CAPTURE_IN       1
+#define SR_CAPTURE_OUT      2
+
+struct sr_instance;
+
+/* Open the capture named by the -l argument, path[:size=MB,secs=N], and
+   start the writer. Returns 0 on success. */
+int  sr_capture_open(struct sr_instance* sr, const char* spec);
+
+/* Record only frames that pass 'expr' (may be 0), and of those every
+   'sample'th (0 or 1 = all). Call before any frame is captured. Returns
+   0 on success. */
+int  sr_capture_filter(struct sr_instance* sr, const char* expr, unsigned int sample);
+
+/* Any thread: queue a frame that crossed 'iface' in direction 'dir'. */
+void sr_capture_packet(struct sr_instance* sr, const uint8_t* buf, unsigned int len,
+                       const char* iface, int dir);
+
+/* Write out what is queued, stop the writer and close the file. */
+void sr_capture_close(struct sr_instance* sr);
+
+#endif /* -- SR_CAPTURE_H -- */
@@ -0,0 +1,270 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum.c
+ *
+ * Description:
+ *
+ * Internet checksum kernels, see sr_cksum.h
+ *
+ * All kernels but the reference one keep a wide sum of the buffer taken
+ * as native 16- or 32-bit words (2^16 = 1 modulo 0xffff, so adding two
+ * 16-bit words as one 32-bit word changes nothing) and fold it to 16
+ * bits at the end.  The vector kernels widen each 16-bit word into a
+ * 32-bit lane and empty the lanes into the 64-bit sum before they can
+ * overflow; they leave what is shorter than a vector to the scalar loop,
+ * and take buffers shorter than SR_CKSUM_VEC_MIN to it whole.
+ *
+ *---------------------------------------------------------------------------*/
+
+/* -- the kernels are only worth having optimized, whatever the build -- */
+#ifdef __GNUC__
+#pragma GCC optimize ("O2")
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _LINUX_
+#include <arpa/inet.h>
+#endif /* _LINUX_ */
+
+#include "sr_cksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CKSUM_X86
+#include <immintrin.h>
+#endif
+
+#define SR_CKSUM_VEC_MIN    128         /* shorter goes to the scalar loop */
+#define SR_CKSUM_VEC_RUN    16384       /* vectors per lane flush */
+
+static uint16_t sr_cksum_resolve(const void* data, int len);
+
+sr_cksum_fn sr_cksum = sr_cksum_resolve;
+
+static const struct sr_cksum_kernel* sr_cksum_cur = 0;
+
+/* The original loop, one byte pair at a time in network order */
+static uint16_t sr_cksum_ref(const void* _data, int len)
+{
+    const uint8_t* data = _data;
+    uint32_t sum;
+
+    for ( sum = 0; len >= 2; data += 2, len -= 2 )
+    { sum += data[0] << 8 | data[1]; }
+    if ( len > 0 )
+    { sum += data[0] << 8; }
+
+    while ( sum > 0xffff )
+    { sum = (sum >> 16) + (sum & 0xffff); }
+    return htons(~sum);
+} /* -- sr_cksum_ref -- */
+
+/* Add 'len' bytes to a wide sum of native words */
+static uint64_t sr_cksum_add(const uint8_t* p, int len, uint64_t sum)
+{
+    uint64_t w0, w1, w2, w3;
+    uint32_t w;
+    uint16_t h;
+
+    while ( len >= 32 )
+    {
+        memcpy(&w0, p, 8);
+        memcpy(&w1, p + 8, 8);
+        memcpy(&w2, p + 16, 8);
+        memcpy(&w3, p + 24, 8);
+        sum += (w0 & 0xffffffff) + (w0 >> 32) + (w1 & 0xffffffff) + (w1 >> 32) +
+               (w2 & 0xffffffff) + (w2 >> 32) + (w3 & 0xffffffff) + (w3 >> 32);
+        p += 32;
+        len -= 32;
+    }
+    for ( ; len >= 4; p += 4, len -= 4 )
+    {
+        memcpy(&w, p, 4);
+        sum += w;
+    }
+    if ( len >= 2 )
+    {
+        memcpy(&h, p, 2);
+        sum += h;
+        p += 2;
+        len -= 2;
+    }
+    if ( len )
+    {
+        /* -- an odd byte is padded with a zero after it -- */
+        h = 0;
+        memcpy(&h, p, 1);
+        sum += h;
+    }
+    return sum;
+} /* -- sr_cksum_add -- */
+
+static uint16_t sr_cksum_fold(uint64_t sum)
+{
+    while ( sum >> 16 )
+    { sum = (sum & 0xffff) + (sum >> 16); }
+    return (uint16_t)~sum;
+} /* -- sr_cksum_fold -- */
+
+static uint16_t sr_cksum_scalar(const void* data, int len)
+{
+    return sr_cksum_fold(sr_cksum_add((const uint8_t*)data, len, 0));
+} /* -- sr_cksum_scalar -- */
+
+#ifdef SR_CKSUM_X86
+
+__attribute__((target("sse2")))
+static uint16_t sr_cksum_sse2(const void* data, int len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    __m128i zero = _mm_setzero_si128();
+    __m128i a0, a1, v, w;
+    uint32_t lanes[8];
+    uint64_t sum = 0;
+    int n, i;
+
+    if ( len < SR_CKSUM_VEC_MIN )
+    { return sr_cksum_scalar(data, len); }
+
+    while ( len >= 32 )
+    {
+        n = len / 32 < SR_CKSUM_VEC_RUN ? len / 32 : SR_CKSUM_VEC_RUN;
+        a0 = a1 = zero;
+        for ( i = 0; i < n; i++, p += 32 )
+        {
+            v = _mm_loadu_si128((const __m128i*)p);
+            w = _mm_loadu_si128((const __m128i*)(p + 16));
+            a0 = _mm_add_epi32(a0, _mm_unpacklo_epi16(v, zero));
+            a1 = _mm_add_epi32(a1, _mm_unpackhi_epi16(v, zero));
+            a0 = _mm_add_epi32(a0, _mm_unpacklo_epi16(w, zero));
+            a1 = _mm_add_epi32(a1, _mm_unpackhi_epi16(w, zero));
+        }
+        _mm_storeu_si128((__m128i*)lanes, a0);
+        _mm_storeu_si128((__m128i*)(lanes + 4), a1);
+        for ( i = 0; i < 8; i++ )
+        { sum += lanes[i]; }
+        len -= n * 32;
+    }
+    return sr_cksum_fold(sr_cksum_add(p, len, sum));
+} /* -- sr_cksum_sse2 -- */
+
+__attribute__((target("avx2")))
+static uint16_t sr_cksum_avx2(const void* data, int len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i a0, a1, v, w;
+    uint32_t lanes[16];
+    uint64_t sum = 0;
+    int n, i;
+
+    if ( len < SR_CKSUM_VEC_MIN )
+    { return sr_cksum_scalar(data, len); }
+
+    while ( len >= 64 )
+    {
+        n = len / 64 < SR_CKSUM_VEC_RUN ? len / 64 : SR_CKSUM_VEC_RUN;
+        a0 = a1 = zero;
+        for ( i = 0; i < n; i++, p += 64 )
+        {
+            v = _mm256_loadu_si256((const __m256i*)p);
+            w = _mm256_loadu_si256((const __m256i*)(p + 32));
+            a0 = _mm256_add_epi32(a0, _mm256_unpacklo_epi16(v, zero));
+            a1 = _mm256_add_epi32(a1, _mm256_unpackhi_epi16(v, zero));
+            a0 = _mm256_add_epi32(a0, _mm256_unpacklo_epi16(w, zero));
+            a1 = _mm256_add_epi32(a1, _mm256_unpackhi_epi16(w, zero));
+        }
+        _mm256_storeu_si256((__m256i*)lanes, a0);
+        _mm256_storeu_si256((__m256i*)(lanes + 8), a1);
+        for ( i = 0; i < 16; i++ )
+        { sum += lanes[i]; }
+        len -= n * 64;
+    }
+    return sr_cksum_fold(sr_cksum_add(p, len, sum));
+} /* -- sr_cksum_avx2 -- */
+
+#endif /* SR_CKSUM_X86 */
+
+static const struct sr_cksum_kernel sr_cksum_kernels[] =
+{
+    { "ref",    sr_cksum_ref },
+    { "scalar", sr_cksum_scalar },
+#ifdef SR_CKSUM_X86
+    { "sse2",   sr_cksum_sse2 },
+    { "avx2",   sr_cksum_avx2 },
+#endif
+    { 0, 0 }
+};
+
+static int sr_cksum_runs(const struct sr_cksum_kernel* k)
+{
+#ifdef SR_CKSUM_X86
+    __builtin_cpu_init();
+    if ( k->fn == sr_cksum_sse2 )
+    { return __builtin_cpu_supports("sse2"); }
+    if ( k->fn == sr_cksum_avx2 )
+    { return __builtin_cpu_supports("avx2"); }
+#endif
+    return 1;
+} /* -- sr_cksum_runs -- */
+
+const struct sr_cksum_kernel* sr_cksum_kernel(int i)
+{
+    const struct sr_cksum_kernel* k;
+
+    for ( k = sr_cksum_kernels; k->name; k++ )
+    {
+        if ( sr_cksum_runs(k) && i-- == 0 )
+        { return k; }
+    }
+    return 0;
+} /* -- sr_cksum_kernel -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cksum_init(..)
+ * Scope:  Global
+ *
+ * The last kernel the CPU runs is the fastest.  Safe to race with the
+ * first sr_cksum calls of other threads: they all pick the same one.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_cksum_init(void)
+{
+    const struct sr_cksum_kernel* k;
+    int i;
+
+    for ( i = 0; (k = sr_cksum_kernel(i)) != 0; i++ )
+    { sr_cksum_cur = k; }
+    __atomic_store_n(&sr_cksum, sr_cksum_cur->fn, __ATOMIC_RELEASE);
+} /* -- sr_cksum_init -- */
+
+static uint16_t sr_cksum_resolve(const void* data, int len)
+{
+    sr_cksum_init();
+    return sr_cksum(data, len);
+} /* -- sr_cksum_resolve -- */
+
+int sr_cksum_use(const char* name)
+{
+    const struct sr_cksum_kernel* k;
+    int i;
+
+    for ( i = 0; (k = sr_cksum_kernel(i)) != 0; i++ )
+    {
+        if ( strcmp(k->name, name) == 0 )
+        {
+            sr_cksum_cur = k;
+            __atomic_store_n(&sr_cksum, k->fn, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+} /* -- sr_cksum_use -- */
+
+const char* sr_cksum_name(void)
+{
+    if ( sr_cksum_cur == 0 )
+    { sr_cksum_init(); }
+    return sr_cksum_cur->name;
+} /* -- sr_cksum_name -- */
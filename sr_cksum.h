@@ -0,0 +1,53 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum.h
+ *
+ * Description:
+ *
+ * The Internet checksum (RFC 1071) with several kernels that give the
+ * same result bit for bit: the original byte-pair loop, a scalar one
+ * that adds 64 bits at a time, and on x86 SSE2 and AVX2 ones for long
+ * buffers.  sr_cksum calls the best kernel the CPU has; the choice is
+ * made by sr_cksum_init at startup, or else on the first call.
+ *
+ * Words are added as they sit in memory: one's complement sums come out
+ * the same in either byte order, so the result is in network order
+ * without swapping anything, as cksum() always returned it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CKSUM_H
+#define SR_CKSUM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+typedef uint16_t (*sr_cksum_fn)(const void* data, int len);
+
+struct sr_cksum_kernel
+{
+    const char* name;
+    sr_cksum_fn fn;
+};
+
+/* The checksum of 'len' bytes, with the kernel in use */
+extern sr_cksum_fn sr_cksum;
+
+/* Pick the fastest kernel this CPU runs */
+void sr_cksum_init(void);
+
+/* Use the kernel called 'name'. Returns 0, or -1 if there is none this
+   CPU runs by that name. */
+int  sr_cksum_use(const char* name);
+
+/* The kernel in use */
+const char* sr_cksum_name(void);
+
+/* The i-th kernel this CPU runs, slowest first, 0 past the last */
+const struct sr_cksum_kernel* sr_cksum_kernel(int i);
+
+#endif /* -- SR_CKSUM_H -- */
@@ -0,0 +1,149 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksumbench.c
+ *
+ * Description:
+ *
+ * Checks that every checksum kernel this CPU runs (see sr_cksum.h) gives
+ * the reference result for random buffers of every length up to a few
+ * kilobytes, at every alignment, and all zeros or all ones; then times
+ * each kernel over a range of packet sizes:
+ *
+ *   sr_cksumbench [-n iterations] [-s size,...]
+ *
+ * Exits with 2 if any kernel disagrees.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sr_cksum.h"
+
+#define CB_BUF      (65536 + 64)
+#define CB_CHECK    4096            /* every length up to this is checked */
+#define CB_SIZES    16
+
+static uint64_t cb_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- cb_now -- */
+
+/* Compare every kernel against the reference over one buffer */
+static int cb_check(const uint8_t* p, int len)
+{
+    const struct sr_cksum_kernel* ref = sr_cksum_kernel(0);
+    const struct sr_cksum_kernel* k;
+    uint16_t want = ref->fn(p, len), got;
+    int i, bad = 0;
+
+    for ( i = 1; (k = sr_cksum_kernel(i)) != 0; i++ )
+    {
+        if ( (got = k->fn(p, len)) != want )
+        {
+            fprintf(stderr, "%s: length %d at offset %d gives %04x, %s gives %04x\n",
+                    k->name, len, (int)((unsigned long)p & 63), got, ref->name, want);
+            bad = 1;
+        }
+    }
+    return bad;
+} /* -- cb_check -- */
+
+static int cb_verify(uint8_t* buf)
+{
+    int len, off, i, bad = 0;
+
+    for ( i = 0; i < CB_BUF; i++ )
+    { buf[i] = (uint8_t)rand(); }
+    for ( len = 0; len <= CB_CHECK; len++ )
+    {
+        for ( off = 0; off < 8; off++ )
+        { bad |= cb_check(buf + off, len); }
+    }
+    bad |= cb_check(buf, 65535);
+
+    /* -- the sums that fold to 0 and to 0xffff -- */
+    memset(buf, 0, CB_BUF);
+    bad |= cb_check(buf, 1500) | cb_check(buf, 65535);
+    memset(buf, 0xff, CB_BUF);
+    bad |= cb_check(buf, 1500) | cb_check(buf, 65535) | cb_check(buf, 3);
+    return bad;
+} /* -- cb_verify -- */
+
+static void usage(char* argv0)
+{
+    fprintf(stderr, "Format: %s [-n iterations] [-s size,...]\n", argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    int sizes[CB_SIZES] = { 20, 64, 128, 256, 576, 1500, 4096, 9000, 65535 };
+    int nsizes = 9, iters = 0, n, i, j, c;
+    const struct sr_cksum_kernel* k;
+    volatile uint16_t sink = 0;
+    uint8_t* buf;
+    uint64_t t0, ns;
+    char* s;
+
+    while ( (c = getopt(argc, argv, "hn:s:")) != EOF )
+    {
+        switch ( c )
+        {
+            case 'n':
+                iters = atoi(optarg);
+                break;
+            case 's':
+                for ( nsizes = 0, s = strtok(optarg, ","); s && nsizes < CB_SIZES;
+                      s = strtok(0, ",") )
+                {
+                    if ( (sizes[nsizes] = atoi(s)) <= 0 || sizes[nsizes] > 65535 )
+                    {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    nsizes++;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if ( (buf = (uint8_t*)malloc(CB_BUF)) == 0 )
+    { return 1; }
+    srand(1);
+    if ( cb_verify(buf) )
+    { return 2; }
+    for ( i = 0; i < CB_BUF; i++ )
+    { buf[i] = (uint8_t)rand(); }
+
+    sr_cksum_init();
+    printf("kernels agree; %s is the one in use\n\n%8s", sr_cksum_name(), "bytes");
+    for ( i = 0; (k = sr_cksum_kernel(i)) != 0; i++ )
+    { printf(" %14s", k->name); }
+    printf("   (ns/call, GB/s)\n");
+
+    for ( j = 0; j < nsizes; j++ )
+    {
+        /* -- about 64MB through each kernel, unless -n says otherwise -- */
+        n = iters ? iters : (64 << 20) / sizes[j] + 1;
+        printf("%8d", sizes[j]);
+        for ( i = 0; (k = sr_cksum_kernel(i)) != 0; i++ )
+        {
+            sink += k->fn(buf, sizes[j]);
+            t0 = cb_now();
+            for ( c = 0; c < n; c++ )
+            { sink += k->fn(buf + (c & 7), sizes[j]); }
+            ns = cb_now() - t0;
+            printf(" %7.1f %6.2f", (double)ns / n, (double)sizes[j] * n / ns);
+        }
+        printf("\n");
+    }
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,97 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_deque.c
+ *
+ * Description:
+ *
+ * Chase-Lev work-stealing deque, see sr_deque.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_deque.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_deque_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_deque_init(struct sr_deque* d, unsigned int size)
+{
+    unsigned int n = 1;
+
+    /* -- REQUIRES -- */
+    assert(d);
+    assert(size > 0);
+
+    while ( n < size )
+    { n <<= 1; }
+
+    memset(d, 0, sizeof(struct sr_deque));
+    if ( (d->buf = (void**)calloc(n, sizeof(void*))) == 0 )
+    { return -1; }
+    d->mask = n - 1;
+
+    return 0;
+} /* -- sr_deque_init -- */
+
+void sr_deque_destroy(struct sr_deque* d)
+{
+    free(d->buf);
+    d->buf = 0;
+} /* -- sr_deque_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_deque_push(..)
+ * Scope: Global
+ *
+ * The buffer does not grow: a slot is only reused once 'top' has moved
+ * past it, so a thief that read it but has not yet claimed it keeps the
+ * deque looking full.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_deque_push(struct sr_deque* d, void* obj)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+    if ( b - t > d->mask )
+    { return -1; }
+
+    __atomic_store_n(&d->buf[b & d->mask], obj, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return 0;
+} /* -- sr_deque_push -- */
+
+int sr_deque_steal(struct sr_deque* d, void** obj)
+{
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    long b;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+    if ( t >= b )
+    { return SR_DEQUE_EMPTY; }
+
+    *obj = __atomic_load_n(&d->buf[t & d->mask], __ATOMIC_RELAXED);
+    if ( !__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+    { return SR_DEQUE_ABORT; }
+
+    return SR_DEQUE_OK;
+} /* -- sr_deque_steal -- */
+
+long sr_deque_size(struct sr_deque* d)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+    return b > t ? b - t : 0;
+} /* -- sr_deque_size -- */
@@ -0,0 +1,48 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_deque.h
+ *
+ * Description:
+ *
+ * Fixed-size Chase-Lev work-stealing deque of pointers (after Le, Pop,
+ * Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak
+ * Memory Models").  One owner thread pushes at the bottom; any thread may
+ * steal from the top.  The worker pool makes the dispatcher the owner of
+ * every worker's deque and has the workers themselves take from the top
+ * too, so batches start in the order they were queued.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_DEQUE_H
+#define SR_DEQUE_H
+
+#include "sr_ring.h"
+
+#define SR_DEQUE_OK     0
+#define SR_DEQUE_EMPTY  1
+#define SR_DEQUE_ABORT  2   /* lost a race with another thief, retry */
+
+struct sr_deque
+{
+    long top;                   /* advanced by thieves */
+    char pad0[SR_CACHELINE - sizeof(long)];
+    long bottom;                /* advanced by the owner */
+    char pad1[SR_CACHELINE - sizeof(long)];
+    void** buf;
+    long mask;
+};
+
+/* 'size' is rounded up to a power of two. Returns 0 on success. */
+int  sr_deque_init(struct sr_deque* d, unsigned int size);
+void sr_deque_destroy(struct sr_deque* d);
+
+/* Owner only. Returns 0 on success, -1 if the deque is full. */
+int  sr_deque_push(struct sr_deque* d, void* obj);
+
+/* Any thread. Returns SR_DEQUE_OK with the oldest entry in '*obj',
+   SR_DEQUE_EMPTY or SR_DEQUE_ABORT. */
+int  sr_deque_steal(struct sr_deque* d, void** obj);
+
+/* Entries queued, approximate while thieves run. */
+long sr_deque_size(struct sr_deque* d);
+
+#endif /* -- SR_DEQUE_H -- */
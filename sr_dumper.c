@@ -2,6 +2,7 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <string.h>
 #include "sr_dumper.h"
 
 static void
@@ -63,6 +64,25 @@ sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp)
         (void)fwrite((char *)sp, h->caplen, 1, fp);
 }
 
+/*
+ * Same record as sr_dump, into memory.
+ */
+size_t
+sr_dump_record(unsigned char *out, const struct pcap_pkthdr *h,
+               const unsigned char *sp)
+{
+        struct pcap_sf_pkthdr sf_hdr;
+
+        sf_hdr.ts.tv_sec  = h->ts.tv_sec;
+        sf_hdr.ts.tv_usec = h->ts.tv_usec;
+        sf_hdr.caplen     = h->caplen;
+        sf_hdr.len        = h->len;
+        memcpy(out, &sf_hdr, sizeof(sf_hdr));
+        memcpy(out + sizeof(sf_hdr), sp, h->caplen);
+
+        return sizeof(sf_hdr) + h->caplen;
+}
+
 void
 sr_dump_close(FILE *fp)
 {
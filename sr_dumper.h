@@ -13,6 +13,7 @@
 #endif /* _DARWIN_ */
 
 #include <sys/time.h>
+#include <stddef.h>
 
 #define PCAP_VERSION_MAJOR 2
 #define PCAP_VERSION_MINOR 4
@@ -73,6 +74,14 @@ FILE* sr_dump_open(const char *fname, int thiszone, int snaplen);
  */
 void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
 
+/**
+ * Write a packet record (header and data) into 'out', which must have room
+ * for sizeof(struct pcap_sf_pkthdr) + h->caplen bytes. Returns the bytes
+ * used. This lets a writer gather many records into one large write.
+ */
+size_t sr_dump_record(unsigned char *out, const struct pcap_pkthdr *h,
+                      const unsigned char *sp);
+
 /**
  * Close the file
  */
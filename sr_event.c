@@ -0,0 +1,200 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.c
+ *
+ * Description:
+ *
+ * Single-threaded event loop (sr -E).  The I/O backend's descriptor (the
+ * server socket by default), a one second
+ * timerfd driving the ARP cache housekeeping and a signalfd for control
+ * are all multiplexed through one epoll instance, so forwarding and the
+ * ARP sweeper share a thread and the ARP cache needs no locking.
+ *
+ * Signals: SIGINT/SIGTERM shut the router down cleanly, SIGUSR1 dumps the
+ * ARP cache and the counters to stderr (sr_dump_state; without -E a
+ * thread of sr_init's waits for it).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#ifdef _LINUX_
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_arpcache.h"
+#include "sr_io.h"
+#include "sr_worker.h"
+
+#define SR_EVENT_MAX 8
+
+#ifdef _LINUX_
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_add(..)
+ * Scope:  Local
+ *
+ * Register 'fd' for input on the epoll instance.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_event_add(int epfd, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl(..):sr_event.c::sr_event_add");
+        return -1;
+    }
+    return 0;
+} /* -- sr_event_add -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_signal(..)
+ * Scope:  Local
+ *
+ * Handle one signal read from the signalfd. Returns 1 to keep running,
+ * 0 to shut down.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_event_signal(struct sr_instance* sr, int sfd)
+{
+    struct signalfd_siginfo si;
+
+    if (read(sfd, &si, sizeof(si)) != sizeof(si))
+        return 1;
+
+    switch (si.ssi_signo) {
+        case SIGUSR1:
+            sr_dump_state(sr);
+            return 1;
+        default:
+            fprintf(stderr, "Caught signal %d, shutting down\n",
+                    (int)si.ssi_signo);
+            return 0;
+    }
+} /* -- sr_event_signal -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_loop(..)
+ * Scope:  Global
+ *
+ * Run the router until the session closes, an error occurs or a
+ * shutdown signal arrives. Must be called after sr_init with
+ * sr->event_mode set, so that no ARP thread is running. With workers
+ * (-W) this thread only polls the backend and dispatches.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on clean shutdown, -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_event_loop(struct sr_instance* sr)
+{
+    struct epoll_event events[SR_EVENT_MAX];
+    struct itimerspec its;
+    sigset_t mask;
+    uint64_t expirations;
+    int epfd = -1, tfd = -1, sfd = -1, iofd;
+    int n, i, ret = 1;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->event_mode);
+
+    /* -- control signals are delivered through a descriptor -- */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        perror("signalfd(..):sr_event.c::sr_event_loop");
+        ret = -1;
+        goto done;
+    }
+
+    /* -- ARP cache housekeeping, once a second -- */
+    if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        perror("timerfd_create(..):sr_event.c::sr_event_loop");
+        ret = -1;
+        goto done;
+    }
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = 1;
+    its.it_interval.tv_sec = 1;
+    timerfd_settime(tfd, 0, &its, NULL);
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1(..):sr_event.c::sr_event_loop");
+        ret = -1;
+        goto done;
+    }
+
+    iofd = sr->io->fd(sr);
+    if (sr_event_add(epfd, iofd) || sr_event_add(epfd, tfd) ||
+        sr_event_add(epfd, sfd)) {
+        ret = -1;
+        goto done;
+    }
+
+    while (ret == 1) {
+        n = epoll_wait(epfd, events, SR_EVENT_MAX, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait(..):sr_event.c::sr_event_loop");
+            ret = -1;
+            break;
+        }
+
+        for (i = 0; i < n && ret == 1; i++) {
+            if (events[i].data.fd == iofd) {
+                ret = sr->io->poll(sr, 0);
+            }
+            else if (events[i].data.fd == tfd) {
+                if (read(tfd, &expirations, sizeof(expirations)) > 0)
+                    sr_arpcache_tick(sr);
+            }
+            else if (events[i].data.fd == sfd) {
+                ret = sr_event_signal(sr, sfd);
+            }
+        }
+    }
+
+done:
+    if (epfd != -1)
+        close(epfd);
+    if (tfd != -1)
+        close(tfd);
+    if (sfd != -1)
+        close(sfd);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+    return ret == -1 ? -1 : 0;
+} /* -- sr_event_loop -- */
+
+#else /* _LINUX_ */
+
+int sr_event_loop(struct sr_instance* sr)
+{
+    fprintf(stderr, "Error: the event loop (-E) requires Linux\n");
+    return -1;
+} /* -- sr_event_loop -- */
+
+#endif /* _LINUX_ */
@@ -0,0 +1,580 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.c
+ *
+ * Description:
+ *
+ * Capture filter compiler and interpreter, see sr_filter.h
+ *
+ * The expression is parsed into a small tree first.  Code generation
+ * walks it with a pair of labels, where control goes if the node is
+ * true and where if it is false, so 'and' and 'or' short-circuit and
+ * 'not' only swaps the labels.  Labels are always placed after the
+ * jumps that use them and are patched into relative offsets at the end.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_capture.h"
+#include "sr_filter.h"
+
+#define SR_FILTER_NODES     128
+#define SR_FILTER_TESTS     4       /* comparisons in one primitive */
+#define SR_FILTER_TOKLEN    64
+
+/* Frame offsets */
+#define OFF_ETHERTYPE   12
+#define OFF_IP_PROTO    (sizeof(struct sr_ethernet_hdr) + 9)
+#define OFF_IP_SRC      (sizeof(struct sr_ethernet_hdr) + 12)
+#define OFF_IP_DST      (sizeof(struct sr_ethernet_hdr) + 16)
+
+#define NODE_TEST   1
+#define NODE_AND    2
+#define NODE_OR     3
+#define NODE_NOT    4
+
+/* One comparison: load, mask, compare */
+struct sr_ftest
+{
+    uint16_t op;
+    uint32_t off;
+    uint32_t mask;          /* 0 or all ones = none */
+    uint32_t k;
+};
+
+struct sr_fnode
+{
+    int type;
+    int a, b;                                   /* children */
+    struct sr_ftest tests[SR_FILTER_TESTS];     /* all must hold */
+    int ntests;
+};
+
+struct sr_fcomp
+{
+    struct sr_filter* f;
+    const char* p;                          /* next character to scan */
+    char tok[SR_FILTER_TOKLEN];             /* current token, "" at the end */
+    struct sr_fnode nodes[SR_FILTER_NODES];
+    int nnodes;
+    int labels[SR_FILTER_MAX];              /* label -> instruction */
+    int nlabels;
+    int jt[SR_FILTER_MAX];                  /* instruction -> label, or -1 */
+    int jf[SR_FILTER_MAX];
+    int error;
+};
+
+static void sr_filter_error(struct sr_fcomp* c, const char* what)
+{
+    if ( c->error == 0 )
+    {
+        fprintf(stderr, "capture filter: %s%s%s\n", what,
+                c->tok[0] ? " at " : "", c->tok);
+    }
+    c->error = 1;
+} /* -- sr_filter_error -- */
+
+/* Scan the next token: a word or a parenthesis */
+static void sr_filter_next(struct sr_fcomp* c)
+{
+    int n = 0;
+
+    while ( isspace((unsigned char)*c->p) )
+    { c->p++; }
+
+    if ( *c->p == '(' || *c->p == ')' )
+    { c->tok[n++] = *c->p++; }
+    else
+    {
+        while ( *c->p && !isspace((unsigned char)*c->p) &&
+                *c->p != '(' && *c->p != ')' )
+        {
+            if ( n < SR_FILTER_TOKLEN - 1 )
+            { c->tok[n++] = *c->p; }
+            c->p++;
+        }
+    }
+    c->tok[n] = 0;
+} /* -- sr_filter_next -- */
+
+static int sr_filter_is(struct sr_fcomp* c, const char* word)
+{ return strcmp(c->tok, word) == 0; }
+
+static int sr_filter_node(struct sr_fcomp* c, int type, int a, int b)
+{
+    struct sr_fnode* n;
+
+    if ( c->nnodes == SR_FILTER_NODES )
+    {
+        sr_filter_error(c, "expression too long");
+        return 0;
+    }
+    n = &c->nodes[c->nnodes];
+    memset(n, 0, sizeof(struct sr_fnode));
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    return c->nnodes++;
+} /* -- sr_filter_node -- */
+
+static void sr_filter_test(struct sr_fcomp* c, int node, uint16_t op, uint32_t off,
+                           uint32_t mask, uint32_t k)
+{
+    struct sr_fnode* n = &c->nodes[node];
+
+    if ( c->error )
+    { return; }
+    assert(n->ntests < SR_FILTER_TESTS);
+    n->tests[n->ntests].op = op;
+    n->tests[n->ntests].off = off;
+    n->tests[n->ntests].mask = mask;
+    n->tests[n->ntests].k = k;
+    n->ntests++;
+} /* -- sr_filter_test -- */
+
+/* A test node for an IPv4 frame, optionally of protocol 'proto' */
+static int sr_filter_ip(struct sr_fcomp* c, int proto)
+{
+    int n = sr_filter_node(c, NODE_TEST, 0, 0);
+
+    sr_filter_test(c, n, SR_F_LDH, OFF_ETHERTYPE, 0, ethertype_ip);
+    if ( proto >= 0 )
+    { sr_filter_test(c, n, SR_F_LDB, OFF_IP_PROTO, 0, proto); }
+    return n;
+} /* -- sr_filter_ip -- */
+
+/* Read a number token in [0, max] */
+static unsigned long sr_filter_number(struct sr_fcomp* c, unsigned long max)
+{
+    char* end;
+    unsigned long v;
+
+    sr_filter_next(c);
+    v = strtoul(c->tok, &end, 0);
+    if ( c->tok[0] == 0 || *end || v > max )
+    {
+        sr_filter_error(c, "expected a number");
+        return 0;
+    }
+    return v;
+} /* -- sr_filter_number -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_address(..)
+ * Scope:  Local
+ *
+ * host A.B.C.D or net A.B.C.D/len, in the direction 'dir' (0 = either)
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_filter_address(struct sr_fcomp* c, int dir)
+{
+    struct in_addr a;
+    char* slash;
+    uint32_t mask = 0xffffffff;
+    int net, plen, src, dst;
+
+    net = sr_filter_is(c, "net");
+    if ( !net && !sr_filter_is(c, "host") )
+    {
+        sr_filter_error(c, "expected host or net");
+        return 0;
+    }
+
+    sr_filter_next(c);
+    slash = strchr(c->tok, '/');
+    if ( net && slash )
+    {
+        *slash = 0;
+        plen = atoi(slash + 1);
+        if ( plen < 0 || plen > 32 )
+        {
+            sr_filter_error(c, "bad prefix length");
+            return 0;
+        }
+        mask = plen ? 0xffffffff << (32 - plen) : 0;
+    }
+    if ( inet_aton(c->tok, &a) == 0 )
+    {
+        sr_filter_error(c, "expected an address");
+        return 0;
+    }
+
+    /* -- a /0 net is any IPv4 frame -- */
+    src = sr_filter_ip(c, -1);
+    dst = sr_filter_ip(c, -1);
+    if ( mask != 0 )
+    {
+        sr_filter_test(c, src, SR_F_LDW, OFF_IP_SRC, mask, ntohl(a.s_addr) & mask);
+        sr_filter_test(c, dst, SR_F_LDW, OFF_IP_DST, mask, ntohl(a.s_addr) & mask);
+    }
+
+    if ( dir == 1 )
+    { return src; }
+    if ( dir == 2 )
+    { return dst; }
+    return sr_filter_node(c, NODE_OR, src, dst);
+} /* -- sr_filter_address -- */
+
+static int sr_filter_or(struct sr_fcomp* c);
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_primary(..)
+ * Scope:  Local
+ *
+ * Parse one primitive, a negation or a parenthesised expression. The
+ * current token is its first word; on return it is the one after it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_filter_primary(struct sr_fcomp* c)
+{
+    int n = 0;
+
+    if ( sr_filter_is(c, "not") || sr_filter_is(c, "!") )
+    {
+        sr_filter_next(c);
+        return sr_filter_node(c, NODE_NOT, sr_filter_primary(c), 0);
+    }
+
+    if ( sr_filter_is(c, "(") )
+    {
+        sr_filter_next(c);
+        n = sr_filter_or(c);
+        if ( !sr_filter_is(c, ")") )
+        { sr_filter_error(c, "expected )"); }
+    }
+    else if ( sr_filter_is(c, "arp") )
+    {
+        n = sr_filter_node(c, NODE_TEST, 0, 0);
+        sr_filter_test(c, n, SR_F_LDH, OFF_ETHERTYPE, 0, ethertype_arp);
+    }
+    else if ( sr_filter_is(c, "ip") )
+    { n = sr_filter_ip(c, -1); }
+    else if ( sr_filter_is(c, "icmp") )
+    { n = sr_filter_ip(c, ip_protocol_icmp); }
+    else if ( sr_filter_is(c, "tcp") )
+    { n = sr_filter_ip(c, ip_protocol_tcp); }
+    else if ( sr_filter_is(c, "udp") )
+    { n = sr_filter_ip(c, ip_protocol_udp); }
+    else if ( sr_filter_is(c, "proto") )
+    { n = sr_filter_ip(c, sr_filter_number(c, 255)); }
+    else if ( sr_filter_is(c, "icmp-type") )
+    {
+        n = sr_filter_ip(c, ip_protocol_icmp);
+        sr_filter_test(c, n, SR_F_LDB_L4, 0, 0, sr_filter_number(c, 255));
+    }
+    else if ( sr_filter_is(c, "src") || sr_filter_is(c, "dst") )
+    {
+        int dir = sr_filter_is(c, "src") ? 1 : 2;
+        sr_filter_next(c);
+        n = sr_filter_address(c, dir);
+    }
+    else if ( sr_filter_is(c, "host") || sr_filter_is(c, "net") )
+    { n = sr_filter_address(c, 0); }
+    else if ( sr_filter_is(c, "iface") )
+    {
+        sr_filter_next(c);
+        if ( c->tok[0] == 0 )
+        { sr_filter_error(c, "expected an interface name"); }
+        n = sr_filter_node(c, NODE_TEST, 0, 0);
+        sr_filter_test(c, n, SR_F_LDIF, 0, 0, sr_filter_iface_hash(c->tok));
+    }
+    else if ( sr_filter_is(c, "in") || sr_filter_is(c, "out") )
+    {
+        n = sr_filter_node(c, NODE_TEST, 0, 0);
+        sr_filter_test(c, n, SR_F_LDDIR, 0, 0,
+                       sr_filter_is(c, "in") ? SR_CAPTURE_IN : SR_CAPTURE_OUT);
+    }
+    else
+    { sr_filter_error(c, c->tok[0] ? "unknown primitive" : "unexpected end"); }
+
+    sr_filter_next(c);
+    return n;
+} /* -- sr_filter_primary -- */
+
+/* primary { [and] primary } */
+static int sr_filter_and(struct sr_fcomp* c)
+{
+    int n = sr_filter_primary(c);
+
+    while ( !c->error && c->tok[0] && !sr_filter_is(c, "or") && !sr_filter_is(c, ")") )
+    {
+        if ( sr_filter_is(c, "and") )
+        { sr_filter_next(c); }
+        n = sr_filter_node(c, NODE_AND, n, sr_filter_primary(c));
+    }
+    return n;
+} /* -- sr_filter_and -- */
+
+/* and { or and } */
+static int sr_filter_or(struct sr_fcomp* c)
+{
+    int n = sr_filter_and(c);
+
+    while ( !c->error && sr_filter_is(c, "or") )
+    {
+        sr_filter_next(c);
+        n = sr_filter_node(c, NODE_OR, n, sr_filter_and(c));
+    }
+    return n;
+} /* -- sr_filter_or -- */
+
+static int sr_filter_label(struct sr_fcomp* c)
+{
+    if ( c->nlabels == SR_FILTER_MAX )
+    {
+        sr_filter_error(c, "program too long");
+        return 0;
+    }
+    c->labels[c->nlabels] = -1;
+    return c->nlabels++;
+} /* -- sr_filter_label -- */
+
+static void sr_filter_place(struct sr_fcomp* c, int label)
+{ c->labels[label] = c->f->n; }
+
+static void sr_filter_emit(struct sr_fcomp* c, uint16_t op, uint32_t k, int jt, int jf)
+{
+    struct sr_filter_insn* i;
+
+    if ( c->f->n == SR_FILTER_MAX )
+    {
+        sr_filter_error(c, "program too long");
+        return;
+    }
+    i = &c->f->insns[c->f->n];
+    i->op = op;
+    i->k = k;
+    i->jt = 0;
+    i->jf = 0;
+    c->jt[c->f->n] = jt;
+    c->jf[c->f->n] = jf;
+    c->f->n++;
+} /* -- sr_filter_emit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_gen(..)
+ * Scope:  Local
+ *
+ * Emit code for node 'n' that continues at label 't' if it holds and
+ * at label 'f' if not.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_filter_gen(struct sr_fcomp* c, int n, int t, int f)
+{
+    struct sr_fnode* node = &c->nodes[n];
+    struct sr_ftest* x;
+    int i, mid;
+
+    if ( c->error )
+    { return; }
+
+    switch ( node->type )
+    {
+        case NODE_AND:
+            mid = sr_filter_label(c);
+            sr_filter_gen(c, node->a, mid, f);
+            sr_filter_place(c, mid);
+            sr_filter_gen(c, node->b, t, f);
+            break;
+        case NODE_OR:
+            mid = sr_filter_label(c);
+            sr_filter_gen(c, node->a, t, mid);
+            sr_filter_place(c, mid);
+            sr_filter_gen(c, node->b, t, f);
+            break;
+        case NODE_NOT:
+            sr_filter_gen(c, node->a, f, t);
+            break;
+        case NODE_TEST:
+            for ( i = 0; i < node->ntests; i++ )
+            {
+                x = &node->tests[i];
+                sr_filter_emit(c, x->op, x->off, -1, -1);
+                if ( x->mask && x->mask != 0xffffffff )
+                { sr_filter_emit(c, SR_F_AND, x->mask, -1, -1); }
+                /* -- fall through to the next test while they hold -- */
+                if ( i < node->ntests - 1 )
+                {
+                    mid = sr_filter_label(c);
+                    sr_filter_emit(c, SR_F_JEQ, x->k, mid, f);
+                    sr_filter_place(c, mid);
+                }
+                else
+                { sr_filter_emit(c, SR_F_JEQ, x->k, t, f); }
+            }
+            break;
+        default:
+            assert(0);
+    }
+} /* -- sr_filter_gen -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_compile(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_filter_compile(struct sr_filter* f, const char* expr)
+{
+    struct sr_fcomp* c;
+    int root, accept, reject, pc, ret;
+
+    /* -- REQUIRES -- */
+    assert(f);
+    assert(expr);
+
+    f->n = 0;
+    if ( (c = (struct sr_fcomp*)calloc(1, sizeof(struct sr_fcomp))) == 0 )
+    { return -1; }
+    c->f = f;
+    c->p = expr;
+
+    sr_filter_next(c);
+    if ( c->tok[0] == 0 )
+    {
+        free(c);
+        return 0;
+    }
+    root = sr_filter_or(c);
+    if ( !c->error && c->tok[0] )
+    { sr_filter_error(c, "unexpected token"); }
+
+    accept = sr_filter_label(c);
+    reject = sr_filter_label(c);
+    sr_filter_gen(c, root, accept, reject);
+    sr_filter_place(c, accept);
+    sr_filter_emit(c, SR_F_RET, 1, -1, -1);
+    sr_filter_place(c, reject);
+    sr_filter_emit(c, SR_F_RET, 0, -1, -1);
+
+    /* -- labels to offsets, all of them forward -- */
+    for ( pc = 0; !c->error && pc < (int)f->n; pc++ )
+    {
+        if ( f->insns[pc].op != SR_F_JEQ )
+        { continue; }
+        assert(c->labels[c->jt[pc]] > pc && c->labels[c->jf[pc]] > pc);
+        f->insns[pc].jt = c->labels[c->jt[pc]] - pc - 1;
+        f->insns[pc].jf = c->labels[c->jf[pc]] - pc - 1;
+    }
+
+    ret = c->error ? -1 : 0;
+    if ( ret != 0 )
+    { f->n = 0; }
+    free(c);
+    return ret;
+} /* -- sr_filter_compile -- */
+
+uint32_t sr_filter_iface_hash(const char* name)
+{
+    uint32_t h = 2166136261U;   /* FNV-1a */
+
+    while ( *name )
+    {
+        h ^= (unsigned char)*name++;
+        h *= 16777619U;
+    }
+    return h;
+} /* -- sr_filter_iface_hash -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_run(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_filter_run(const struct sr_filter* f, const uint8_t* p, unsigned int len,
+                  const char* iface, int dir)
+{
+    const struct sr_filter_insn* i;
+    unsigned int pc = 0, off;
+    uint32_t a = 0;
+
+    if ( f->n == 0 )
+    { return 1; }
+
+    while ( pc < f->n )
+    {
+        i = &f->insns[pc++];
+        switch ( i->op )
+        {
+            case SR_F_LDB:
+                if ( i->k >= len )
+                { return 0; }
+                a = p[i->k];
+                break;
+            case SR_F_LDH:
+                if ( i->k + 2 > len )
+                { return 0; }
+                a = ((uint32_t)p[i->k] << 8) | p[i->k + 1];
+                break;
+            case SR_F_LDW:
+                if ( i->k + 4 > len )
+                { return 0; }
+                a = ((uint32_t)p[i->k] << 24) | ((uint32_t)p[i->k + 1] << 16) |
+                    ((uint32_t)p[i->k + 2] << 8) | p[i->k + 3];
+                break;
+            case SR_F_LDB_L4:
+                off = sizeof(struct sr_ethernet_hdr);
+                if ( off >= len )
+                { return 0; }
+                off += (p[off] & 0x0f) * 4 + i->k;
+                if ( off >= len )
+                { return 0; }
+                a = p[off];
+                break;
+            case SR_F_LDIF:
+                a = sr_filter_iface_hash(iface);
+                break;
+            case SR_F_LDDIR:
+                a = dir;
+                break;
+            case SR_F_AND:
+                a &= i->k;
+                break;
+            case SR_F_JEQ:
+                pc += (a == i->k) ? i->jt : i->jf;
+                break;
+            case SR_F_RET:
+                return i->k != 0;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+} /* -- sr_filter_run -- */
+
+void sr_filter_dump(const struct sr_filter* f, FILE* out)
+{
+    static const char* names[] =
+    { "?", "ldb", "ldh", "ldw", "ldb l4", "ldif", "lddir", "and", "jeq", "ret" };
+    const struct sr_filter_insn* i;
+    unsigned int pc;
+
+    for ( pc = 0; pc < f->n; pc++ )
+    {
+        i = &f->insns[pc];
+        if ( i->op == SR_F_JEQ )
+        {
+            fprintf(out, "(%03u) %-6s #0x%x jt %u jf %u\n", pc, names[i->op], i->k,
+                    pc + 1 + i->jt, pc + 1 + i->jf);
+        }
+        else if ( i->op == SR_F_LDIF || i->op == SR_F_LDDIR )
+        { fprintf(out, "(%03u) %s\n", pc, names[i->op]); }
+        else if ( i->op >= SR_F_AND && i->op <= SR_F_RET )
+        { fprintf(out, "(%03u) %-6s #0x%x\n", pc, names[i->op], i->k); }
+        else if ( i->op <= SR_F_LDB_L4 )
+        { fprintf(out, "(%03u) %-6s [%u]\n", pc, names[i->op], i->k); }
+    }
+} /* -- sr_filter_dump -- */
@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.h
+ *
+ * Description:
+ *
+ * Capture filters (-F).  The expression is parsed once at startup and
+ * compiled into a program for a small accumulator machine in the style
+ * of classic BPF: loads from the frame (or of its interface and
+ * direction), a mask, compare-and-branch and return.  Branches only go
+ * forward, so every run ends within the length of the program, and a
+ * load past the end of the frame rejects it.
+ *
+ * Expressions are primitives combined with 'and' (or just written side
+ * by side), 'or', 'not' and parentheses:
+ *
+ *   arp  ip  icmp  tcp  udp      frame or IP protocol
+ *   proto N                      IP protocol number
+ *   [src|dst] host A.B.C.D       either address if neither is given
+ *   [src|dst] net A.B.C.D/len
+ *   icmp-type N                  ICMP messages of type N
+ *   iface NAME                   received or sent on interface NAME
+ *   in  out                      received / sent by the router
+ *
+ * e.g. -F "icmp and not icmp-type 8" or -F "iface eth1 and (udp or arp)".
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FILTER_H
+#define SR_FILTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_FILTER_MAX   256     /* instructions in a program */
+
+/* Opcodes */
+#define SR_F_LDB        1       /* A = frame[k] */
+#define SR_F_LDH        2       /* A = 16 bits at frame[k], host order */
+#define SR_F_LDW        3       /* A = 32 bits at frame[k], host order */
+#define SR_F_LDB_L4     4       /* A = byte k past the IPv4 header */
+#define SR_F_LDIF       5       /* A = hash of the interface name */
+#define SR_F_LDDIR      6       /* A = direction, SR_CAPTURE_IN or _OUT */
+#define SR_F_AND        7       /* A &= k */
+#define SR_F_JEQ        8       /* pc += (A == k) ? jt : jf */
+#define SR_F_RET        9       /* accept if k is non-zero */
+
+struct sr_filter_insn
+{
+    uint16_t op;
+    uint16_t jt;                /* skipped instructions if true */
+    uint16_t jf;                /* ... and if false */
+    uint32_t k;
+};
+
+struct sr_filter
+{
+    struct sr_filter_insn insns[SR_FILTER_MAX];
+    unsigned int n;             /* 0 = accept everything */
+};
+
+/* Compile 'expr'. Returns 0 on success, -1 with a message on stderr. */
+int  sr_filter_compile(struct sr_filter* f, const char* expr);
+
+/* Non-zero if the frame passes. */
+int  sr_filter_run(const struct sr_filter* f, const uint8_t* frame, unsigned int len,
+                   const char* iface, int dir);
+
+/* Hash of an interface name, as SR_F_LDIF loads it. */
+uint32_t sr_filter_iface_hash(const char* name);
+
+/* Print the program, one instruction per line. */
+void sr_filter_dump(const struct sr_filter* f, FILE* out);
+
+#endif /* -- SR_FILTER_H -- */
@@ -24,6 +24,63 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_utils.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_if_templates(..)
+ * Scope: Local
+ *
+ * (Re)build the frame templates of an interface from its addresses
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_templates(struct sr_if* iface)
+{
+    struct sr_if_tmpl* t = &iface->tmpl;
+    sr_ethernet_hdr_t* e_hdr;
+    sr_arp_hdr_t* a_hdr;
+    sr_ip_hdr_t* ip_hdr;
+    sr_icmp_t3_hdr_t* icmp_hdr;
+
+    memset(t, 0, sizeof(*t));
+
+    /* -- ARP: a request goes to everyone, a reply back to the asker -- */
+    e_hdr = get_eth_hdr(t->arp_request);
+    a_hdr = get_arp_hdr(t->arp_request);
+    memset(e_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_arp);
+    a_hdr->ar_hrd = htons(arp_hrd_ethernet);
+    a_hdr->ar_pro = htons(ethertype_ip);
+    a_hdr->ar_hln = ETHER_ADDR_LEN;
+    a_hdr->ar_pln = 4;
+    a_hdr->ar_op = htons(arp_op_request);
+    memcpy(a_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
+    a_hdr->ar_sip = iface->ip;
+    memset(a_hdr->ar_tha, 0xff, ETHER_ADDR_LEN);
+
+    memcpy(t->arp_reply, t->arp_request, SR_ARP_FRAME_LEN);
+    e_hdr = get_eth_hdr(t->arp_reply);
+    a_hdr = get_arp_hdr(t->arp_reply);
+    memset(e_hdr->ether_dhost, 0, ETHER_ADDR_LEN);
+    a_hdr->ar_op = htons(arp_op_reply);
+    memset(a_hdr->ar_tha, 0, ETHER_ADDR_LEN);
+
+    /* -- ICMP errors, from this interface's address -- */
+    e_hdr = get_eth_hdr(t->icmp_t3);
+    ip_hdr = get_ip_hdr(t->icmp_t3);
+    icmp_hdr = get_icmp_t3_hdr(t->icmp_t3);
+    e_hdr->ether_type = htons(ethertype_ip);
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = sizeof(sr_ip_hdr_t) / 4;
+    ip_hdr->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
+    ip_hdr->ip_off = htons(IP_DF);
+    ip_hdr->ip_ttl = INIT_TTL;
+    ip_hdr->ip_p = ip_protocol_icmp;
+    ip_hdr->ip_src = iface->ip;
+    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+    icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_t3_hdr_t));
+} /* -- sr_if_templates -- */
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
@@ -74,7 +131,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
-        sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
+        sr->if_list = (struct sr_if*)calloc(1, sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
@@ -86,7 +143,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     while(if_walker->next)
     {if_walker = if_walker->next; }
 
-    if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
+    if_walker->next = (struct sr_if*)calloc(1, sizeof(struct sr_if));
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
@@ -114,6 +171,7 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
 
     /* -- copy address -- */
     memcpy(if_walker->addr,addr,6);
+    sr_if_templates(if_walker);
 
 } /* -- sr_set_ether_addr -- */
 
@@ -138,6 +196,7 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_if_templates(if_walker);
 
 } /* -- sr_set_ether_ip -- */
 
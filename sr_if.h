@@ -28,6 +28,29 @@
 
 struct sr_instance;
 
+#define SR_ARP_FRAME_LEN     (sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr))
+#define SR_ICMP_T3_FRAME_LEN (sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) + \
+                              sizeof(struct sr_icmp_t3_hdr))
+
+/* ----------------------------------------------------------------------------
+ * struct sr_if_tmpl
+ *
+ * The frames the router originates from an interface, prebuilt whenever
+ * its addresses are set.  A sender copies one onto the stack and fills
+ * in what varies, left zero here; the checksums are those of the
+ * template, so the variable fields go in with cksum_adjust.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_if_tmpl
+{
+  uint8_t arp_request[SR_ARP_FRAME_LEN];  /* ar_tip */
+  uint8_t arp_reply[SR_ARP_FRAME_LEN];    /* ether_dhost, ar_tha, ar_tip */
+  uint8_t icmp_t3[SR_ICMP_T3_FRAME_LEN];  /* ether_dhost and ether_shost (the
+                                             way out), ip_tos, ip_id, ip_dst,
+                                             icmp_type, icmp_code, data */
+};
+
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
@@ -42,6 +65,7 @@ struct sr_if
   uint32_t ip;
   uint32_t speed;
   struct sr_if* next;
+  struct sr_if_tmpl tmpl;
 };
 typedef struct sr_if sr_if_t;
 
@@ -0,0 +1,149 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.c
+ *
+ * Description:
+ *
+ * I/O backend registry and helpers shared by the backends
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "sr_protocol.h"
+#include "sr_io.h"
+
+static struct sr_io_ops* sr_io_backends[] =
+{
+    &sr_io_vns,
+    &sr_io_packet,
+    &sr_io_uring,
+    &sr_io_tap,
+    0
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_io_find(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_io_ops* sr_io_find(const char* name)
+{
+    int i;
+
+    /* -- REQUIRES -- */
+    assert(name);
+
+    for (i = 0; sr_io_backends[i]; i++)
+    {
+        if (strcmp(sr_io_backends[i]->name, name) == 0)
+        { return sr_io_backends[i]; }
+    }
+
+    return 0;
+} /* -- sr_io_find -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_io_parse_iface(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_io_parse_iface(const char* item, char* name, uint32_t* ip)
+{
+    const char* eq = strchr(item, '=');
+    size_t n = eq ? (size_t)(eq - item) : strlen(item);
+    struct in_addr addr;
+
+    if (n == 0 || n >= sr_IFACE_NAMELEN)
+    {
+        fprintf(stderr, "Bad interface name in '%s'\n", item);
+        return -1;
+    }
+    memcpy(name, item, n);
+    name[n] = 0;
+
+    *ip = 0;
+    if (eq)
+    {
+        if (inet_aton(eq + 1, &addr) == 0)
+        {
+            fprintf(stderr, "Bad IP address in '%s'\n", item);
+            return -1;
+        }
+        *ip = addr.s_addr;
+    }
+
+    return 0;
+} /* -- sr_io_parse_iface -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_io_host_iface(..)
+ * Scope:  Global
+ *
+ * Read index, MAC and (if 'ip' is still 0) IPv4 address of a host
+ * interface. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+#ifdef _LINUX_
+
+int sr_io_host_iface(const char* name, int* ifindex,
+                     unsigned char* mac, uint32_t* ip)
+{
+    struct ifreq ifr;
+    int fd, ret = -1;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) == -1) {
+        fprintf(stderr, "No host interface %s\n", name);
+        goto out;
+    }
+    *ifindex = ifr.ifr_ifindex;
+
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+        perror("ioctl(SIOCGIFHWADDR):sr_io.c");
+        goto out;
+    }
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    if (*ip == 0) {
+        if (ioctl(fd, SIOCGIFADDR, &ifr) == -1) {
+            fprintf(stderr, "Interface %s has no IP address, use %s=a.b.c.d\n",
+                    name, name);
+            goto out;
+        }
+        *ip = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+    }
+    ret = 0;
+
+out:
+    close(fd);
+    return ret;
+} /* -- sr_io_host_iface -- */
+
+#else /* _LINUX_ */
+
+int sr_io_host_iface(const char* name, int* ifindex,
+                     unsigned char* mac, uint32_t* ip)
+{
+    fprintf(stderr, "Host interfaces are only supported on Linux\n");
+    return -1;
+} /* -- sr_io_host_iface -- */
+
+#endif /* _LINUX_ */
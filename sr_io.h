@@ -0,0 +1,72 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.h
+ *
+ * Description:
+ *
+ * Pluggable frame I/O.  The forwarding code only ever calls
+ * sr_send_packet/sr_flush_packets and is fed through sr_deliver_packet;
+ * which wire those frames travel on is decided by the backend selected
+ * with -i (the VNS server connection by default).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_IO_H
+#define SR_IO_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_io_ops
+ *
+ * open   attach to the backend and fill sr->if_list (0 on success), may be
+ *        null when the backend is set up elsewhere
+ * poll   wait up to 'timeout' ms (forever if negative) for input, deliver
+ *        one batch of frames and flush what it produced. Returns 1 to keep
+ *        going, 0 when the backend is done, -1 on error
+ * fd     descriptor that becomes readable when poll has work, for the
+ *        event loop
+ * send   transmit (or stage) one frame out of 'iface', 0 on success
+ * flush  push out staged frames, 0 on success
+ * close  release everything open acquired
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_io_ops
+{
+    const char* name;
+    int  (*open)(struct sr_instance* sr, const char* arg);
+    int  (*poll)(struct sr_instance* sr, int timeout);
+    int  (*fd)(struct sr_instance* sr);
+    int  (*send)(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                 const char* iface);
+    int  (*flush)(struct sr_instance* sr);
+    void (*close)(struct sr_instance* sr);
+};
+
+extern struct sr_io_ops sr_io_vns;
+extern struct sr_io_ops sr_io_packet;
+extern struct sr_io_ops sr_io_uring;
+extern struct sr_io_ops sr_io_tap;
+
+/* Look up a backend by name, returns 0 if there is none. */
+struct sr_io_ops* sr_io_find(const char* name);
+
+/* Parse one "name[=a.b.c.d]" item of a backend interface list. Copies the
+   name into 'name' (sr_IFACE_NAMELEN bytes) and sets '*ip' (network byte
+   order) to the given address or 0. Returns 0 on success. */
+int sr_io_parse_iface(const char* item, char* name, uint32_t* ip);
+
+/* Read index, MAC and (if '*ip' is still 0) IPv4 address of a host
+   interface. Returns 0 on success. */
+int sr_io_host_iface(const char* name, int* ifindex, unsigned char* mac,
+                     uint32_t* ip);
+
+#endif /* -- SR_IO_H -- */
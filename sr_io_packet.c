@@ -0,0 +1,475 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io_packet.c
+ *
+ * Description:
+ *
+ * AF_PACKET backend (sr -i packet:eth0[=ip],eth1[=ip],...).  Each router
+ * interface is bound to the host interface of the same name through a
+ * PACKET_MMAP TPACKET_V3 socket.  Received frames are consumed a whole
+ * ring block at a time and transmitted frames are written straight into
+ * the TX ring, which is kicked once per batch, so there are no per-packet
+ * system calls in either direction.
+ *
+ * The interface list is filled from the host: MAC address from the NIC,
+ * IP address from the interface unless one is given after '='.  Giving it
+ * explicitly is the usual setup for veth pairs, whose router side should
+ * have no address of its own so that the kernel stays out of the way.
+ * Turn off TX checksum offload on the peers (ethtool -K <peer> tx off),
+ * otherwise their frames reach the ring with unfinished L4 checksums.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <sys/epoll.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_io.h"
+
+#ifdef _LINUX_
+
+#define SR_PKT_MAX_IFACES 16
+#define SR_PKT_BLOCK_SZ   (1 << 18)   /* ring block size */
+#define SR_PKT_RX_BLOCKS  8
+#define SR_PKT_TX_BLOCKS  4
+#define SR_PKT_FRAME_SZ   2048        /* tx slot size */
+#define SR_PKT_BLOCK_TMO  1           /* ms before a partly filled rx block is handed over */
+#define SR_PKT_TX_KICK    64          /* kick the tx ring at least this often */
+
+/* offset of frame data inside a tx slot (no PACKET_TX_HAS_OFF) */
+#define SR_PKT_TX_DATA    (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+struct sr_pkt_ring
+{
+    char name[sr_IFACE_NAMELEN];
+    int fd;
+    uint8_t* map;               /* rx blocks followed by tx slots */
+    size_t map_len;
+    unsigned int rx_block;      /* next rx block to look at */
+    uint8_t* tx;                /* first tx slot */
+    unsigned int tx_slots;
+    unsigned int tx_next;       /* next tx slot to fill */
+    unsigned int tx_pending;    /* slots handed over since the last kick */
+    pthread_mutex_t tx_lock;
+    unsigned long rx_pkts;
+    unsigned long tx_pkts;
+    unsigned long tx_drops;
+};
+
+struct sr_pkt_io
+{
+    int epfd;
+    int nrings;
+    struct sr_pkt_ring rings[SR_PKT_MAX_IFACES];
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_ring_open(..)
+ * Scope:  Local
+ *
+ * Create the socket and rings for one host interface. Returns 0 on
+ * success.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pkt_ring_open(struct sr_pkt_ring* ring, int ifindex)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    size_t rx_len, tx_len;
+    int v, one = 1;
+
+    if ((ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1) {
+        perror("socket(..):sr_io_packet.c::sr_pkt_ring_open");
+        return -1;
+    }
+
+    v = TPACKET_V3;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) == -1) {
+        perror("setsockopt(PACKET_VERSION):sr_io_packet.c");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_PKT_BLOCK_SZ;
+    req.tp_block_nr = SR_PKT_RX_BLOCKS;
+    req.tp_frame_size = SR_PKT_FRAME_SZ;
+    req.tp_frame_nr = (SR_PKT_BLOCK_SZ / SR_PKT_FRAME_SZ) * SR_PKT_RX_BLOCKS;
+    req.tp_retire_blk_tov = SR_PKT_BLOCK_TMO;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        perror("setsockopt(PACKET_RX_RING):sr_io_packet.c");
+        return -1;
+    }
+    rx_len = (size_t)SR_PKT_BLOCK_SZ * SR_PKT_RX_BLOCKS;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_PKT_BLOCK_SZ;
+    req.tp_block_nr = SR_PKT_TX_BLOCKS;
+    req.tp_frame_size = SR_PKT_FRAME_SZ;
+    req.tp_frame_nr = (SR_PKT_BLOCK_SZ / SR_PKT_FRAME_SZ) * SR_PKT_TX_BLOCKS;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1) {
+        perror("setsockopt(PACKET_TX_RING):sr_io_packet.c");
+        return -1;
+    }
+    tx_len = (size_t)SR_PKT_BLOCK_SZ * SR_PKT_TX_BLOCKS;
+    ring->tx_slots = req.tp_frame_nr;
+
+    /* -- both are optimisations, older kernels may refuse them -- */
+    setsockopt(ring->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(ring->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    ring->map_len = rx_len + tx_len;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+        perror("mmap(..):sr_io_packet.c::sr_pkt_ring_open");
+        ring->map = 0;
+        return -1;
+    }
+    ring->tx = ring->map + rx_len;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(ring->fd, (struct sockaddr*)&sll, sizeof(sll)) == -1) {
+        perror("bind(..):sr_io_packet.c::sr_pkt_ring_open");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_pkt_ring_open -- */
+
+static void sr_pkt_close(struct sr_instance* sr);
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_open(..)
+ * Scope:  Local
+ *
+ * 'arg' is a comma separated list of name[=ip] items.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pkt_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_pkt_io* io;
+    struct sr_pkt_ring* ring;
+    struct epoll_event ev;
+    unsigned char mac[ETHER_ADDR_LEN];
+    char *list, *item, *save = 0;
+    uint32_t ip;
+    int ifindex;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if (arg == 0 || *arg == 0) {
+        fprintf(stderr, "packet backend needs a list of interfaces\n");
+        return -1;
+    }
+
+    if ((io = (struct sr_pkt_io*)calloc(1, sizeof(struct sr_pkt_io))) == 0)
+        return -1;
+    io->epfd = -1;
+    sr->io_priv = io;
+
+    if ((io->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1(..):sr_io_packet.c::sr_pkt_open");
+        sr_pkt_close(sr);
+        return -1;
+    }
+
+    if ((list = strdup(arg)) == 0) {
+        sr_pkt_close(sr);
+        return -1;
+    }
+    for (item = strtok_r(list, ",", &save); item; item = strtok_r(0, ",", &save)) {
+        if (io->nrings == SR_PKT_MAX_IFACES) {
+            fprintf(stderr, "Too many interfaces (max %d)\n", SR_PKT_MAX_IFACES);
+            goto fail;
+        }
+        ring = &io->rings[io->nrings];
+        ring->fd = -1;
+
+        if (sr_io_parse_iface(item, ring->name, &ip) != 0 ||
+            sr_io_host_iface(ring->name, &ifindex, mac, &ip) != 0)
+            goto fail;
+
+        pthread_mutex_init(&ring->tx_lock, NULL);
+        io->nrings++;
+
+        if (sr_pkt_ring_open(ring, ifindex) != 0)
+            goto fail;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = ring;
+        if (epoll_ctl(io->epfd, EPOLL_CTL_ADD, ring->fd, &ev) == -1) {
+            perror("epoll_ctl(..):sr_io_packet.c::sr_pkt_open");
+            goto fail;
+        }
+
+        sr_add_interface(sr, ring->name);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, ip);
+    }
+    free(list);
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return 0;
+
+fail:
+    free(list);
+    sr_pkt_close(sr);
+    return -1;
+} /* -- sr_pkt_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_rx(..)
+ * Scope:  Local
+ *
+ * Deliver every frame in every block the kernel has handed over on
+ * 'ring', then give the blocks back. Returns the number of frames.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pkt_rx(struct sr_instance* sr, struct sr_pkt_ring* ring)
+{
+    struct tpacket_block_desc* bd;
+    struct tpacket3_hdr* ppd;
+    struct sockaddr_ll* sll;
+    unsigned int i;
+    int n = 0;
+
+    while (1) {
+        bd = (struct tpacket_block_desc*)(ring->map +
+                (size_t)ring->rx_block * SR_PKT_BLOCK_SZ);
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            break;
+        __sync_synchronize();
+
+        ppd = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            sll = (struct sockaddr_ll*)((uint8_t*)ppd +
+                    TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            /* -- our own transmissions are looped back, skip them -- */
+            if (sll->sll_pkttype != PACKET_OUTGOING &&
+                ppd->tp_snaplen == ppd->tp_len) {
+                sr_deliver_packet(sr, (uint8_t*)ppd + ppd->tp_mac,
+                                  ppd->tp_snaplen, ring->name);
+                n++;
+            }
+            ppd = (struct tpacket3_hdr*)((uint8_t*)ppd + ppd->tp_next_offset);
+        }
+
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        ring->rx_block = (ring->rx_block + 1) % SR_PKT_RX_BLOCKS;
+    }
+
+    ring->rx_pkts += n;
+    return n;
+} /* -- sr_pkt_rx -- */
+
+/* Tell the kernel to transmit the slots handed over so far. 'wait' blocks
+   until they are on the wire, which frees up slots. */
+static void sr_pkt_kick(struct sr_pkt_ring* ring, int wait)
+{
+    if (send(ring->fd, NULL, 0, wait ? 0 : MSG_DONTWAIT) == -1 &&
+        errno != EAGAIN && errno != ENOBUFS)
+        perror("send(..):sr_io_packet.c::sr_pkt_kick");
+    ring->tx_pending = 0;
+}
+
+static void sr_pkt_lock(struct sr_instance* sr, struct sr_pkt_ring* ring)
+{
+    if (!sr->lockless)
+        pthread_mutex_lock(&ring->tx_lock);
+}
+
+static void sr_pkt_unlock(struct sr_instance* sr, struct sr_pkt_ring* ring)
+{
+    if (!sr->lockless)
+        pthread_mutex_unlock(&ring->tx_lock);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_send(..)
+ * Scope:  Local
+ *
+ * Copy the frame into the next tx slot of the interface's ring. The
+ * slot goes out with the next kick (flush or every SR_PKT_TX_KICK).
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pkt_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       const char* iface)
+{
+    struct sr_pkt_io* io = (struct sr_pkt_io*)sr->io_priv;
+    struct sr_pkt_ring* ring = 0;
+    struct tpacket3_hdr* hdr;
+    int i;
+
+    for (i = 0; i < io->nrings; i++) {
+        if (strncmp(io->rings[i].name, iface, sr_IFACE_NAMELEN) == 0) {
+            ring = &io->rings[i];
+            break;
+        }
+    }
+    if (ring == 0) {
+        fprintf(stderr, "** Error: no ring for interface %s\n", iface);
+        return -1;
+    }
+    if (len > SR_PKT_FRAME_SZ - SR_PKT_TX_DATA) {
+        fprintf(stderr, "** Error: frame of %u bytes too long\n", len);
+        return -1;
+    }
+
+    sr_pkt_lock(sr, ring);
+
+    hdr = (struct tpacket3_hdr*)(ring->tx + (size_t)ring->tx_next * SR_PKT_FRAME_SZ);
+    if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+        /* -- ring full, wait for the kernel to drain it -- */
+        sr_pkt_kick(ring, 1);
+        if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+            ring->tx_drops++;
+            sr_pkt_unlock(sr, ring);
+            return -1;
+        }
+    }
+
+    memcpy((uint8_t*)hdr + SR_PKT_TX_DATA, buf, len);
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+    ring->tx_next = (ring->tx_next + 1) % ring->tx_slots;
+    ring->tx_pkts++;
+    if (++ring->tx_pending >= SR_PKT_TX_KICK)
+        sr_pkt_kick(ring, 0);
+
+    sr_pkt_unlock(sr, ring);
+
+    return 0;
+} /* -- sr_pkt_send -- */
+
+static int sr_pkt_flush(struct sr_instance* sr)
+{
+    struct sr_pkt_io* io = (struct sr_pkt_io*)sr->io_priv;
+    int i;
+
+    for (i = 0; i < io->nrings; i++) {
+        if (io->rings[i].tx_pending) {
+            sr_pkt_lock(sr, &io->rings[i]);
+            sr_pkt_kick(&io->rings[i], 0);
+            sr_pkt_unlock(sr, &io->rings[i]);
+        }
+    }
+    return 0;
+} /* -- sr_pkt_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_poll(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pkt_poll(struct sr_instance* sr, int timeout)
+{
+    struct sr_pkt_io* io = (struct sr_pkt_io*)sr->io_priv;
+    struct epoll_event ev[SR_PKT_MAX_IFACES];
+    int i, n = 0;
+
+    for (i = 0; i < io->nrings; i++)
+        n += sr_pkt_rx(sr, &io->rings[i]);
+
+    if (n == 0 && timeout != 0) {
+        if (epoll_wait(io->epfd, ev, SR_PKT_MAX_IFACES, timeout) == -1 &&
+            errno != EINTR) {
+            perror("epoll_wait(..):sr_io_packet.c::sr_pkt_poll");
+            return -1;
+        }
+        for (i = 0; i < io->nrings; i++)
+            n += sr_pkt_rx(sr, &io->rings[i]);
+    }
+
+    sr_end_batch(sr);
+
+    return 1;
+} /* -- sr_pkt_poll -- */
+
+static int sr_pkt_fd(struct sr_instance* sr)
+{
+    return ((struct sr_pkt_io*)sr->io_priv)->epfd;
+} /* -- sr_pkt_fd -- */
+
+static void sr_pkt_close(struct sr_instance* sr)
+{
+    struct sr_pkt_io* io = (struct sr_pkt_io*)sr->io_priv;
+    struct sr_pkt_ring* ring;
+    int i;
+
+    if (io == 0)
+        return;
+
+    for (i = 0; i < io->nrings; i++) {
+        ring = &io->rings[i];
+        fprintf(stderr, "%s: rx %lu tx %lu tx drops %lu\n", ring->name,
+                ring->rx_pkts, ring->tx_pkts, ring->tx_drops);
+        if (ring->map)
+            munmap(ring->map, ring->map_len);
+        if (ring->fd != -1)
+            close(ring->fd);
+        pthread_mutex_destroy(&ring->tx_lock);
+    }
+    if (io->epfd != -1)
+        close(io->epfd);
+
+    free(io);
+    sr->io_priv = 0;
+} /* -- sr_pkt_close -- */
+
+struct sr_io_ops sr_io_packet =
+{
+    "packet",
+    sr_pkt_open,
+    sr_pkt_poll,
+    sr_pkt_fd,
+    sr_pkt_send,
+    sr_pkt_flush,
+    sr_pkt_close
+};
+
+#else /* _LINUX_ */
+
+static int sr_pkt_open(struct sr_instance* sr, const char* arg)
+{
+    fprintf(stderr, "The packet backend requires Linux\n");
+    return -1;
+}
+
+struct sr_io_ops sr_io_packet = { "packet", sr_pkt_open, 0, 0, 0, 0, 0 };
+
+#endif /* _LINUX_ */
@@ -0,0 +1,510 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io_tap.c
+ *
+ * Description:
+ *
+ * TAP backend (sr -i tap:tap0=ip[@mac],tap1=ip[@mac],...[,queues=n]).
+ * Every router interface is a Linux TAP device, created if needed and
+ * brought up.  The kernel side of the device is the host on that link,
+ * so moving it into a network namespace and giving it an address there
+ * lets ordinary ping/iperf traffic run through sr_handlepacket:
+ *
+ *   ip link set tap0 netns h1
+ *   ip -n h1 addr add 10.0.1.100/24 dev tap0
+ *   ip -n h1 link set tap0 up
+ *   ip -n h1 route add default via 10.0.1.1
+ *
+ * The router's address on each link must be given, its MAC defaults to
+ * 02:53:52:00:00:<n>.  With queues=n each device is opened with
+ * IFF_MULTI_QUEUE and n descriptors; the kernel spreads flows over them.
+ *
+ * Frames are read until the descriptors run dry (up to SR_TAP_RX_BATCH
+ * per queue per poll) and transmitted frames are staged per queue and
+ * written when the batch is flushed.  Frames of one flow always leave on
+ * the same queue.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <sys/epoll.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_io.h"
+#include "sr_protocol.h"
+
+#ifdef _LINUX_
+
+#define SR_TAP_MAX_IFACES 16
+#define SR_TAP_MAX_QUEUES 8
+#define SR_TAP_FRAME_SZ   2048        /* tx stage slot size */
+#define SR_TAP_TX_BATCH   64          /* frames staged per queue */
+#define SR_TAP_RX_BATCH   64          /* frames read per queue per poll */
+#define SR_TAP_RXBUF_SZ   65536
+
+struct sr_tap_queue
+{
+    int fd;
+    struct sr_tap_dev* dev;
+    unsigned int tx_n;
+    unsigned int tx_len[SR_TAP_TX_BATCH];
+    uint8_t tx_buf[SR_TAP_TX_BATCH][SR_TAP_FRAME_SZ];
+};
+
+struct sr_tap_dev
+{
+    char name[sr_IFACE_NAMELEN];
+    int nqueues;
+    struct sr_tap_queue* queues[SR_TAP_MAX_QUEUES];
+    pthread_mutex_t tx_lock;
+    unsigned long rx_pkts;
+    unsigned long tx_pkts;
+    unsigned long tx_drops;
+};
+
+struct sr_tap_io
+{
+    int epfd;
+    int nqueues;                /* per device */
+    int ndevs;
+    struct sr_tap_dev devs[SR_TAP_MAX_IFACES];
+    uint8_t rxbuf[SR_TAP_RXBUF_SZ];
+};
+
+static void sr_tap_lock(struct sr_instance* sr, struct sr_tap_dev* dev)
+{
+    if (!sr->lockless)
+        pthread_mutex_lock(&dev->tx_lock);
+}
+
+static void sr_tap_unlock(struct sr_instance* sr, struct sr_tap_dev* dev)
+{
+    if (!sr->lockless)
+        pthread_mutex_unlock(&dev->tx_lock);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_queue_open(..)
+ * Scope:  Local
+ *
+ * Attach one (non-blocking) queue of TAP device 'name', creating the
+ * device on the first call. Returns the descriptor or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_queue_open(const char* name, int multi)
+{
+    struct ifreq ifr;
+    int fd;
+
+    if ((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) == -1) {
+        perror("open(/dev/net/tun):sr_io_tap.c");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    if (multi)
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+
+    if (ioctl(fd, TUNSETIFF, &ifr) == -1) {
+        fprintf(stderr, "TUNSETIFF %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+} /* -- sr_tap_queue_open -- */
+
+/* Set IFF_UP on the kernel side of the device. */
+static int sr_tap_up(const char* name)
+{
+    struct ifreq ifr;
+    int fd, ret = -1;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0) {
+        ifr.ifr_flags |= IFF_UP;
+        ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
+    }
+    if (ret == -1)
+        fprintf(stderr, "Cannot bring up %s: %s\n", name, strerror(errno));
+
+    close(fd);
+    return ret;
+} /* -- sr_tap_up -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_parse_mac(..)
+ * Scope:  Local
+ *
+ * Split an optional "@aa:bb:cc:dd:ee:ff" off the end of 'item'.
+ * Returns 1 if a MAC was found, 0 if none, -1 if it is malformed.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_parse_mac(char* item, unsigned char* mac)
+{
+    char* at = strchr(item, '@');
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if (at == 0)
+        return 0;
+    *at++ = 0;
+
+    if (sscanf(at, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2],
+               &b[3], &b[4], &b[5]) != ETHER_ADDR_LEN) {
+        fprintf(stderr, "Bad MAC address '%s'\n", at);
+        return -1;
+    }
+    for (i = 0; i < ETHER_ADDR_LEN; i++) {
+        if (b[i] > 0xff) {
+            fprintf(stderr, "Bad MAC address '%s'\n", at);
+            return -1;
+        }
+        mac[i] = (unsigned char)b[i];
+    }
+
+    return 1;
+} /* -- sr_tap_parse_mac -- */
+
+static void sr_tap_close(struct sr_instance* sr);
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_open(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_tap_io* io;
+    struct sr_tap_dev* dev;
+    struct sr_tap_queue* q;
+    struct epoll_event ev;
+    unsigned char mac[ETHER_ADDR_LEN];
+    char *list, *item, *save = 0;
+    uint32_t ip;
+    int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if (arg == 0 || *arg == 0) {
+        fprintf(stderr, "tap backend needs a list of interfaces\n");
+        return -1;
+    }
+
+    if ((io = (struct sr_tap_io*)calloc(1, sizeof(struct sr_tap_io))) == 0)
+        return -1;
+    sr->io_priv = io;
+    io->nqueues = 1;
+
+    if ((io->epfd = epoll_create(SR_TAP_MAX_IFACES * SR_TAP_MAX_QUEUES)) == -1) {
+        perror("epoll_create(..):sr_io_tap.c::sr_tap_open");
+        sr_tap_close(sr);
+        return -1;
+    }
+
+    /* -- queue count first, it applies to every device -- */
+    list = strdup(arg);
+    for (item = strtok_r(list, ",", &save); item; item = strtok_r(0, ",", &save)) {
+        if (strncmp(item, "queues=", 7) == 0) {
+            io->nqueues = atoi(item + 7);
+            if (io->nqueues < 1 || io->nqueues > SR_TAP_MAX_QUEUES) {
+                fprintf(stderr, "queues must be 1..%d\n", SR_TAP_MAX_QUEUES);
+                goto fail;
+            }
+        }
+    }
+    free(list);
+
+    list = strdup(arg);
+    save = 0;
+    for (item = strtok_r(list, ",", &save); item; item = strtok_r(0, ",", &save)) {
+        if (strncmp(item, "queues=", 7) == 0)
+            continue;
+        if (io->ndevs == SR_TAP_MAX_IFACES) {
+            fprintf(stderr, "Too many interfaces (max %d)\n", SR_TAP_MAX_IFACES);
+            goto fail;
+        }
+        dev = &io->devs[io->ndevs];
+
+        memset(mac, 0, sizeof(mac));
+        mac[0] = 0x02; mac[1] = 0x53; mac[2] = 0x52;
+        mac[5] = (unsigned char)(io->ndevs + 1);
+        if (sr_tap_parse_mac(item, mac) < 0 ||
+            sr_io_parse_iface(item, dev->name, &ip) != 0)
+            goto fail;
+        if (ip == 0) {
+            fprintf(stderr, "TAP interface %s needs an address, use %s=a.b.c.d\n",
+                    dev->name, dev->name);
+            goto fail;
+        }
+
+        pthread_mutex_init(&dev->tx_lock, NULL);
+        io->ndevs++;
+
+        for (i = 0; i < io->nqueues; i++) {
+            if ((q = (struct sr_tap_queue*)calloc(1, sizeof(struct sr_tap_queue))) == 0)
+                goto fail;
+            dev->queues[dev->nqueues++] = q;
+            q->dev = dev;
+            if ((q->fd = sr_tap_queue_open(dev->name, io->nqueues > 1)) == -1)
+                goto fail;
+
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = q;
+            if (epoll_ctl(io->epfd, EPOLL_CTL_ADD, q->fd, &ev) == -1) {
+                perror("epoll_ctl(..):sr_io_tap.c::sr_tap_open");
+                goto fail;
+            }
+        }
+        if (sr_tap_up(dev->name) != 0)
+            goto fail;
+
+        sr_add_interface(sr, dev->name);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, ip);
+    }
+    free(list);
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return 0;
+
+fail:
+    free(list);
+    sr_tap_close(sr);
+    return -1;
+} /* -- sr_tap_open -- */
+
+/* Write out the frames staged on 'q'. Caller holds the device lock. */
+static void sr_tap_tx_flush(struct sr_tap_queue* q)
+{
+    unsigned int i;
+
+    for (i = 0; i < q->tx_n; i++) {
+        if (write(q->fd, q->tx_buf[i], q->tx_len[i]) == -1)
+            q->dev->tx_drops++;
+    }
+    q->tx_n = 0;
+} /* -- sr_tap_tx_flush -- */
+
+/* Queue of 'dev' that carries the flow of 'buf', from its IPv4 addresses. */
+static struct sr_tap_queue* sr_tap_pick_queue(struct sr_tap_dev* dev,
+                                              const uint8_t* buf, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)buf;
+    const sr_ip_hdr_t* iph;
+    uint32_t h;
+
+    if (dev->nqueues == 1 ||
+        len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+        eth->ether_type != htons(ethertype_ip))
+        return dev->queues[0];
+
+    iph = (const sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    h = iph->ip_src ^ iph->ip_dst;
+    h ^= h >> 16;
+    h ^= h >> 8;
+
+    return dev->queues[h % dev->nqueues];
+} /* -- sr_tap_pick_queue -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_send(..)
+ * Scope:  Local
+ *
+ * Stage the frame on the device queue of its flow. It is written with
+ * the next flush, or when the stage is full.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       const char* iface)
+{
+    struct sr_tap_io* io = (struct sr_tap_io*)sr->io_priv;
+    struct sr_tap_dev* dev = 0;
+    struct sr_tap_queue* q;
+    int i, ret = 0;
+
+    for (i = 0; i < io->ndevs; i++) {
+        if (strncmp(io->devs[i].name, iface, sr_IFACE_NAMELEN) == 0) {
+            dev = &io->devs[i];
+            break;
+        }
+    }
+    if (dev == 0) {
+        fprintf(stderr, "** Error: no TAP device for interface %s\n", iface);
+        return -1;
+    }
+
+    q = sr_tap_pick_queue(dev, buf, len);
+
+    sr_tap_lock(sr, dev);
+
+    if (len > SR_TAP_FRAME_SZ) {
+        /* -- jumbo frame, keep the order and write it directly -- */
+        sr_tap_tx_flush(q);
+        if (write(q->fd, buf, len) == -1) {
+            dev->tx_drops++;
+            ret = -1;
+        }
+    }
+    else {
+        if (q->tx_n == SR_TAP_TX_BATCH)
+            sr_tap_tx_flush(q);
+        memcpy(q->tx_buf[q->tx_n], buf, len);
+        q->tx_len[q->tx_n++] = len;
+    }
+    dev->tx_pkts++;
+
+    sr_tap_unlock(sr, dev);
+
+    return ret;
+} /* -- sr_tap_send -- */
+
+static int sr_tap_flush(struct sr_instance* sr)
+{
+    struct sr_tap_io* io = (struct sr_tap_io*)sr->io_priv;
+    struct sr_tap_dev* dev;
+    int i, j;
+
+    for (i = 0; i < io->ndevs; i++) {
+        dev = &io->devs[i];
+        sr_tap_lock(sr, dev);
+        for (j = 0; j < dev->nqueues; j++) {
+            if (dev->queues[j]->tx_n)
+                sr_tap_tx_flush(dev->queues[j]);
+        }
+        sr_tap_unlock(sr, dev);
+    }
+    return 0;
+} /* -- sr_tap_flush -- */
+
+/* Deliver up to SR_TAP_RX_BATCH frames waiting on 'q'. */
+static int sr_tap_rx(struct sr_instance* sr, struct sr_tap_queue* q)
+{
+    struct sr_tap_io* io = (struct sr_tap_io*)sr->io_priv;
+    ssize_t len;
+    int n;
+
+    for (n = 0; n < SR_TAP_RX_BATCH; n++) {
+        if ((len = read(q->fd, io->rxbuf, SR_TAP_RXBUF_SZ)) <= 0) {
+            if (len == -1 && errno != EAGAIN && errno != EINTR)
+                perror("read(..):sr_io_tap.c::sr_tap_rx");
+            break;
+        }
+        sr_deliver_packet(sr, io->rxbuf, (unsigned int)len, q->dev->name);
+    }
+
+    q->dev->rx_pkts += n;
+    return n;
+} /* -- sr_tap_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_poll(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_poll(struct sr_instance* sr, int timeout)
+{
+    struct sr_tap_io* io = (struct sr_tap_io*)sr->io_priv;
+    struct epoll_event ev[SR_TAP_MAX_IFACES * SR_TAP_MAX_QUEUES];
+    int i, n;
+
+    n = epoll_wait(io->epfd, ev, SR_TAP_MAX_IFACES * SR_TAP_MAX_QUEUES, timeout);
+    if (n == -1 && errno != EINTR) {
+        perror("epoll_wait(..):sr_io_tap.c::sr_tap_poll");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+        sr_tap_rx(sr, (struct sr_tap_queue*)ev[i].data.ptr);
+
+    sr_end_batch(sr);
+
+    return 1;
+} /* -- sr_tap_poll -- */
+
+static int sr_tap_fd(struct sr_instance* sr)
+{
+    return ((struct sr_tap_io*)sr->io_priv)->epfd;
+} /* -- sr_tap_fd -- */
+
+static void sr_tap_close(struct sr_instance* sr)
+{
+    struct sr_tap_io* io = (struct sr_tap_io*)sr->io_priv;
+    struct sr_tap_dev* dev;
+    int i, j;
+
+    if (io == 0)
+        return;
+
+    for (i = 0; i < io->ndevs; i++) {
+        dev = &io->devs[i];
+        fprintf(stderr, "%s: rx %lu tx %lu tx drops %lu\n", dev->name,
+                dev->rx_pkts, dev->tx_pkts, dev->tx_drops);
+        for (j = 0; j < dev->nqueues; j++) {
+            if (dev->queues[j]->fd != -1)
+                close(dev->queues[j]->fd);
+            free(dev->queues[j]);
+        }
+        pthread_mutex_destroy(&dev->tx_lock);
+    }
+    if (io->epfd != -1)
+        close(io->epfd);
+
+    free(io);
+    sr->io_priv = 0;
+} /* -- sr_tap_close -- */
+
+struct sr_io_ops sr_io_tap =
+{
+    "tap",
+    sr_tap_open,
+    sr_tap_poll,
+    sr_tap_fd,
+    sr_tap_send,
+    sr_tap_flush,
+    sr_tap_close
+};
+
+#else /* _LINUX_ */
+
+static int sr_tap_open(struct sr_instance* sr, const char* arg)
+{
+    fprintf(stderr, "The tap backend requires Linux\n");
+    return -1;
+}
+
+struct sr_io_ops sr_io_tap = { "tap", sr_tap_open, 0, 0, 0, 0, 0 };
+
+#endif /* _LINUX_ */
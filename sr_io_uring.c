@@ -0,0 +1,668 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io_uring.c
+ *
+ * Description:
+ *
+ * io_uring backend (sr -i uring:eth0[=ip],eth1[=ip],...).  Router
+ * interfaces are bound to host interfaces through plain AF_PACKET sockets
+ * like the packet backend, but all socket I/O is asynchronous:
+ *
+ *  - every socket has one multishot IORING_OP_RECV armed against a ring of
+ *    provided buffers registered with IORING_REGISTER_PBUF_RING, so the
+ *    kernel keeps receiving into our buffers without new submissions; a
+ *    frame longer than a buffer is counted and dropped, not forwarded cut
+ *  - transmitted frames are copied into preallocated slots and queued as
+ *    IORING_OP_SEND entries that go out with the next io_uring_enter
+ *
+ * When one thread does everything (-E) a single io_uring_enter both
+ * submits the sends produced by the previous batch and waits for the next
+ * batch of receive and send completions.
+ *
+ * The ring is driven with raw system calls, liburing is not required.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <linux/io_uring.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_io.h"
+#include "sr_worker.h"
+#include "sr_numa.h"
+
+#if defined(_LINUX_) && defined(IORING_RECV_MULTISHOT)
+
+#define SR_URING_ENTRIES    256     /* submission queue size */
+#define SR_URING_RX_BUFS    512     /* provided receive buffers, power of two */
+#define SR_URING_BUF_SZ     2048
+#define SR_URING_TX_SLOTS   1024
+#define SR_URING_BATCH      128     /* completions handled per poll */
+#define SR_URING_MAX_IFACES 16
+#define SR_URING_BGID       0       /* buffer group of the receive buffers */
+
+/* user_data: operation in the upper half, interface or slot in the lower */
+#define SR_URING_RECV       1ULL
+#define SR_URING_SEND       2ULL
+#define SR_URING_UD(op, i)  (((op) << 32) | (uint64_t)(i))
+
+struct sr_uring_iface
+{
+    char name[sr_IFACE_NAMELEN];
+    int fd;
+    int armed;                  /* multishot receive outstanding */
+    unsigned long rx_pkts;
+    unsigned long tx_pkts;
+    unsigned long tx_drops;
+    unsigned long rx_truncated; /* frames too big for a buffer, dropped */
+};
+
+struct sr_uring_io
+{
+    int ring_fd;
+
+    /* -- submission queue -- */
+    uint8_t* sq_ptr;
+    size_t sq_len;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_fill;           /* local tail, ahead of *sq_tail */
+    unsigned sq_pending;        /* filled but not yet submitted */
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    /* -- completion queue -- */
+    uint8_t* cq_ptr;
+    size_t cq_len;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* -- provided receive buffers -- */
+    struct io_uring_buf_ring* br;
+    size_t br_len;
+    uint8_t* rx_bufs;
+    unsigned short br_tail;
+
+    /* -- transmit slots -- */
+    uint8_t* tx_bufs;
+    int tx_free[SR_URING_TX_SLOTS];
+    int tx_nfree;
+
+    pthread_mutex_t lock;       /* submission queue and tx slots */
+    unsigned long enters;       /* io_uring_enter calls */
+    unsigned long completions;  /* completions reaped */
+
+    int nifaces;
+    struct sr_uring_iface ifaces[SR_URING_MAX_IFACES];
+};
+
+static int sr_uring_enter(struct sr_uring_io* io, unsigned to_submit,
+                          unsigned min_complete, unsigned flags)
+{
+    int ret;
+
+    /* -- a bare wait gives up on a signal, so that the poll loop gets to
+       see sr->stop -- */
+    io->enters++;
+    do {
+        ret = syscall(__NR_io_uring_enter, io->ring_fd, to_submit,
+                      min_complete, flags, NULL, 0);
+    } while (ret == -1 && errno == EINTR && to_submit > 0);
+
+    return ret;
+} /* -- sr_uring_enter -- */
+
+static void sr_uring_lock(struct sr_instance* sr, struct sr_uring_io* io)
+{
+    if (!sr->lockless)
+        pthread_mutex_lock(&io->lock);
+}
+
+static void sr_uring_unlock(struct sr_instance* sr, struct sr_uring_io* io)
+{
+    if (!sr->lockless)
+        pthread_mutex_unlock(&io->lock);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_submit_locked(..)
+ * Scope:  Local
+ *
+ * Publish the filled entries and hand them to the kernel, optionally
+ * waiting for 'wait' completions. Caller holds the lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_submit_locked(struct sr_uring_io* io, unsigned wait)
+{
+    unsigned n = io->sq_pending;
+    int ret;
+
+    if (n == 0 && wait == 0)
+        return 0;
+
+    __atomic_store_n(io->sq_tail, io->sq_fill, __ATOMIC_RELEASE);
+    io->sq_pending = 0;
+
+    ret = sr_uring_enter(io, n, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    if (ret == -1) {
+        perror("io_uring_enter(..):sr_io_uring.c");
+        return -1;
+    }
+    return 0;
+} /* -- sr_uring_submit_locked -- */
+
+/* Next free submission entry, zeroed. Caller holds the lock. */
+static struct io_uring_sqe* sr_uring_get_sqe(struct sr_uring_io* io)
+{
+    struct io_uring_sqe* sqe;
+    unsigned head, idx;
+
+    head = __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE);
+    if (io->sq_fill - head >= io->sq_entries) {
+        sr_uring_submit_locked(io, 0);
+        head = __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE);
+        if (io->sq_fill - head >= io->sq_entries)
+            return 0;
+    }
+
+    idx = io->sq_fill & io->sq_mask;
+    sqe = &io->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    io->sq_array[idx] = idx;
+    io->sq_fill++;
+    io->sq_pending++;
+
+    return sqe;
+} /* -- sr_uring_get_sqe -- */
+
+/* Arm the multishot receive of interface 'i'. Caller holds the lock. */
+static int sr_uring_arm_recv(struct sr_uring_io* io, int i)
+{
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = sr_uring_get_sqe(io)) == 0)
+        return -1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = io->ifaces[i].fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->msg_flags = MSG_TRUNC;     /* report the length a frame really had */
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SR_URING_BGID;
+    sqe->user_data = SR_URING_UD(SR_URING_RECV, i);
+    io->ifaces[i].armed = 1;
+
+    return 0;
+} /* -- sr_uring_arm_recv -- */
+
+/* Give receive buffer 'bid' back to the kernel. */
+static void sr_uring_recycle(struct sr_uring_io* io, unsigned bid)
+{
+    struct io_uring_buf* buf;
+
+    buf = &io->br->bufs[io->br_tail & (SR_URING_RX_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(io->rx_bufs + (size_t)bid * SR_URING_BUF_SZ);
+    buf->len = SR_URING_BUF_SZ;
+    buf->bid = bid;
+    io->br_tail++;
+} /* -- sr_uring_recycle -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_setup(..)
+ * Scope:  Local
+ *
+ * Create the ring, map its queues and register the receive buffers.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_setup(struct sr_uring_io* io, int node)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    unsigned i;
+
+    memset(&p, 0, sizeof(p));
+    io->ring_fd = syscall(__NR_io_uring_setup, SR_URING_ENTRIES, &p);
+    if (io->ring_fd == -1) {
+        perror("io_uring_setup(..):sr_io_uring.c");
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "io_uring: kernel too old (no IORING_FEAT_SINGLE_MMAP)\n");
+        return -1;
+    }
+
+    io->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    io->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (io->cq_len > io->sq_len)
+        io->sq_len = io->cq_len;
+    io->cq_len = 0;   /* shares the sq mapping */
+
+    io->sq_ptr = mmap(0, io->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQ_RING);
+    if (io->sq_ptr == MAP_FAILED) {
+        perror("mmap(sq):sr_io_uring.c");
+        io->sq_ptr = 0;
+        return -1;
+    }
+    io->cq_ptr = io->sq_ptr;
+
+    io->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = mmap(0, io->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        perror("mmap(sqes):sr_io_uring.c");
+        io->sqes = 0;
+        return -1;
+    }
+
+    io->sq_head = (unsigned*)(io->sq_ptr + p.sq_off.head);
+    io->sq_tail = (unsigned*)(io->sq_ptr + p.sq_off.tail);
+    io->sq_array = (unsigned*)(io->sq_ptr + p.sq_off.array);
+    io->sq_mask = *(unsigned*)(io->sq_ptr + p.sq_off.ring_mask);
+    io->sq_entries = p.sq_entries;
+    io->sq_fill = *io->sq_tail;
+
+    io->cq_head = (unsigned*)(io->cq_ptr + p.cq_off.head);
+    io->cq_tail = (unsigned*)(io->cq_ptr + p.cq_off.tail);
+    io->cq_mask = *(unsigned*)(io->cq_ptr + p.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe*)(io->cq_ptr + p.cq_off.cqes);
+
+    /* -- receive buffers and the ring describing them -- */
+    io->br_len = SR_URING_RX_BUFS * sizeof(struct io_uring_buf);
+    io->br = mmap(0, io->br_len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (io->br == MAP_FAILED) {
+        io->br = 0;
+        return -1;
+    }
+    io->rx_bufs = (uint8_t*)sr_mem_alloc("uring rx buffers",
+                                         (size_t)SR_URING_RX_BUFS * SR_URING_BUF_SZ, node);
+    io->tx_bufs = (uint8_t*)sr_mem_alloc("uring tx buffers",
+                                         (size_t)SR_URING_TX_SLOTS * SR_URING_BUF_SZ, node);
+    if (io->rx_bufs == 0 || io->tx_bufs == 0)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)io->br;
+    reg.ring_entries = SR_URING_RX_BUFS;
+    reg.bgid = SR_URING_BGID;
+    if (syscall(__NR_io_uring_register, io->ring_fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        perror("io_uring_register(PBUF_RING):sr_io_uring.c");
+        return -1;
+    }
+
+    io->br_tail = 0;
+    for (i = 0; i < SR_URING_RX_BUFS; i++)
+        sr_uring_recycle(io, i);
+    __atomic_store_n(&io->br->tail, io->br_tail, __ATOMIC_RELEASE);
+
+    for (i = 0; i < SR_URING_TX_SLOTS; i++)
+        io->tx_free[i] = SR_URING_TX_SLOTS - 1 - i;
+    io->tx_nfree = SR_URING_TX_SLOTS;
+
+    return 0;
+} /* -- sr_uring_setup -- */
+
+/* Packet socket bound to host interface 'ifindex'. */
+static int sr_uring_socket(int ifindex)
+{
+    struct sockaddr_ll sll;
+    int fd, one = 1;
+
+    if ((fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1) {
+        perror("socket(..):sr_io_uring.c::sr_uring_socket");
+        return -1;
+    }
+
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(fd, (struct sockaddr*)&sll, sizeof(sll)) == -1) {
+        perror("bind(..):sr_io_uring.c::sr_uring_socket");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+} /* -- sr_uring_socket -- */
+
+static void sr_uring_close(struct sr_instance* sr);
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_open(..)
+ * Scope:  Local
+ *
+ * 'arg' is a comma separated list of name[=ip] items.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_uring_io* io;
+    struct sr_uring_iface* ifc;
+    unsigned char mac[ETHER_ADDR_LEN];
+    char *list, *item, *save = 0;
+    uint32_t ip;
+    int ifindex, i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if (arg == 0 || *arg == 0) {
+        fprintf(stderr, "uring backend needs a list of interfaces\n");
+        return -1;
+    }
+
+    if ((io = (struct sr_uring_io*)calloc(1, sizeof(struct sr_uring_io))) == 0)
+        return -1;
+    sr->io_priv = io;
+    io->ring_fd = -1;
+    pthread_mutex_init(&io->lock, NULL);
+
+    if (sr_uring_setup(io, sr_node_for(sr, SR_ROLE_RX, 0)) != 0) {
+        sr_uring_close(sr);
+        return -1;
+    }
+
+    list = strdup(arg);
+    for (item = strtok_r(list, ",", &save); item; item = strtok_r(0, ",", &save)) {
+        if (io->nifaces == SR_URING_MAX_IFACES) {
+            fprintf(stderr, "Too many interfaces (max %d)\n", SR_URING_MAX_IFACES);
+            goto fail;
+        }
+        ifc = &io->ifaces[io->nifaces];
+        ifc->fd = -1;
+
+        if (sr_io_parse_iface(item, ifc->name, &ip) != 0 ||
+            sr_io_host_iface(ifc->name, &ifindex, mac, &ip) != 0)
+            goto fail;
+
+        io->nifaces++;
+        if ((ifc->fd = sr_uring_socket(ifindex)) == -1)
+            goto fail;
+
+        sr_add_interface(sr, ifc->name);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, ip);
+    }
+    free(list);
+
+    for (i = 0; i < io->nifaces; i++)
+        sr_uring_arm_recv(io, i);
+    sr_uring_submit_locked(io, 0);
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return 0;
+
+fail:
+    free(list);
+    sr_uring_close(sr);
+    return -1;
+} /* -- sr_uring_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_send(..)
+ * Scope:  Local
+ *
+ * Copy the frame into a transmit slot and queue a send for it. It is
+ * submitted with the next flush or poll.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                         const char* iface)
+{
+    struct sr_uring_io* io = (struct sr_uring_io*)sr->io_priv;
+    struct sr_uring_iface* ifc = 0;
+    struct io_uring_sqe* sqe;
+    uint8_t* slot_buf;
+    int i, slot;
+
+    for (i = 0; i < io->nifaces; i++) {
+        if (strncmp(io->ifaces[i].name, iface, sr_IFACE_NAMELEN) == 0) {
+            ifc = &io->ifaces[i];
+            break;
+        }
+    }
+    if (ifc == 0) {
+        fprintf(stderr, "** Error: no socket for interface %s\n", iface);
+        return -1;
+    }
+    if (len > SR_URING_BUF_SZ) {
+        fprintf(stderr, "** Error: frame of %u bytes too long\n", len);
+        return -1;
+    }
+
+    sr_uring_lock(sr, io);
+
+    if (io->tx_nfree == 0 || (sqe = sr_uring_get_sqe(io)) == 0) {
+        ifc->tx_drops++;
+        sr_uring_unlock(sr, io);
+        return -1;
+    }
+
+    slot = io->tx_free[--io->tx_nfree];
+    slot_buf = io->tx_bufs + (size_t)slot * SR_URING_BUF_SZ;
+    memcpy(slot_buf, buf, len);
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = ifc->fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot_buf;
+    sqe->len = len;
+    sqe->user_data = SR_URING_UD(SR_URING_SEND, slot);
+    ifc->tx_pkts++;
+
+    sr_uring_unlock(sr, io);
+
+    return 0;
+} /* -- sr_uring_send -- */
+
+static int sr_uring_flush(struct sr_instance* sr)
+{
+    struct sr_uring_io* io = (struct sr_uring_io*)sr->io_priv;
+    int ret;
+
+    sr_uring_lock(sr, io);
+    ret = sr_uring_submit_locked(io, 0);
+    sr_uring_unlock(sr, io);
+
+    return ret;
+} /* -- sr_uring_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_poll(..)
+ * Scope:  Local
+ *
+ * Submit what is queued, wait for completions unless 'timeout' is 0 and
+ * handle up to SR_URING_BATCH of them.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_poll(struct sr_instance* sr, int timeout)
+{
+    struct sr_uring_io* io = (struct sr_uring_io*)sr->io_priv;
+    struct io_uring_cqe* cqe;
+    struct sr_uring_iface* ifc;
+    unsigned head, tail, wait, n = 0;
+    unsigned long op, idx;
+    int i, ret;
+
+    head = *io->cq_head;
+    tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+
+    /* -- one enter submits last batch's sends and waits for the next, but
+       other threads (ARP sweeper, workers) must not wait on the lock
+       meanwhile, so then the wait is a second enter outside it -- */
+    wait = (head == tail && timeout < 0) ? 1 : 0;
+    sr_uring_lock(sr, io);
+    ret = sr_uring_submit_locked(io, sr->lockless ? wait : 0);
+    sr_uring_unlock(sr, io);
+    if (ret != 0)
+        return -1;
+    if (wait && !sr->lockless &&
+        sr_uring_enter(io, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+        perror("io_uring_enter(..):sr_io_uring.c::sr_uring_poll");
+        return -1;
+    }
+
+    if (head == tail && timeout > 0) {
+        struct pollfd pfd;
+        pfd.fd = io->ring_fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, timeout);
+    }
+
+    tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < SR_URING_BATCH) {
+        cqe = &io->cqes[head & io->cq_mask];
+        op = cqe->user_data >> 32;
+        idx = cqe->user_data & 0xffffffffUL;
+
+        if (op == SR_URING_RECV) {
+            ifc = &io->ifaces[idx];
+            if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                if (cqe->res > SR_URING_BUF_SZ)
+                    ifc->rx_truncated++;
+                else {
+                    sr_deliver_packet(sr, io->rx_bufs + (size_t)bid * SR_URING_BUF_SZ,
+                                      cqe->res, ifc->name);
+                    ifc->rx_pkts++;
+                }
+                sr_uring_recycle(io, bid);
+            }
+            else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                fprintf(stderr, "io_uring recv on %s: %s\n", ifc->name,
+                        strerror(-cqe->res));
+            }
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                ifc->armed = 0;
+        }
+        else if (op == SR_URING_SEND) {
+            sr_uring_lock(sr, io);
+            io->tx_free[io->tx_nfree++] = (int)idx;
+            sr_uring_unlock(sr, io);
+        }
+
+        head++;
+        n++;
+        if (head == tail)
+            tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    }
+    __atomic_store_n(&io->br->tail, io->br_tail, __ATOMIC_RELEASE);
+    __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+    io->completions += n;
+
+    /* -- multishot receives stop e.g. when buffers ran out, re-arm -- */
+    sr_uring_lock(sr, io);
+    for (i = 0; i < io->nifaces; i++) {
+        if (!io->ifaces[i].armed)
+            sr_uring_arm_recv(io, i);
+    }
+    sr_uring_unlock(sr, io);
+
+    /* -- end of the receive batch: its flush submits the re-arms with
+       what is staged, and the event loop will not call back before new
+       input anyway -- */
+    ret = sr_end_batch(sr);
+
+    return ret == 0 ? 1 : -1;
+} /* -- sr_uring_poll -- */
+
+static int sr_uring_fd(struct sr_instance* sr)
+{
+    return ((struct sr_uring_io*)sr->io_priv)->ring_fd;
+} /* -- sr_uring_fd -- */
+
+static void sr_uring_close(struct sr_instance* sr)
+{
+    struct sr_uring_io* io = (struct sr_uring_io*)sr->io_priv;
+    int i;
+
+    if (io == 0)
+        return;
+
+    for (i = 0; i < io->nifaces; i++) {
+        fprintf(stderr, "%s: rx %lu rx truncated %lu tx %lu tx drops %lu\n",
+                io->ifaces[i].name, io->ifaces[i].rx_pkts,
+                io->ifaces[i].rx_truncated, io->ifaces[i].tx_pkts,
+                io->ifaces[i].tx_drops);
+        if (io->ifaces[i].fd != -1)
+            close(io->ifaces[i].fd);
+    }
+    if (io->enters)
+        fprintf(stderr, "io_uring: %lu completions in %lu enters\n",
+                io->completions, io->enters);
+
+    if (io->sqes)
+        munmap(io->sqes, io->sqes_len);
+    if (io->sq_ptr)
+        munmap(io->sq_ptr, io->sq_len);
+    if (io->ring_fd != -1)
+        close(io->ring_fd);
+    if (io->br)
+        munmap(io->br, io->br_len);
+    sr_mem_free(io->rx_bufs);
+    sr_mem_free(io->tx_bufs);
+    pthread_mutex_destroy(&io->lock);
+
+    free(io);
+    sr->io_priv = 0;
+} /* -- sr_uring_close -- */
+
+struct sr_io_ops sr_io_uring =
+{
+    "uring",
+    sr_uring_open,
+    sr_uring_poll,
+    sr_uring_fd,
+    sr_uring_send,
+    sr_uring_flush,
+    sr_uring_close
+};
+
+#else /* _LINUX_ && IORING_RECV_MULTISHOT */
+
+static int sr_uring_open(struct sr_instance* sr, const char* arg)
+{
+    fprintf(stderr, "The uring backend needs Linux 6.0 headers or newer\n");
+    return -1;
+}
+
+struct sr_io_ops sr_io_uring = { "uring", sr_uring_open, 0, 0, 0, 0, 0 };
+
+#endif /* _LINUX_ && IORING_RECV_MULTISHOT */
@@ -0,0 +1,191 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Per-thread trace rings, see sr_log.h
+ *
+ * A thread gets its ring the first time it records an event, and the
+ * ring goes on a global list for sr_trace_close; that is the only time
+ * the lock is taken.  The trace file is
+ *
+ *   SR_TRACE_MAGIC, uint32 rings
+ *   per ring: uint32 thread id, uint32 events, uint64 recorded,
+ *             then the events oldest first
+ *
+ * in the byte order of the host that wrote it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#endif /* _LINUX_ */
+
+#include "sr_log.h"
+
+struct sr_trace_ring
+{
+    struct sr_trace_ring* next;
+    uint32_t tid;
+    uint64_t head;                          /* events recorded */
+    struct sr_trace_ev ev[SR_TRACE_RING];
+};
+
+int sr_trace_on = 0;
+
+static char* sr_trace_path = 0;
+static struct sr_trace_ring* sr_trace_rings = 0;
+static pthread_mutex_t sr_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct sr_trace_ring* sr_trace_self = 0;
+
+int sr_trace_open(const char* path)
+{
+    FILE* fp;
+
+    /* -- REQUIRES -- */
+    assert(path);
+
+    /* -- find out now rather than at exit that it cannot be written -- */
+    if ( (fp = fopen(path, "wb")) == 0 )
+    {
+        perror("fopen(..):sr_log.c::sr_trace_open");
+        return -1;
+    }
+    fclose(fp);
+
+    sr_trace_path = strdup(path);
+    sr_trace_on = 1;
+    return 0;
+} /* -- sr_trace_open -- */
+
+static struct sr_trace_ring* sr_trace_attach(void)
+{
+    struct sr_trace_ring* r;
+
+    if ( (r = (struct sr_trace_ring*)calloc(1, sizeof(struct sr_trace_ring))) == 0 )
+    { return 0; }
+#ifdef _LINUX_
+    r->tid = (uint32_t)syscall(SYS_gettid);
+#else
+    r->tid = (uint32_t)getpid();
+#endif /* _LINUX_ */
+
+    pthread_mutex_lock(&sr_trace_lock);
+    r->next = sr_trace_rings;
+    sr_trace_rings = r;
+    pthread_mutex_unlock(&sr_trace_lock);
+
+    sr_trace_self = r;
+    return r;
+} /* -- sr_trace_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_rec(..)
+ * Scope:  Global
+ *
+ * Only the owning thread writes its ring, so the newest events simply
+ * overwrite the oldest.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_trace_rec(uint16_t id, uint16_t x, uint32_t a, uint32_t b, uint32_t c)
+{
+    struct sr_trace_ring* r = sr_trace_self;
+    struct sr_trace_ev* e;
+    struct timespec ts;
+
+    if ( r == 0 && (r = sr_trace_attach()) == 0 )
+    { return; }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    e = &r->ev[r->head & (SR_TRACE_RING - 1)];
+    e->ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    e->id = id;
+    e->x = x;
+    e->a = a;
+    e->b = b;
+    e->c = c;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+} /* -- sr_trace_rec -- */
+
+uint32_t sr_trace_name(const char* name)
+{
+    uint32_t v = 0;
+    unsigned int i;
+
+    for ( i = 0; i < sizeof(v) && name[i]; i++ )
+    { ((char*)&v)[i] = name[i]; }
+    return v;
+} /* -- sr_trace_name -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_close(..)
+ * Scope:  Global
+ *
+ * A thread still running (the ARP thread is never joined) may overwrite
+ * its oldest events while they are written; at worst one is torn. For
+ * the same reason the rings are left to the exit rather than freed.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_trace_close(void)
+{
+    struct sr_trace_ring* r;
+    FILE* fp;
+    uint32_t n = 0, count;
+    uint64_t head, first;
+
+    if ( sr_trace_path == 0 )
+    { return; }
+    sr_trace_on = 0;
+
+    pthread_mutex_lock(&sr_trace_lock);
+    if ( (fp = fopen(sr_trace_path, "wb")) == 0 )
+    { perror("fopen(..):sr_log.c::sr_trace_close"); }
+    else
+    {
+        for ( r = sr_trace_rings; r; r = r->next )
+        { n++; }
+        fwrite(SR_TRACE_MAGIC, 1, 8, fp);
+        fwrite(&n, sizeof(n), 1, fp);
+
+        for ( r = sr_trace_rings; r; r = r->next )
+        {
+            head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            count = head < SR_TRACE_RING ? (uint32_t)head : SR_TRACE_RING;
+            first = head - count;
+            fwrite(&r->tid, sizeof(r->tid), 1, fp);
+            fwrite(&count, sizeof(count), 1, fp);
+            fwrite(&head, sizeof(head), 1, fp);
+            /* -- oldest first: the tail of the ring, then its start -- */
+            if ( (first & (SR_TRACE_RING - 1)) + count > SR_TRACE_RING )
+            {
+                fwrite(&r->ev[first & (SR_TRACE_RING - 1)], sizeof(struct sr_trace_ev),
+                       SR_TRACE_RING - (first & (SR_TRACE_RING - 1)), fp);
+                fwrite(r->ev, sizeof(struct sr_trace_ev),
+                       head & (SR_TRACE_RING - 1), fp);
+            }
+            else
+            {
+                fwrite(&r->ev[first & (SR_TRACE_RING - 1)], sizeof(struct sr_trace_ev),
+                       count, fp);
+            }
+            fprintf(stderr, "trace: thread %u, %lu events (%u kept)\n", r->tid,
+                    (unsigned long)head, count);
+        }
+        fclose(fp);
+    }
+
+    pthread_mutex_unlock(&sr_trace_lock);
+
+    free(sr_trace_path);
+    sr_trace_path = 0;
+} /* -- sr_trace_close -- */
@@ -0,0 +1,144 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Logging for the forwarding path.  There are two layers:
+ *
+ * Text messages, LogError(..) to LogDebug(..), with a level fixed at
+ * compile time (SR_LOG_LEVEL, set by the Makefile's LOGLEVEL).  Levels
+ * above it expand to nothing, so a per-packet LogDebug costs nothing,
+ * not even its arguments, in a normal build.
+ *
+ * Trace events, SR_TRACE(..), for diagnostics at full rate.  An event is
+ * a fixed-size binary record, an id and four integer arguments with a
+ * nanosecond timestamp, appended to a ring owned by the calling thread,
+ * so recording one is a clock read and a few stores with no locks and
+ * no formatting.  Each ring keeps the last SR_TRACE_RING events of its
+ * thread.  Tracing is off until -L names a file; on exit the rings are
+ * written there and sr_tracedump turns them into one timeline.  Built
+ * with TRACE=0 the trace points compile out as well.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_LOG_ERROR    1
+#define SR_LOG_WARN     2
+#define SR_LOG_INFO     3
+#define SR_LOG_DEBUG    4   /* per packet */
+
+#ifndef SR_LOG_LEVEL
+#define SR_LOG_LEVEL    SR_LOG_INFO
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_ERROR
+#define LogError(x, args...) fprintf(stderr, x, ## args)
+#else
+#define LogError(x, args...) do{}while(0)
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_WARN
+#define LogWarn(x, args...) fprintf(stderr, x, ## args)
+#else
+#define LogWarn(x, args...) do{}while(0)
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_INFO
+#define LogInfo(x, args...) printf(x, ## args)
+#else
+#define LogInfo(x, args...) do{}while(0)
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_DEBUG
+#define LogDebug(x, args...) printf(x, ## args)
+#else
+#define LogDebug(x, args...) do{}while(0)
+#endif
+
+/* ----------------------------------------------------------------------------
+ * Trace events
+ *
+ * Arguments that are addresses are stored as the headers carry them, in
+ * network order; interfaces as the first four bytes of their name.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_TRACE_RING   4096    /* events kept per thread, a power of two */
+#define SR_TRACE_MAGIC  "SRTRACE1"
+
+                                /* x          a          b          c      */
+#define SR_EV_RX          1     /* ethertype  len        iface             */
+#define SR_EV_UNKNOWN     2     /* ethertype  len                          */
+#define SR_EV_ARP_BAD     3     /*            len                          */
+#define SR_EV_ARP         4     /* opcode     sender ip  target ip         */
+#define SR_EV_ARP_NOT_US  5     /*            target ip                    */
+#define SR_EV_ARP_FLUSH   6     /*            ip                    frames */
+#define SR_EV_ARP_GIVEUP  7     /*            ip                    frames */
+#define SR_EV_IP          8     /* protocol   src        dst        len    */
+#define SR_EV_IP_BAD      9     /* reason     src        dst        len    */
+#define SR_EV_IP_LOCAL   10     /* protocol   src        dst               */
+#define SR_EV_TTL        11     /*            src        dst               */
+#define SR_EV_NO_ROUTE   12     /*            src        dst               */
+#define SR_EV_ARP_WAIT   13     /*            next hop   iface             */
+#define SR_EV_FORWARD    14     /* checksum   dst        iface      len    */
+#define SR_EV_ICMP_LIMIT 15     /* icmp type  dst                          */
+#define SR_EV_MAX        16
+
+/* SR_EV_IP_BAD reasons, as sr_validate_ip returns them */
+#define SR_IP_BAD_LEN       1   /* frame shorter than an IP header */
+#define SR_IP_BAD_SUM       2
+#define SR_IP_BAD_VER       3
+#define SR_IP_BAD_HL        4   /* ip_hl under 5 or past the frame */
+#define SR_IP_BAD_TOTLEN    5   /* ip_len under ip_hl or past the frame */
+#define SR_IP_BAD_ICMP_LEN  6
+#define SR_IP_BAD_ICMP_SUM  7
+#define SR_IP_BAD_MAX       8
+
+struct sr_trace_ev
+{
+    uint64_t ns;                /* CLOCK_MONOTONIC */
+    uint16_t id;
+    uint16_t x;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+#ifndef SR_TRACE_ON
+#define SR_TRACE_ON 1
+#endif
+
+extern int sr_trace_on;
+
+#if SR_TRACE_ON
+#define SR_TRACE(ev, x, a, b, c) \
+  do { if (sr_trace_on) sr_trace_rec((ev), (x), (a), (b), (c)); } while (0)
+#else
+#define SR_TRACE(ev, x, a, b, c) do{}while(0)
+#endif
+
+/* Start tracing, to be written to 'path' by sr_trace_close. */
+int  sr_trace_open(const char* path);
+
+/* Append an event to the calling thread's ring. */
+void sr_trace_rec(uint16_t id, uint16_t x, uint32_t a, uint32_t b, uint32_t c);
+
+/* First four bytes of an interface name, for an event argument. */
+uint32_t sr_trace_name(const char* name);
+
+/* Write the rings out. Call once the threads have stopped. */
+void sr_trace_close(void);
+
+#endif /* -- SR_LOG_H -- */
@@ -20,9 +20,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <signal.h>
 #include <sys/types.h>
 
 #ifdef _LINUX_
@@ -30,8 +33,14 @@
 #endif /* _LINUX_ */
 
 #include "sr_dumper.h"
+#include "sr_capture.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_io.h"
+#include "sr_worker.h"
+#include "sr_numa.h"
+#include "sr_cksum.h"
+#include "sr_log.h"
 
 extern char* optarg;
 
@@ -48,6 +57,7 @@ extern char* optarg;
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
+static int sr_parse_limit(const char* , unsigned int* , unsigned int* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
 
@@ -65,11 +75,25 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *filter = 0;
+    char *tracefile = 0;
+    unsigned int sample = 0;
+    unsigned int batch = 0;
+    int event_mode = 0;
+    int nworkers = 0;
+    int pipeline = 0;
+    char *dispatch = 0;
+    unsigned long reorder_us = 0;
+    char *cpulist = 0;
+    char *backend = 0;
+    char *backend_arg = 0;
+    unsigned int icmp_pps = SR_RL_PPS;
+    unsigned int icmp_src_pps = SR_RL_SRC_PPS;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:B:Ei:W:PD:R:C:F:S:L:I:")) != EOF)
     {
         switch (c)
         {
@@ -101,11 +125,98 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'B':
+                batch = atoi((char *) optarg);
+                break;
+            case 'E':
+                event_mode = 1;
+                break;
+            case 'i':
+                backend = optarg;
+                break;
+            case 'W':
+                nworkers = atoi((char *) optarg);
+                break;
+            case 'P':
+                pipeline = 1;
+                break;
+            case 'D':
+                dispatch = optarg;
+                break;
+            case 'R':
+                reorder_us = strtoul(optarg, NULL, 10);
+                if(reorder_us == 0)
+                { reorder_us = SR_REORDER_WAIT_US; }
+                break;
+            case 'C':
+                cpulist = optarg;
+                break;
+            case 'F':
+                filter = optarg;
+                break;
+            case 'S':
+                sample = strtoul(optarg, NULL, 10);
+                break;
+            case 'L':
+                tracefile = optarg;
+                break;
+            case 'I':
+                if(sr_parse_limit(optarg, &icmp_pps, &icmp_src_pps) != 0)
+                {
+                    fprintf(stderr, "Bad ICMP limit %s\n", optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    sr.txq.max_frames = batch;
+    sr_ratelimit_init(&(sr.icmp_limit), icmp_pps, icmp_src_pps);
+    sr.event_mode = event_mode;
+    sr.nworkers = nworkers;
+    if(dispatch)
+    {
+        if(strcmp(dispatch, "steal") == 0)
+        { sr.dispatch = SR_DISPATCH_STEAL; }
+        else if(strcmp(dispatch, "spray") == 0)
+        {
+            sr.dispatch = SR_DISPATCH_SPRAY;
+            if(reorder_us == 0)
+            { reorder_us = SR_REORDER_WAIT_US; }
+        }
+        else if(strcmp(dispatch, "ordered") == 0)
+        {
+            sr.dispatch = SR_DISPATCH_STEAL;
+            sr.flow_guard = 1;
+        }
+        else if(strcmp(dispatch, "hash") != 0)
+        {
+            fprintf(stderr, "Unknown dispatch mode %s\n", dispatch);
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    /* -- the reorder stage lives in the TX thread -- */
+    if(reorder_us)
+    { pipeline = 1; }
+    sr.reorder_us = reorder_us;
+    sr.pipeline = pipeline;
+    if(pipeline && nworkers == 0)
+    { sr.nworkers = 1; }
+
+    /* -- pin this (the RX) thread first, so what it allocates is local -- */
+    if(cpulist)
+    {
+        if((sr.ncpus = sr_cpu_parse(cpulist, &sr.cpus)) < 0)
+        {
+            fprintf(stderr, "Bad CPU list %s\n", cpulist);
+            exit(1);
+        }
+    }
+    sr_pin_self("rx", sr_cpu_for(&sr, SR_ROLE_RX, 0));
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -123,31 +234,79 @@ int main(int argc, char **argv)
     else
     { strncpy(sr.user, user, 32); }
 
-    /* -- set up file pointer for logging of raw packets -- */
+    /* -- set up the capture of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        if(sr_capture_open(&sr, logfile) != 0)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
             exit(1);
         }
+        if(sr_capture_filter(&sr, filter, sample) != 0)
+        { exit(1); }
+    }
+    else if(filter != 0 || sample != 0)
+    {
+        fprintf(stderr,"-F and -S need a capture (-l)\n");
+        exit(1);
     }
 
+    /* -- binary trace of the forwarding path -- */
+    if(tracefile != 0 && sr_trace_open(tracefile) != 0)
+    {
+        fprintf(stderr,"Error opening trace file %s\n", tracefile);
+        exit(1);
+    }
+
+    /* -- checksum kernel for this CPU -- */
+    sr_cksum_init();
+    Debug("Using the %s checksum kernel\n", sr_cksum_name());
+
     Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
     if(template)
         Debug("Requesting topology template %s\n", template);
     else
         Debug("Requesting topology %d\n", topo);
 
+    /* -- pick the frame I/O backend, name[:arguments] -- */
+    if(backend != 0)
+    {
+        if((backend_arg = strchr(backend, ':')) != 0)
+        { *backend_arg++ = 0; }
+        if((sr.io = sr_io_find(backend)) == 0)
+        {
+            fprintf(stderr,"Unknown I/O backend %s\n", backend);
+            exit(1);
+        }
+    }
+
+    if(sr.io != &sr_io_vns)
+    {
+        /* -- local interfaces, the routing table was loaded above -- */
+        if(template != NULL)
+        {
+            fprintf(stderr,"Templates need the VNS backend\n");
+            exit(1);
+        }
+        if(sr.io->open(&sr, backend_arg) != 0)
+        {
+            fprintf(stderr,"Error opening I/O backend %s\n", backend);
+            return 1;
+        }
+        if(sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr,"Routing table not consistent with hardware\n");
+            return 1;
+        }
+        printf(" <-- Ready to process packets --> \n");
+    }
     /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    else if(sr_connect_to_server(&sr,port,server) == -1)
     {
         return 1;
     }
-
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+    else if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
         Debug("Connected to new instantiation of topology template %s\n", template);
         sr_load_rt_wrap(&sr, "rtable.vrhost");
     }
@@ -160,7 +319,13 @@ int main(int argc, char **argv)
     sr_init(&sr);
 
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(sr.event_mode)
+    { sr_event_loop(&sr); }
+    else
+    {
+        while( !__atomic_load_n(&sr.stop, __ATOMIC_ACQUIRE) &&
+               sr.io->poll(&sr, -1) == 1);
+    }
 
     sr_destroy_instance(&sr);
 
@@ -178,11 +343,75 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-B tx batch size] [-E] \n");
+    printf("           [-i backend[:args]] [-W workers] [-P] \n");
+    printf("           [-D hash|steal|ordered|spray] [-R usec] [-C cpulist] \n");
+    printf("           [-F capture filter] [-S n] [-L trace file] \n");
+    printf("           [-I pps[,per-source pps]] \n");
+    printf("   -E runs a single-threaded epoll event loop \n");
+    printf("   SIGUSR1 dumps the ARP cache and the counters to stderr \n");
+    printf("   -W forwards on n worker threads, sharded by flow \n");
+    printf("   -P moves transmission to a TX thread behind the workers \n");
+    printf("   -D steal lets idle workers take batches queued for busy ones, \n");
+    printf("      ordered also keeps each flow on one worker at a time, \n");
+    printf("      spray deals batches round robin (implies -R) \n");
+    printf("   -R puts each flow back in arrival order before transmission, \n");
+    printf("      waiting at most usec (default %d) for a late frame (implies -P) \n",
+            SR_REORDER_WAIT_US);
+    printf("   -C pins the RX thread, workers, TX thread and ARP thread to \n");
+    printf("      the listed CPUs in that order, e.g. 0-3,6 \n");
+    printf("   -l file.pcapng[:size=MB,secs=N] captures in pcapng, rotating \n");
+    printf("      to numbered files at the given size or age \n");
+    printf("   -F records only frames that match, e.g. \"icmp and dst net 10.0.1.0/24\", \n");
+    printf("      \"iface eth1 and not icmp-type 8\", \"arp or in\" \n");
+    printf("   -S n records one in n of the frames that match \n");
+    printf("   -L records trace events per thread, written on exit; decode \n");
+    printf("      with sr_tracedump \n");
+    printf("   -I limits the ICMP messages the router sends, in all and to \n");
+    printf("      one address (default %d,%d), 0 for no limit, -I 0 for none \n",
+            SR_RL_PPS, SR_RL_SRC_PPS);
+    printf("   -i packet:eth0[=ip],eth1[=ip],... forwards between host interfaces \n");
+    printf("   -i uring:eth0[=ip],eth1[=ip],... the same through io_uring \n");
+    printf("   -i tap:tap0=ip[@mac],tap1=ip[@mac],...[,queues=n] uses TAP devices \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_parse_limit(..)
+ * Scope: Local
+ *
+ * -I pps[,per-source pps], decimal numbers and nothing else. A bare 0
+ * turns both limits off; otherwise the per-source one is left alone
+ * unless given. Returns -1 on anything else.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_parse_limit(const char* arg, unsigned int* pps, unsigned int* src_pps)
+{
+    unsigned long v, src = *src_pps;
+    char* end;
+
+    if(!isdigit((unsigned char)arg[0]))
+    { return -1; }
+    v = strtoul(arg, &end, 10);
+    if(*end == ',')
+    {
+        arg = end + 1;
+        if(!isdigit((unsigned char)arg[0]))
+        { return -1; }
+        src = strtoul(arg, &end, 10);
+    }
+    else if(v == 0)
+    { src = 0; }
+    if(*end != 0 || v > UINT_MAX || src > UINT_MAX)
+    { return -1; }
+
+    *pps = (unsigned int)v;
+    *src_pps = (unsigned int)src;
+    return 0;
+} /* -- sr_parse_limit -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_set_user(..)
  * Scope: local
@@ -217,14 +446,33 @@ void sr_set_user(struct sr_instance* sr)
 
 static void sr_destroy_instance(struct sr_instance* sr)
 {
+    sigset_t mask;
+
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    /* -- no more wakeups from sr_signal_thread, and nothing sending from
+          the ARP thread once the backend is closed -- */
+    if(!sr->event_mode)
     {
-        sr_dump_close(sr->logfile);
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGUSR2);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+        __atomic_store_n(&sr->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(sr->arp_thread, NULL);
     }
 
+    sr_workers_stop(sr);
+    if(sr->io->close)
+    { sr->io->close(sr); }
+    sr_txq_destroy(&(sr->txq));
+    sr_ratelimit_stats(&(sr->icmp_limit), stderr);
+    sr_ratelimit_destroy(&(sr->icmp_limit));
+    free(sr->cpus);
+
+    sr_capture_close(sr);
+    sr_trace_close();
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -249,59 +497,26 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->if_list = 0;
     sr->routing_table = 0;
     sr->logfile = 0;
+    sr->capture = 0;
+    sr->io = &sr_io_vns;
+    sr->io_priv = 0;
+    sr->event_mode = 0;
+    sr->lockless = 0;
+    sr->nworkers = 0;
+    sr->workers = 0;
+    sr->pipeline = 0;
+    sr->txstage = 0;
+    sr->dispatch = SR_DISPATCH_HASH;
+    sr->flow_guard = 0;
+    sr->reorder_us = 0;
+    sr->cpus = 0;
+    sr->ncpus = 0;
+    sr->sched = 0;
+    sr->rxbuf = 0;
+    sr->rxlen = 0;
+    sr_txq_init(&(sr->txq), 0);
 } /* -- sr_init_instance -- */
 
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
-    {
-        return 999; /* doh! */
-    }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
-
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
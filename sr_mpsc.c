@@ -0,0 +1,100 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mpsc.c
+ *
+ * Description:
+ *
+ * Lock-free multi-producer/single-consumer queue, see sr_mpsc.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_mpsc.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_mpsc_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_mpsc_init(struct sr_mpsc* q, unsigned int size)
+{
+    unsigned int n = 1, i;
+
+    /* -- REQUIRES -- */
+    assert(q);
+    assert(size > 0);
+
+    while ( n < size )
+    { n <<= 1; }
+
+    memset(q, 0, sizeof(struct sr_mpsc));
+    if ( (q->seq = (unsigned int*)malloc(n * sizeof(unsigned int))) == 0 )
+    { return -1; }
+    for ( i = 0; i < n; i++ )
+    { q->seq[i] = i; }
+    q->mask = n - 1;
+
+    return 0;
+} /* -- sr_mpsc_init -- */
+
+void sr_mpsc_destroy(struct sr_mpsc* q)
+{
+    free(q->seq);
+    q->seq = 0;
+} /* -- sr_mpsc_destroy -- */
+
+int sr_mpsc_claim(struct sr_mpsc* q, unsigned int* pos)
+{
+    unsigned int p = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    int dif;
+
+    while ( 1 )
+    {
+        dif = (int)(__atomic_load_n(&q->seq[p & q->mask], __ATOMIC_ACQUIRE) - p);
+        if ( dif == 0 )
+        {
+            if ( __atomic_compare_exchange_n(&q->head, &p, p + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+            { break; }
+        }
+        else if ( dif < 0 )
+        {
+            /* -- full: the consumer is a lap behind -- */
+            return -1;
+        }
+        else
+        { p = __atomic_load_n(&q->head, __ATOMIC_RELAXED); }
+    }
+
+    *pos = p;
+    return 0;
+} /* -- sr_mpsc_claim -- */
+
+void sr_mpsc_publish(struct sr_mpsc* q, unsigned int pos)
+{
+    __atomic_store_n(&q->seq[pos & q->mask], pos + 1, __ATOMIC_RELEASE);
+} /* -- sr_mpsc_publish -- */
+
+int sr_mpsc_peek(struct sr_mpsc* q, unsigned int* pos)
+{
+    if ( __atomic_load_n(&q->seq[q->tail & q->mask], __ATOMIC_ACQUIRE) != q->tail + 1 )
+    { return -1; }
+    *pos = q->tail;
+    return 0;
+} /* -- sr_mpsc_peek -- */
+
+void sr_mpsc_release(struct sr_mpsc* q)
+{
+    __atomic_store_n(&q->seq[q->tail & q->mask], q->tail + q->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELAXED);
+} /* -- sr_mpsc_release -- */
+
+int sr_mpsc_pending(struct sr_mpsc* q)
+{
+    unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&q->seq[tail & q->mask], __ATOMIC_ACQUIRE) == tail + 1;
+} /* -- sr_mpsc_pending -- */
@@ -0,0 +1,50 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mpsc.h
+ *
+ * Description:
+ *
+ * Bounded multi-producer/single-consumer queue (after Vyukov).  It only
+ * hands out positions; the caller keeps the entries in an array of its
+ * own, indexed by position & mask, so they can be of any size and are
+ * written in place.  Each slot carries a sequence number saying whose
+ * turn it is: a producer claims position p by moving 'head' on with a
+ * CAS once slot p reads p, fills the entry and publishes it as p + 1;
+ * the consumer takes position t once the slot reads t + 1 and hands it
+ * back for the next lap with t + size.  Producers never wait for each
+ * other beyond a failed CAS, and never for the consumer.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_MPSC_H
+#define SR_MPSC_H
+
+#include "sr_ring.h"
+
+struct sr_mpsc
+{
+    unsigned int head;              /* next position to claim, producers */
+    char pad0[SR_CACHELINE - sizeof(unsigned int)];
+    unsigned int tail;              /* next position to take, consumer */
+    char pad1[SR_CACHELINE - sizeof(unsigned int)];
+    unsigned int* seq;
+    unsigned int mask;
+};
+
+/* 'size' is rounded up to a power of two. Returns 0 on success. */
+int  sr_mpsc_init(struct sr_mpsc* q, unsigned int size);
+void sr_mpsc_destroy(struct sr_mpsc* q);
+
+/* Producer: claim a position. Returns 0 on success, -1 if the queue is
+   full. The entry must be published once filled. */
+int  sr_mpsc_claim(struct sr_mpsc* q, unsigned int* pos);
+void sr_mpsc_publish(struct sr_mpsc* q, unsigned int pos);
+
+/* Consumer: position of the oldest published entry. Returns 0 on success,
+   -1 if there is none. The entry must be released once read. */
+int  sr_mpsc_peek(struct sr_mpsc* q, unsigned int* pos);
+void sr_mpsc_release(struct sr_mpsc* q);
+
+/* Any thread: non-zero if an entry is waiting for the consumer. */
+int  sr_mpsc_pending(struct sr_mpsc* q);
+
+#endif /* -- SR_MPSC_H -- */
@@ -0,0 +1,239 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_neigh.c
+ *
+ * Description:
+ *
+ * Per-worker neighbor shards, see sr_neigh.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_router.h"
+#include "sr_utils.h"
+#include "sr_worker.h"
+#include "sr_neigh.h"
+
+#define SR_NEIGH_MUL 0x9e3779b1U
+
+/*---------------------------------------------------------------------
+ * Method: sr_neigh_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_neigh_init(struct sr_neigh* n, int id)
+{
+    /* -- REQUIRES -- */
+    assert(n);
+
+    n->id = id;
+    if ( sr_mpsc_init(&n->box, SR_NEIGH_MBOX) != 0 )
+    { return -1; }
+    if ( sr_arpcache_init(&n->cache) != 0 )
+    {
+        sr_mpsc_destroy(&n->box);
+        return -1;
+    }
+    /* -- only the owner ever touches it -- */
+    n->cache.lockless = 1;
+
+    return 0;
+} /* -- sr_neigh_init -- */
+
+void sr_neigh_destroy(struct sr_neigh* n)
+{
+    struct sr_arpreq* req;
+
+    while ( (req = n->cache.requests) != 0 )
+    {
+        n->cache.requests = req->next;
+        sr_arpreq_free(req);
+    }
+    sr_arpcache_destroy(&n->cache);
+    sr_mpsc_destroy(&n->box);
+} /* -- sr_neigh_destroy -- */
+
+struct sr_arpcache* sr_neigh_cache(struct sr_instance* sr)
+{
+    return sr_worker_self ? &sr_worker_self->neigh->cache : &sr->cache;
+} /* -- sr_neigh_cache -- */
+
+int sr_neigh_home(struct sr_instance* sr, uint32_t ip)
+{
+    return (int)(((ip * SR_NEIGH_MUL) >> 16) % (uint32_t)sr->nworkers);
+} /* -- sr_neigh_home -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_neigh_post(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_neigh_post(struct sr_instance* sr, int to, int op, uint32_t ip,
+                  const unsigned char* mac)
+{
+    struct sr_worker* w = sr->workers[to];
+    struct sr_neigh* n = w->neigh;
+    struct sr_neigh_msg* m;
+    unsigned int pos;
+
+    if ( sr_mpsc_claim(&n->box, &pos) != 0 )
+    {
+        __atomic_fetch_add(&n->lost, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    m = &n->msgs[pos & (SR_NEIGH_MBOX - 1)];
+    m->op = op;
+    m->from = sr_worker_self ? sr_worker_self->id : -1;
+    m->ip = ip;
+    if ( mac )
+    { memcpy(m->mac, mac, ETHER_ADDR_LEN); }
+    sr_mpsc_publish(&n->box, pos);
+
+    sr_worker_kick(w);
+
+    return 0;
+} /* -- sr_neigh_post -- */
+
+/* Owner: take the next message. Returns 0, or -1 if there is none. */
+static int sr_neigh_take(struct sr_neigh* n, struct sr_neigh_msg* m)
+{
+    unsigned int pos;
+
+    if ( sr_mpsc_peek(&n->box, &pos) != 0 )
+    { return -1; }
+    *m = n->msgs[pos & (SR_NEIGH_MBOX - 1)];
+    sr_mpsc_release(&n->box);
+
+    return 0;
+} /* -- sr_neigh_take -- */
+
+int sr_neigh_pending(struct sr_neigh* n)
+{
+    return sr_mpsc_pending(&n->box);
+} /* -- sr_neigh_pending -- */
+
+void sr_neigh_publish(struct sr_instance* sr, uint32_t ip, const unsigned char* mac)
+{
+    int i;
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        if ( sr->workers[i] != sr_worker_self )
+        { sr_neigh_post(sr, i, SR_NEIGH_UPDATE, ip, mac); }
+    }
+} /* -- sr_neigh_publish -- */
+
+void sr_neigh_fail(struct sr_instance* sr, uint32_t ip)
+{
+    int i;
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        if ( sr->workers[i] != sr_worker_self )
+        { sr_neigh_post(sr, i, SR_NEIGH_FAIL, ip, 0); }
+    }
+} /* -- sr_neigh_fail -- */
+
+void sr_neigh_tick(struct sr_instance* sr)
+{
+    int i;
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    { sr_neigh_post(sr, i, SR_NEIGH_TICK, 0, 0); }
+} /* -- sr_neigh_tick -- */
+
+/* Send the packets waiting on 'req' to 'mac' and free it. */
+static void sr_neigh_release(struct sr_instance* sr, struct sr_arpreq* req,
+                             unsigned char* mac)
+{
+    struct sr_packet* pkt;
+
+    for ( pkt = req->packets; pkt != 0; pkt = pkt->next )
+    { sr_forward_packet(sr, pkt->buf, pkt->len, sr_get_interface(sr, pkt->iface), mac); }
+    sr_arpreq_free(req);
+} /* -- sr_neigh_release -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_neigh_poll(..)
+ * Scope:  Global
+ *
+ * Called by the owning worker between batches. ARP requests and ICMP
+ * errors decided on here are sent as one lot at the end, like the
+ * sweeper does.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_neigh_poll(struct sr_instance* sr, struct sr_neigh* n)
+{
+    struct sr_arpcache* cache = &n->cache;
+    struct sr_neigh_msg m;
+    struct sr_arpentry entry;
+    struct sr_arpreq* req;
+    struct sr_arp_work work;
+    int count = 0, tick = 0;
+
+    if ( !sr_neigh_pending(n) )
+    { return 0; }
+
+    sr_arp_work_init(&work);
+
+    while ( count < SR_NEIGH_POLL_MAX && sr_neigh_take(n, &m) == 0 )
+    {
+        count++;
+        switch ( m.op )
+        {
+            case SR_NEIGH_UPDATE:
+                n->updates++;
+                req = (struct sr_arpreq*)sr_arpcache_insert(cache, m.mac, m.ip);
+                if ( req )
+                { sr_neigh_release(sr, req, m.mac); }
+                break;
+
+            case SR_NEIGH_RESOLVE:
+                n->resolves++;
+                if ( sr_arpcache_get(cache, m.ip, &entry) )
+                {
+                    /* -- already known, the asker just missed the update -- */
+                    if ( m.from >= 0 )
+                    { sr_neigh_post(sr, m.from, SR_NEIGH_UPDATE, m.ip, entry.mac); }
+                }
+                else
+                {
+                    req = (struct sr_arpreq*)sr_arpcache_queuereq(cache, m.ip, 0, 0, 0);
+                    sr_arpreq_collect(sr, req, time(NULL), &work);
+                }
+                break;
+
+            case SR_NEIGH_FAIL:
+                n->fails++;
+                for ( req = cache->requests; req != 0 && req->ip != m.ip; req = req->next );
+                if ( req )
+                {
+                    sr_arpreq_detach(cache, req);
+                    req->next = work.failed;
+                    work.failed = req;
+                }
+                break;
+
+            case SR_NEIGH_TICK:
+                tick = 1;
+                break;
+        }
+    }
+
+    sr_arp_work_run(sr, &work);
+
+    /* -- both end by pushing out what was sent -- */
+    if ( tick )
+    { sr_arpcache_tick(sr); }
+    else
+    { sr_end_batch(sr); }
+
+    return count;
+} /* -- sr_neigh_poll -- */
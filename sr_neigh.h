@@ -0,0 +1,114 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_neigh.h
+ *
+ * Description:
+ *
+ * Per-worker neighbor (ARP) shards.  With -W every forwarding worker owns
+ * a complete ARP cache of its own, entries and request queue alike, and
+ * is the only thread that ever touches it, so lookups on the fast path
+ * are core local and nothing in the neighbor code takes the cache lock.
+ *
+ * Shards talk through message boxes, one per shard (an sr_mpsc queue),
+ * which any thread may post to:
+ *
+ *   UPDATE   an ARP reply arrived on another worker; the receiving shard
+ *            learns the entry and sends the packets it had waiting.
+ *   RESOLVE  a shard needs a next hop it is not home for (see below).
+ *   FAIL     the home shard gave up on a next hop; waiting packets get
+ *            an ICMP host unreachable.
+ *   TICK     once a second from the ARP timer: expire entries and sweep
+ *            the shard's request queue.
+ *
+ * Every next hop has a home shard, picked by hashing its address.  Only
+ * the home shard sends ARP requests for it, so the wire sees one request
+ * per second per next hop however many workers wait on it; the others
+ * queue their packets locally and ask the home shard with RESOLVE.  A
+ * shard that hears nothing back for SR_NEIGH_WAIT seconds (a lost FAIL,
+ * say) gives up on its own.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_NEIGH_H
+#define SR_NEIGH_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#include "sr_mpsc.h"
+#include "sr_arpcache.h"
+
+#define SR_NEIGH_MBOX      1024     /* messages a shard can have queued, a power of two */
+#define SR_NEIGH_POLL_MAX  256      /* messages handled per poll */
+#define SR_NEIGH_WAIT      7.0      /* seconds a non-home shard waits for an answer */
+
+/* Message types */
+#define SR_NEIGH_UPDATE    1
+#define SR_NEIGH_RESOLVE   2
+#define SR_NEIGH_FAIL      3
+#define SR_NEIGH_TICK      4
+
+struct sr_instance;
+
+struct sr_neigh_msg
+{
+    int op;
+    int from;                       /* posting shard, -1 if none */
+    uint32_t ip;                    /* network byte order */
+    unsigned char mac[6];
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_neigh
+ *
+ * One shard. Everything but the box and 'lost' belongs to the owner.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_neigh
+{
+    struct sr_mpsc box;
+    struct sr_neigh_msg msgs[SR_NEIGH_MBOX];
+    struct sr_arpcache cache;
+    int id;
+    unsigned long updates;          /* entries learnt from other shards */
+    unsigned long resolves;         /* next hops resolved for other shards */
+    unsigned long fails;            /* next hops given up on by their home */
+    unsigned long lost;             /* messages dropped on a full box */
+};
+
+/* Set up shard 'id' in zeroed memory. Returns 0 on success. */
+int  sr_neigh_init(struct sr_neigh* n, int id);
+void sr_neigh_destroy(struct sr_neigh* n);
+
+/* ARP cache of the calling thread: its worker's shard, or sr->cache. */
+struct sr_arpcache* sr_neigh_cache(struct sr_instance* sr);
+
+/* Shard resolving 'ip'. */
+int  sr_neigh_home(struct sr_instance* sr, uint32_t ip);
+
+/* Post a message to shard 'to' and wake its worker. 'mac' may be 0.
+   Returns 0 on success, -1 if the box was full. */
+int  sr_neigh_post(struct sr_instance* sr, int to, int op, uint32_t ip,
+                   const unsigned char* mac);
+
+/* Tell every other shard about an entry, or a next hop given up on. */
+void sr_neigh_publish(struct sr_instance* sr, uint32_t ip, const unsigned char* mac);
+void sr_neigh_fail(struct sr_instance* sr, uint32_t ip);
+
+/* ARP timer: have every shard run its housekeeping. */
+void sr_neigh_tick(struct sr_instance* sr);
+
+/* Owner: handle queued messages. Returns how many there were. */
+int  sr_neigh_poll(struct sr_instance* sr, struct sr_neigh* n);
+
+/* Any thread: non-zero if messages are waiting. */
+int  sr_neigh_pending(struct sr_neigh* n);
+
+#endif /* -- SR_NEIGH_H -- */
@@ -0,0 +1,359 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_numa.c
+ *
+ * Description:
+ *
+ * Thread and memory placement, see sr_numa.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_numa.h"
+
+#define SR_MPOL_PREFERRED  1    /* from <numaif.h>, which needs libnuma */
+#define SR_PLACED_MAX      (SR_MAX_CPUS + 8)
+#define SR_REGIONS_MAX     256
+#define SR_PLACE_NAMELEN   24
+
+struct sr_placed
+{
+    char name[SR_PLACE_NAMELEN];
+    int cpu;
+    int ok;
+};
+
+struct sr_region
+{
+    char name[SR_PLACE_NAMELEN];
+    void* addr;
+    size_t len;
+    int node;
+    int kind;
+};
+
+/* Recorded for the report; written at startup, under the lock */
+static pthread_mutex_t sr_place_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sr_placed sr_placed[SR_PLACED_MAX];
+static int sr_nplaced = 0;
+static struct sr_region sr_regions[SR_REGIONS_MAX];
+static int sr_nregions = 0;
+
+/*---------------------------------------------------------------------
+ * Method: sr_cpu_parse(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_cpu_parse(const char* list, int** cpus)
+{
+    const char* p = list;
+    char* end;
+    long lo, hi;
+    int n = 0;
+
+    /* -- REQUIRES -- */
+    assert(list);
+    assert(cpus);
+
+    if ( (*cpus = (int*)malloc(SR_MAX_CPUS * sizeof(int))) == 0 )
+    { return -1; }
+
+    while ( *p )
+    {
+        lo = strtol(p, &end, 10);
+        if ( end == p || lo < 0 )
+        { break; }
+        hi = lo;
+        if ( *end == '-' )
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if ( end == p || hi < lo )
+            { break; }
+        }
+        for ( ; lo <= hi && n < SR_MAX_CPUS; lo++ )
+        { (*cpus)[n++] = (int)lo; }
+
+        p = end;
+        if ( *p == ',' )
+        { p++; }
+        else if ( *p != 0 )
+        { break; }
+    }
+
+    if ( *p != 0 || n == 0 )
+    {
+        free(*cpus);
+        *cpus = 0;
+        return -1;
+    }
+    return n;
+} /* -- sr_cpu_parse -- */
+
+int sr_cpu_for(struct sr_instance* sr, int role, int index)
+{
+    int slot;
+
+    if ( sr->ncpus == 0 )
+    { return -1; }
+
+    switch ( role )
+    {
+        case SR_ROLE_RX:     slot = 0; break;
+        case SR_ROLE_WORKER: slot = 1 + index; break;
+        case SR_ROLE_TX:     slot = 1 + sr->nworkers; break;
+        default:             slot = 1 + sr->nworkers + (sr->pipeline ? 1 : 0); break;
+    }
+    return sr->cpus[slot % sr->ncpus];
+} /* -- sr_cpu_for -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cpu_node(..)
+ * Scope:  Global
+ *
+ * sysfs lists the node of a CPU as a 'nodeN' entry in its directory.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_cpu_node(int cpu)
+{
+    char path[64];
+    DIR* dir;
+    struct dirent* de;
+    int node = -1;
+
+    if ( cpu < 0 )
+    { return -1; }
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if ( (dir = opendir(path)) == 0 )
+    { return -1; }
+    while ( (de = readdir(dir)) != 0 )
+    {
+        if ( strncmp(de->d_name, "node", 4) == 0 &&
+             de->d_name[4] >= '0' && de->d_name[4] <= '9' )
+        {
+            node = atoi(de->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+
+    return node;
+} /* -- sr_cpu_node -- */
+
+int sr_node_for(struct sr_instance* sr, int role, int index)
+{
+    return sr_cpu_node(sr_cpu_for(sr, role, index));
+} /* -- sr_node_for -- */
+
+static void sr_place_record(const char* name, int cpu, int ok)
+{
+    pthread_mutex_lock(&sr_place_lock);
+    if ( sr_nplaced < SR_PLACED_MAX )
+    {
+        strncpy(sr_placed[sr_nplaced].name, name, SR_PLACE_NAMELEN - 1);
+        sr_placed[sr_nplaced].cpu = cpu;
+        sr_placed[sr_nplaced].ok = ok;
+        sr_nplaced++;
+    }
+    pthread_mutex_unlock(&sr_place_lock);
+} /* -- sr_place_record -- */
+
+int sr_thread_attr(pthread_attr_t* attr, const char* name, int cpu)
+{
+    int ret = 0;
+#ifdef _LINUX_
+    cpu_set_t set;
+
+    if ( cpu >= 0 )
+    {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+#endif /* _LINUX_ */
+
+    sr_place_record(name, cpu, ret == 0);
+    return ret;
+} /* -- sr_thread_attr -- */
+
+int sr_pin_self(const char* name, int cpu)
+{
+    int ret = 0;
+#ifdef _LINUX_
+    cpu_set_t set;
+
+    if ( cpu >= 0 )
+    {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif /* _LINUX_ */
+
+    sr_place_record(name, cpu, ret == 0);
+    return ret;
+} /* -- sr_pin_self -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_mem_alloc(..)
+ * Scope:  Global
+ *
+ * The node policy is set before anything touches the mapping, so every
+ * page is faulted in on 'node' no matter which thread touches it first.
+ * The policy is only preferred: a full node does not fail the fault.
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_mem_alloc(const char* name, size_t size, int node)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (size + page - 1) & ~(page - 1);
+    void* addr = MAP_FAILED;
+    int kind = SR_MEM_SMALL;
+#ifdef _LINUX_
+    unsigned long mask;
+#endif /* _LINUX_ */
+
+#ifdef MAP_HUGETLB
+    if ( size >= SR_HUGE_MIN )
+    {
+        addr = mmap(0, (size + SR_HUGE_PAGE_SZ - 1) & ~(SR_HUGE_PAGE_SZ - 1),
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if ( addr != MAP_FAILED )
+        {
+            len = (size + SR_HUGE_PAGE_SZ - 1) & ~(SR_HUGE_PAGE_SZ - 1);
+            kind = SR_MEM_HUGE;
+        }
+    }
+#endif /* MAP_HUGETLB */
+
+    if ( addr == MAP_FAILED )
+    {
+        addr = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ( addr == MAP_FAILED )
+        {
+            /* -- e.g. out of map count; still usable, just not placed -- */
+            if ( (addr = calloc(1, size)) == 0 )
+            { return 0; }
+            len = size;
+            kind = SR_MEM_HEAP;
+            node = -1;
+        }
+#ifdef MADV_HUGEPAGE
+        else if ( size >= SR_HUGE_PAGE_SZ && madvise(addr, len, MADV_HUGEPAGE) == 0 )
+        { kind = SR_MEM_THP; }
+#endif /* MADV_HUGEPAGE */
+    }
+
+#ifdef _LINUX_
+    if ( node >= 0 && node < (int)(8 * sizeof(mask)) )
+    {
+        mask = 1UL << node;
+        if ( syscall(SYS_mbind, addr, len, SR_MPOL_PREFERRED, &mask,
+                     8 * sizeof(mask), 0) != 0 )
+        { node = -1; }
+    }
+#else
+    node = -1;
+#endif /* _LINUX_ */
+
+    pthread_mutex_lock(&sr_place_lock);
+    if ( sr_nregions < SR_REGIONS_MAX )
+    {
+        strncpy(sr_regions[sr_nregions].name, name, SR_PLACE_NAMELEN - 1);
+        sr_regions[sr_nregions].addr = addr;
+        sr_regions[sr_nregions].len = len;
+        sr_regions[sr_nregions].node = node;
+        sr_regions[sr_nregions].kind = kind;
+        sr_nregions++;
+    }
+    else if ( kind != SR_MEM_HEAP )
+    {
+        /* -- sr_mem_free could not find the length again -- */
+        munmap(addr, len);
+        addr = 0;
+    }
+    pthread_mutex_unlock(&sr_place_lock);
+
+    return addr;
+} /* -- sr_mem_alloc -- */
+
+void sr_mem_free(void* addr)
+{
+    int i;
+
+    if ( addr == 0 )
+    { return; }
+
+    pthread_mutex_lock(&sr_place_lock);
+    for ( i = 0; i < sr_nregions; i++ )
+    {
+        if ( sr_regions[i].addr == addr )
+        {
+            if ( sr_regions[i].kind == SR_MEM_HEAP )
+            { free(addr); }
+            else
+            { munmap(addr, sr_regions[i].len); }
+            sr_regions[i] = sr_regions[--sr_nregions];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sr_place_lock);
+} /* -- sr_mem_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_placement_report(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_placement_report(FILE* out)
+{
+    static const char* kinds[] = { "4k pages", "huge pages", "transparent huge pages",
+                                   "heap" };
+    int i;
+
+    pthread_mutex_lock(&sr_place_lock);
+    fprintf(out, "Placement\n");
+    fprintf(out, "---------------------------------------------\n");
+    for ( i = 0; i < sr_nplaced; i++ )
+    {
+        if ( sr_placed[i].cpu < 0 )
+        { fprintf(out, "thread %-16s unpinned\n", sr_placed[i].name); }
+        else
+        {
+            fprintf(out, "thread %-16s cpu %d node %d%s\n", sr_placed[i].name,
+                    sr_placed[i].cpu, sr_cpu_node(sr_placed[i].cpu),
+                    sr_placed[i].ok ? "" : " (pinning failed)");
+        }
+    }
+    for ( i = 0; i < sr_nregions; i++ )
+    {
+        fprintf(out, "memory %-16s %8lu KB ", sr_regions[i].name,
+                (unsigned long)(sr_regions[i].len / 1024));
+        if ( sr_regions[i].node >= 0 )
+        { fprintf(out, "node %d", sr_regions[i].node); }
+        else
+        { fprintf(out, "any node"); }
+        fprintf(out, ", %s\n", kinds[sr_regions[i].kind]);
+    }
+    fprintf(out, "---------------------------------------------\n");
+    pthread_mutex_unlock(&sr_place_lock);
+} /* -- sr_placement_report -- */
@@ -0,0 +1,70 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_numa.h
+ *
+ * Description:
+ *
+ * Thread and memory placement (-C cpulist).  The listed CPUs are handed
+ * out in order to the RX thread (the one polling the backend), the
+ * forwarding workers, the TX thread and the ARP thread, wrapping around
+ * if there are fewer CPUs than threads.  Threads are pinned through
+ * their creation attributes, so they never run anywhere else.
+ *
+ * Large buffers (frame pools, backend buffers, the routing table) come
+ * from sr_mem_alloc: anonymous mappings bound to the NUMA node of the
+ * CPU that uses them, backed by 2 MB huge pages when the system has some
+ * reserved, transparent huge pages otherwise.  Both the threads and the
+ * regions are recorded for the placement report printed at startup.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_NUMA_H
+#define SR_NUMA_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define SR_MAX_CPUS        256
+#define SR_HUGE_PAGE_SZ    (2UL * 1024 * 1024)
+#define SR_HUGE_MIN        (SR_HUGE_PAGE_SZ / 2)  /* smaller regions use small pages */
+
+/* Threads that get a CPU, in the order they take them from the list */
+#define SR_ROLE_RX      0
+#define SR_ROLE_WORKER  1
+#define SR_ROLE_TX      2
+#define SR_ROLE_ARP     3
+
+/* How a region is backed */
+#define SR_MEM_SMALL    0   /* base pages */
+#define SR_MEM_HUGE     1   /* reserved huge pages (MAP_HUGETLB) */
+#define SR_MEM_THP      2   /* transparent huge pages requested */
+#define SR_MEM_HEAP     3   /* malloc, mapping failed */
+
+struct sr_instance;
+
+/* Parse "0-3,6,8" into a new array. Returns the count, -1 on error. */
+int  sr_cpu_parse(const char* list, int** cpus);
+
+/* CPU for the 'index'th thread of 'role', -1 if nothing is pinned. */
+int  sr_cpu_for(struct sr_instance* sr, int role, int index);
+
+/* NUMA node of a CPU, -1 if unknown or 'cpu' is -1. */
+int  sr_cpu_node(int cpu);
+
+/* Node the 'index'th thread of 'role' runs on, -1 if unknown. */
+int  sr_node_for(struct sr_instance* sr, int role, int index);
+
+/* Set up 'attr' to pin a new thread to 'cpu' (none if -1), and record
+   it as 'name'. Returns 0 on success. */
+int  sr_thread_attr(pthread_attr_t* attr, const char* name, int cpu);
+
+/* Pin the calling thread. Returns 0 on success. */
+int  sr_pin_self(const char* name, int cpu);
+
+/* Zeroed region of 'size' bytes on 'node' (any if -1), 0 on failure. */
+void* sr_mem_alloc(const char* name, size_t size, int node);
+void  sr_mem_free(void* addr);
+
+void sr_placement_report(FILE* out);
+
+#endif /* -- SR_NUMA_H -- */
@@ -0,0 +1,395 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcapng.c
+ *
+ * Description:
+ *
+ * pcapng writer with rotation, see sr_pcapng.h.  Blocks are written in
+ * host byte order, which the section header's byte order magic records.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "sr_router.h"
+#include "sr_dumper.h"
+#include "sr_pcapng.h"
+
+#define SR_PCAPNG_SHB       0x0A0D0D0AU
+#define SR_PCAPNG_IDB       0x00000001U
+#define SR_PCAPNG_EPB       0x00000006U
+#define SR_PCAPNG_BOM       0x1A2B3C4DU
+
+/* Option codes */
+#define SR_OPT_END          0
+#define SR_OPT_SHB_USERAPPL 4
+#define SR_OPT_IF_NAME      2
+#define SR_OPT_IF_IPV4      4
+#define SR_OPT_IF_MAC       6
+#define SR_OPT_IF_TSRESOL   9
+#define SR_OPT_EPB_FLAGS    2
+
+#define SR_PCAPNG_BLOCK_MAX (64 + PACKET_DUMP_SIZE)
+#define SR_PAD4(n)          (((n) + 3) & ~3U)
+
+static unsigned int sr_put16(unsigned char* p, uint16_t v)
+{
+    memcpy(p, &v, 2);
+    return 2;
+} /* -- sr_put16 -- */
+
+static unsigned int sr_put32(unsigned char* p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+    return 4;
+} /* -- sr_put32 -- */
+
+/* One option: code, length, value padded to 32 bits. */
+static unsigned int sr_pcapng_opt(unsigned char* p, uint16_t code, const void* val,
+                                  uint16_t len)
+{
+    unsigned int n = 0;
+
+    n += sr_put16(p + n, code);
+    n += sr_put16(p + n, len);
+    memset(p + n, 0, SR_PAD4(len));
+    memcpy(p + n, val, len);
+    return n + SR_PAD4(len);
+} /* -- sr_pcapng_opt -- */
+
+/* Fill in both length fields of the block of 'len' bytes at 'b'. */
+static unsigned int sr_pcapng_seal(unsigned char* b, unsigned int len)
+{
+    len += 4;
+    sr_put32(b + 4, len);
+    sr_put32(b + len - 4, len);
+    return len;
+} /* -- sr_pcapng_seal -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcapng_map(..)
+ * Scope:  Local
+ *
+ * Reserve the disk space of the segment at 'off' before mapping it, so
+ * a full disk shows up here and not as a SIGBUS on a later copy.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pcapng_map(struct sr_pcapng* w, uint64_t off)
+{
+    int err;
+
+    /* -- the error comes back, errno is left alone -- */
+    if ( (err = posix_fallocate(w->fd, (off_t)off, SR_PCAPNG_SEG)) != 0 )
+    {
+        errno = err;
+        perror("posix_fallocate(..):sr_pcapng.c::sr_pcapng_map");
+        return -1;
+    }
+    w->seg = (unsigned char*)mmap(0, SR_PCAPNG_SEG, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                  w->fd, (off_t)off);
+    if ( w->seg == MAP_FAILED )
+    {
+        perror("mmap(..):sr_pcapng.c::sr_pcapng_map");
+        w->seg = 0;
+        return -1;
+    }
+    w->seg_off = off;
+    return 0;
+} /* -- sr_pcapng_map -- */
+
+/* Append 'n' bytes, moving on to the next segment as they fill. */
+static int sr_pcapng_put(struct sr_pcapng* w, const unsigned char* p, unsigned int n)
+{
+    unsigned int room, c;
+
+    if ( w->seg == 0 )
+    { return -1; }
+
+    while ( n > 0 )
+    {
+        room = (unsigned int)(w->seg_off + SR_PCAPNG_SEG - w->off);
+        if ( room == 0 )
+        {
+            munmap(w->seg, SR_PCAPNG_SEG);
+            w->seg = 0;
+            if ( sr_pcapng_map(w, w->seg_off + SR_PCAPNG_SEG) != 0 )
+            { return -1; }
+            continue;
+        }
+        c = n < room ? n : room;
+        memcpy(w->seg + (w->off - w->seg_off), p, c);
+        w->off += c;
+        p += c;
+        n -= c;
+    }
+    w->blocks++;
+    return 0;
+} /* -- sr_pcapng_put -- */
+
+static void sr_pcapng_write_shb(struct sr_pcapng* w)
+{
+    static const char appl[] = "Simple Router";
+    unsigned char b[64];
+    unsigned int n = 0;
+    int64_t unknown = -1;
+
+    n += sr_put32(b + n, SR_PCAPNG_SHB);
+    n += 4;
+    n += sr_put32(b + n, SR_PCAPNG_BOM);
+    n += sr_put16(b + n, 1);
+    n += sr_put16(b + n, 0);
+    memcpy(b + n, &unknown, 8);
+    n += 8;
+    n += sr_pcapng_opt(b + n, SR_OPT_SHB_USERAPPL, appl, sizeof(appl) - 1);
+    n += sr_pcapng_opt(b + n, SR_OPT_END, 0, 0);
+
+    sr_pcapng_put(w, b, sr_pcapng_seal(b, n));
+} /* -- sr_pcapng_write_shb -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcapng_iface(..)
+ * Scope:  Local
+ *
+ * Interface id of 'name' in the current file, describing it first if
+ * this is its first frame there. Returns -1 if the file has no ids left.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pcapng_iface(struct sr_pcapng* w, const char* name)
+{
+    struct sr_if* ifc;
+    unsigned char b[128];
+    unsigned char addr[8];
+    unsigned int n = 0;
+    uint8_t tsresol = 9;
+    int i;
+
+    for ( i = 0; i < w->nifaces; i++ )
+    {
+        if ( strncmp(w->ifaces[i], name, sr_IFACE_NAMELEN) == 0 )
+        { return i; }
+    }
+    if ( w->nifaces == SR_PCAPNG_IFACES )
+    { return -1; }
+
+    n += sr_put32(b + n, SR_PCAPNG_IDB);
+    n += 4;
+    n += sr_put16(b + n, LINKTYPE_ETHERNET);
+    n += sr_put16(b + n, 0);
+    n += sr_put32(b + n, PACKET_DUMP_SIZE);
+    n += sr_pcapng_opt(b + n, SR_OPT_IF_NAME, name, strnlen(name, sr_IFACE_NAMELEN));
+    if ( (ifc = sr_get_interface(w->sr, name)) != 0 )
+    {
+        n += sr_pcapng_opt(b + n, SR_OPT_IF_MAC, ifc->addr, ETHER_ADDR_LEN);
+        if ( ifc->ip )
+        {
+            /* -- the interface list has no netmask, describe the host -- */
+            memcpy(addr, &ifc->ip, 4);
+            memset(addr + 4, 0xff, 4);
+            n += sr_pcapng_opt(b + n, SR_OPT_IF_IPV4, addr, 8);
+        }
+    }
+    n += sr_pcapng_opt(b + n, SR_OPT_IF_TSRESOL, &tsresol, 1);
+    n += sr_pcapng_opt(b + n, SR_OPT_END, 0, 0);
+
+    if ( sr_pcapng_put(w, b, sr_pcapng_seal(b, n)) != 0 )
+    { return -1; }
+
+    strncpy(w->ifaces[w->nifaces], name, sr_IFACE_NAMELEN);
+    return w->nifaces++;
+} /* -- sr_pcapng_iface -- */
+
+/* Open file number w->index and start its section. */
+static int sr_pcapng_start(struct sr_pcapng* w)
+{
+    char path[SR_PCAPNG_PATHLEN + 32];
+
+    if ( w->rotate )
+    { snprintf(path, sizeof(path), "%s.%04u%s", w->stem, w->index, w->suffix); }
+    else
+    { snprintf(path, sizeof(path), "%s%s", w->stem, w->suffix); }
+
+    if ( (w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 )
+    {
+        fprintf(stderr, "sr_pcapng: can't open %s\n", path);
+        return -1;
+    }
+    w->off = 0;
+    w->opened_ns = 0;
+    w->nifaces = 0;
+    if ( sr_pcapng_map(w, 0) != 0 )
+    {
+        close(w->fd);
+        w->fd = -1;
+        return -1;
+    }
+    w->files++;
+
+    sr_pcapng_write_shb(w);
+    return 0;
+} /* -- sr_pcapng_start -- */
+
+/* Unmap the file and cut off the unused part of its last segment. */
+static void sr_pcapng_finish(struct sr_pcapng* w)
+{
+    if ( w->fd < 0 )
+    { return; }
+    if ( w->seg )
+    {
+        munmap(w->seg, SR_PCAPNG_SEG);
+        w->seg = 0;
+    }
+    if ( ftruncate(w->fd, (off_t)w->off) != 0 )
+    { perror("ftruncate(..):sr_pcapng.c::sr_pcapng_finish"); }
+    close(w->fd);
+    w->fd = -1;
+} /* -- sr_pcapng_finish -- */
+
+int sr_pcapng_wanted(const char* spec)
+{
+    const char* colon = strrchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+    if ( colon && (strncmp(colon + 1, "size=", 5) == 0 ||
+                   strncmp(colon + 1, "secs=", 5) == 0) )
+    { return 1; }
+    return len >= 7 && strncmp(spec + len - 7, ".pcapng", 7) == 0;
+} /* -- sr_pcapng_wanted -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcapng_open(..)
+ * Scope:  Global
+ *
+ * 'spec' is path[:size=MB,secs=N].
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pcapng_open(struct sr_pcapng* w, struct sr_instance* sr, const char* spec)
+{
+    char buf[SR_PCAPNG_PATHLEN];
+    char* opts;
+    char* opt;
+    size_t len;
+    long v;
+
+    /* -- REQUIRES -- */
+    assert(w);
+    assert(spec);
+
+    memset(w, 0, sizeof(struct sr_pcapng));
+    w->sr = sr;
+    w->fd = -1;
+
+    if ( strlen(spec) >= sizeof(buf) )
+    { return -1; }
+    strcpy(buf, spec);
+
+    if ( (opts = strrchr(buf, ':')) != 0 &&
+         (strncmp(opts + 1, "size=", 5) == 0 || strncmp(opts + 1, "secs=", 5) == 0) )
+    {
+        *opts++ = 0;
+        for ( opt = strtok(opts, ","); opt; opt = strtok(0, ",") )
+        {
+            v = atol(opt + 5);
+            if ( strncmp(opt, "size=", 5) == 0 && v > 0 )
+            { w->max_bytes = (uint64_t)v * 1024 * 1024; }
+            else if ( strncmp(opt, "secs=", 5) == 0 && v > 0 )
+            { w->max_ns = (uint64_t)v * 1000000000ULL; }
+            else
+            {
+                fprintf(stderr, "sr_pcapng: bad option %s\n", opt);
+                return -1;
+            }
+        }
+        w->rotate = 1;
+    }
+
+    len = strlen(buf);
+    if ( len >= 7 && strcmp(buf + len - 7, ".pcapng") == 0 )
+    {
+        strcpy(w->suffix, ".pcapng");
+        buf[len - 7] = 0;
+    }
+    strcpy(w->stem, buf);
+
+    return sr_pcapng_start(w);
+} /* -- sr_pcapng_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcapng_packet(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pcapng_packet(struct sr_pcapng* w, const char* iface, int dir, uint64_t ts_ns,
+                      const uint8_t* data, unsigned int caplen, unsigned int len)
+{
+    unsigned char b[SR_PCAPNG_BLOCK_MAX];
+    uint32_t flags = (uint32_t)dir;
+    unsigned int n = 0;
+    int id;
+
+    if ( w->stopped )
+    {
+        w->lost++;
+        return;
+    }
+    if ( caplen > PACKET_DUMP_SIZE )
+    { caplen = PACKET_DUMP_SIZE; }
+
+    /* -- a file that has frames is rotated when it is full or old -- */
+    if ( w->rotate && w->nifaces > 0 &&
+         ((w->max_ns && ts_ns - w->opened_ns >= w->max_ns) ||
+          (w->max_bytes && w->off + SR_PCAPNG_BLOCK_MAX > w->max_bytes)) )
+    {
+        sr_pcapng_finish(w);
+        w->index++;
+        if ( sr_pcapng_start(w) != 0 )
+        {
+            fprintf(stderr, "sr_pcapng: capture stopped at file %u\n", w->index);
+            w->stopped = 1;
+            w->lost++;
+            return;
+        }
+    }
+    if ( w->opened_ns == 0 )
+    { w->opened_ns = ts_ns; }
+
+    if ( (id = sr_pcapng_iface(w, iface)) < 0 )
+    {
+        w->unnamed++;
+        return;
+    }
+
+    n += sr_put32(b + n, SR_PCAPNG_EPB);
+    n += 4;
+    n += sr_put32(b + n, (uint32_t)id);
+    n += sr_put32(b + n, (uint32_t)(ts_ns >> 32));
+    n += sr_put32(b + n, (uint32_t)ts_ns);
+    n += sr_put32(b + n, caplen);
+    n += sr_put32(b + n, len);
+    memset(b + n, 0, SR_PAD4(caplen));
+    memcpy(b + n, data, caplen);
+    n += SR_PAD4(caplen);
+    n += sr_pcapng_opt(b + n, SR_OPT_EPB_FLAGS, &flags, 4);
+    n += sr_pcapng_opt(b + n, SR_OPT_END, 0, 0);
+
+    if ( sr_pcapng_put(w, b, sr_pcapng_seal(b, n)) != 0 )
+    {
+        fprintf(stderr, "sr_pcapng: capture stopped in file %u\n", w->index);
+        w->stopped = 1;
+        w->lost++;
+    }
+} /* -- sr_pcapng_packet -- */
+
+void sr_pcapng_close(struct sr_pcapng* w)
+{
+    sr_pcapng_finish(w);
+} /* -- sr_pcapng_close -- */
@@ -0,0 +1,98 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcapng.h
+ *
+ * Description:
+ *
+ * pcapng writer for the capture thread (-l file.pcapng[:size=MB,secs=N]).
+ * Every router interface a frame crosses gets an Interface Description
+ * Block (name, MAC and IPv4 address, nanosecond resolution) the first
+ * time it shows up in a file, and every frame an Enhanced Packet Block
+ * naming that interface, with a nanosecond timestamp and the direction
+ * in its flags, so a capture can be split per interface and per
+ * direction for latency analysis.
+ *
+ * Files are written through shared mappings of SR_PCAPNG_SEG bytes that
+ * are allocated on disk before they are mapped, so writing a block is a
+ * copy and the file system is only asked for space once per segment.
+ * Closing a file cuts it back to what was written; until then its
+ * preallocated tail reads as zeros.  A file that cannot be opened or
+ * grown (a full disk) stops the capture for good: that is logged once,
+ * and the frames after it are only counted.
+ *
+ * With size= (megabytes) or secs= the capture rotates to a new file when
+ * the current one would grow past the size or has been open that long.
+ * Rotated files are numbered: cap.pcapng becomes cap.0000.pcapng,
+ * cap.0001.pcapng and so on, each a complete section of its own.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PCAPNG_H
+#define SR_PCAPNG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#include "sr_if.h"
+
+#define SR_PCAPNG_SEG       (4 * 1024 * 1024)   /* mapping and preallocation unit */
+#define SR_PCAPNG_IFACES    32                  /* interfaces per file */
+#define SR_PCAPNG_PATHLEN   256
+
+/* Direction, as encoded in the EPB flags */
+#define SR_PCAPNG_IN        1
+#define SR_PCAPNG_OUT       2
+
+struct sr_instance;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pcapng
+ *
+ * Used by the capture thread only. 'ifaces' maps the interface ids of
+ * the current file to names.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pcapng
+{
+    struct sr_instance* sr;
+    char stem[SR_PCAPNG_PATHLEN];   /* path up to the suffix */
+    char suffix[16];
+    int rotate;                     /* number the files */
+    unsigned int index;             /* number of the current file */
+    uint64_t max_bytes;             /* 0 = no size limit */
+    uint64_t max_ns;                /* 0 = no time limit */
+    int fd;
+    uint64_t opened_ns;             /* timestamp of the file's first frame */
+    uint64_t off;                   /* bytes written to the file */
+    uint64_t seg_off;               /* file offset of the mapped segment */
+    unsigned char* seg;
+    char ifaces[SR_PCAPNG_IFACES][sr_IFACE_NAMELEN];
+    int nifaces;
+    unsigned long files;
+    unsigned long blocks;
+    unsigned long unnamed;          /* frames with no interface id left */
+    int stopped;                    /* a file failed, nothing more is written */
+    unsigned long lost;             /* frames seen after that */
+};
+
+/* Non-zero if the -l argument asks for pcapng. */
+int  sr_pcapng_wanted(const char* spec);
+
+/* Parse 'spec' and open the first file. Returns 0 on success. */
+int  sr_pcapng_open(struct sr_pcapng* w, struct sr_instance* sr, const char* spec);
+
+/* Append a frame that crossed 'iface' in direction 'dir' at 'ts_ns'
+   (ns since the epoch). */
+void sr_pcapng_packet(struct sr_pcapng* w, const char* iface, int dir, uint64_t ts_ns,
+                      const uint8_t* data, unsigned int caplen, unsigned int len);
+
+void sr_pcapng_close(struct sr_pcapng* w);
+
+#endif /* -- SR_PCAPNG_H -- */
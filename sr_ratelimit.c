@@ -0,0 +1,129 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ratelimit.c
+ *
+ * Description:
+ *
+ * ICMP rate limiter, see sr_ratelimit.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_ratelimit.h"
+
+static uint64_t sr_rl_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- sr_rl_now -- */
+
+int sr_ratelimit_init(struct sr_ratelimit* rl, unsigned int pps, unsigned int src_pps)
+{
+    /* REQUIRES */
+    assert(rl);
+
+    memset(rl, 0, sizeof(*rl));
+    if ( pps )
+    {
+        rl->interval  = 1000000000ULL / pps;
+        rl->tolerance = (SR_RL_BURST - 1) * rl->interval;
+    }
+    if ( src_pps )
+    {
+        rl->src_interval  = 1000000000ULL / src_pps;
+        rl->src_tolerance = (SR_RL_SRC_BURST - 1) * rl->src_interval;
+    }
+    return pthread_mutex_init(&rl->lock, NULL);
+} /* -- sr_ratelimit_init -- */
+
+void sr_ratelimit_destroy(struct sr_ratelimit* rl)
+{
+    pthread_mutex_destroy(&rl->lock);
+} /* -- sr_ratelimit_destroy -- */
+
+/* The entry of 'ip', moved to the front of its set; a new one, with a
+   full bucket, in place of the least recently used if there is none */
+static struct sr_rl_src* sr_rl_src_get(struct sr_ratelimit* rl, uint32_t ip)
+{
+    struct sr_rl_src* set = rl->src[(ip * 2654435761U) >> 24 & (SR_RL_SETS - 1)];
+    struct sr_rl_src e;
+    int i;
+
+    for ( i = 0; i < SR_RL_WAYS - 1 && set[i].ip != ip; i++ )
+        ;
+    if ( set[i].ip == ip )
+    { e = set[i]; }
+    else
+    {
+        e.ip = ip;
+        e.due = 0;
+    }
+    memmove(set + 1, set, i * sizeof(*set));
+    set[0] = e;
+    return set;
+} /* -- sr_rl_src_get -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ratelimit_allow(..)
+ * Scope:  Global
+ *
+ * A bucket with a token has 'due' no further than its tolerance ahead of
+ * now; taking the token moves 'due' one interval on from the later of
+ * the two.  The address's bucket is looked at first and neither gives up
+ * a token unless both have one, so a message refused by the global limit
+ * does not count against its address.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ratelimit_allow(struct sr_ratelimit* rl, uint32_t ip)
+{
+    struct sr_rl_src* s = 0;
+    uint64_t now;
+    int ok = 1;
+
+    if ( rl->interval == 0 && rl->src_interval == 0 )
+    { return 1; }
+
+    now = sr_rl_now();
+    if ( !rl->lockless )
+    { pthread_mutex_lock(&rl->lock); }
+
+    if ( rl->src_interval )
+    {
+        s = sr_rl_src_get(rl, ip);
+        if ( s->due > now + rl->src_tolerance )
+        {
+            rl->src_limited++;
+            ok = 0;
+        }
+    }
+    if ( ok && rl->interval && rl->due > now + rl->tolerance )
+    {
+        rl->limited++;
+        ok = 0;
+    }
+    if ( ok )
+    {
+        if ( s )
+        { s->due = (s->due > now ? s->due : now) + rl->src_interval; }
+        if ( rl->interval )
+        { rl->due = (rl->due > now ? rl->due : now) + rl->interval; }
+        rl->sent++;
+    }
+
+    if ( !rl->lockless )
+    { pthread_mutex_unlock(&rl->lock); }
+    return ok;
+} /* -- sr_ratelimit_allow -- */
+
+void sr_ratelimit_stats(struct sr_ratelimit* rl, FILE* out)
+{
+    if ( rl->interval == 0 && rl->src_interval == 0 )
+    { return; }
+    fprintf(out, "icmp limit: %lu sent, %lu dropped by the global limit, "
+            "%lu by the per-source limit\n", rl->sent, rl->limited, rl->src_limited);
+} /* -- sr_ratelimit_stats -- */
@@ -0,0 +1,83 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ratelimit.h
+ *
+ * Description:
+ *
+ * Rate limiter for the ICMP messages the router generates (time exceeded,
+ * unreachables, echo replies).  Without it a traceroute storm or a flood
+ * from spoofed sources makes the router an amplifier and leaves it no time
+ * to forward.
+ *
+ * Two token buckets must both have a token for a message to go out: one
+ * for the router as a whole and one for the address the message is sent
+ * to.  The per-address buckets live in a small set-associative table that
+ * evicts the least recently used address of a set, so a flood from many
+ * sources costs a fixed amount of memory; an evicted address comes back
+ * with a full bucket, which the global bucket still bounds.  Messages
+ * refused are counted, by the bucket that refused them.
+ *
+ * A bucket is kept as the time its next token is due (GCRA): it has a
+ * token as long as that time is no further ahead than its burst allows.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RATELIMIT_H
+#define SR_RATELIMIT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define SR_RL_PPS         1000  /* default messages/s for the router */
+#define SR_RL_BURST       50
+#define SR_RL_SRC_PPS     20    /* default messages/s to one address */
+#define SR_RL_SRC_BURST   10
+#define SR_RL_SETS        256   /* per-address table, a power of two */
+#define SR_RL_WAYS        4     /* addresses per set, most recent first */
+
+struct sr_rl_src
+{
+    uint32_t ip;                /* network order */
+    uint64_t due;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ratelimit
+ *
+ * A rate of 0 leaves that bucket out; with both 0 (as a zeroed struct has
+ * them) every message is let through without taking the lock.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ratelimit
+{
+    pthread_mutex_t lock;
+    int lockless;               /* single-threaded, skip the lock */
+    uint64_t interval;          /* ns per token, 0 = no global limit */
+    uint64_t tolerance;         /* how far ahead 'due' may be, (burst - 1) tokens */
+    uint64_t due;
+    uint64_t src_interval;      /* the same per address */
+    uint64_t src_tolerance;
+    struct sr_rl_src src[SR_RL_SETS][SR_RL_WAYS];
+    unsigned long sent;         /* let through while limiting */
+    unsigned long limited;      /* refused by the global bucket */
+    unsigned long src_limited;  /* refused by the address's bucket */
+};
+
+int  sr_ratelimit_init(struct sr_ratelimit* rl, unsigned int pps, unsigned int src_pps);
+void sr_ratelimit_destroy(struct sr_ratelimit* rl);
+
+/* Take a token for one message to 'ip' (network order). Returns 1 if it
+   may be sent, 0 if it is to be dropped. */
+int  sr_ratelimit_allow(struct sr_ratelimit* rl, uint32_t ip);
+
+void sr_ratelimit_stats(struct sr_ratelimit* rl, FILE* out);
+
+#endif /* -- SR_RATELIMIT_H -- */
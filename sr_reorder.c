@@ -0,0 +1,206 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_reorder.c
+ *
+ * Description:
+ *
+ * Per-flow reorder buffer of the TX stage, see sr_reorder.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_worker.h"
+#include "sr_reorder.h"
+
+/* Sequence numbers wrap, compare them by distance */
+#define SR_SEQ_DIFF(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)))
+
+/*---------------------------------------------------------------------
+ * Method: sr_reorder_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_reorder_init(struct sr_reorder* r, unsigned int nitems, unsigned long wait_us)
+{
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(r);
+    assert(nitems > 0);
+
+    memset(r, 0, sizeof(struct sr_reorder));
+    if ( (r->ingress = (uint32_t*)calloc(SR_REORDER_FLOWS, sizeof(uint32_t))) == 0 ||
+         (r->items = (struct sr_rob_item*)calloc(nitems,
+                                                 sizeof(struct sr_rob_item))) == 0 )
+    {
+        free(r->ingress);
+        return -1;
+    }
+
+    for ( i = 0; i < nitems; i++ )
+    {
+        r->items[i].next = r->free_items;
+        r->free_items = &r->items[i];
+    }
+    for ( i = 0; i < SR_REORDER_FLOWS; i++ )
+    { r->wpos[i] = -1; }
+    r->wait_us = wait_us;
+
+    return 0;
+} /* -- sr_reorder_init -- */
+
+void sr_reorder_destroy(struct sr_reorder* r)
+{
+    free(r->ingress);
+    free(r->items);
+    r->ingress = 0;
+    r->items = 0;
+} /* -- sr_reorder_destroy -- */
+
+uint32_t sr_reorder_stamp(struct sr_reorder* r, uint32_t hash)
+{
+    return r->ingress[hash & (SR_REORDER_FLOWS - 1)]++;
+} /* -- sr_reorder_stamp -- */
+
+unsigned long sr_reorder_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+} /* -- sr_reorder_now -- */
+
+static void sr_reorder_unwait(struct sr_reorder* r, int b)
+{
+    int last = r->waiting[--r->nwaiting];
+
+    r->waiting[r->wpos[b]] = last;
+    r->wpos[last] = r->wpos[b];
+    r->wpos[b] = -1;
+} /* -- sr_reorder_unwait -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_reorder_drain(..)
+ * Scope:  Local
+ *
+ * Send the held frames of flow 'b' that are now due, in order.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_reorder_drain(struct sr_reorder* r, int b, unsigned long now)
+{
+    struct sr_rob_item* it;
+    int d;
+
+    while ( (it = r->pending[b]) != 0 &&
+            (d = SR_SEQ_DIFF(it->f->seq, r->next[b])) <= 0 )
+    {
+        r->pending[b] = it->next;
+        if ( d == 0 && it->f->last )
+        { r->next[b]++; }
+        r->emit(r->arg, it->f, it->owner);
+        it->next = r->free_items;
+        r->free_items = it;
+    }
+
+    if ( r->pending[b] == 0 )
+    { sr_reorder_unwait(r, b); }
+    else
+    { r->since[b] = now; }
+} /* -- sr_reorder_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_reorder_input(..)
+ * Scope:  Global
+ *
+ * Frames of one input come from one worker in order, so a frame with
+ * the expected number can go out at once; only the last one of its
+ * input releases what is held behind it.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_reorder_input(struct sr_reorder* r, struct sr_wframe* f, void* owner,
+                      unsigned long now)
+{
+    struct sr_rob_item* it;
+    struct sr_rob_item** pp;
+    int b = f->hash & (SR_REORDER_FLOWS - 1);
+    int d = SR_SEQ_DIFF(f->seq, r->next[b]);
+
+    if ( d < 0 )
+    {
+        r->late++;
+        r->emit(r->arg, f, owner);
+        return;
+    }
+
+    if ( d == 0 )
+    {
+        r->in_order++;
+        if ( f->last )
+        { r->next[b]++; }
+        r->emit(r->arg, f, owner);
+        if ( f->last && r->pending[b] )
+        { sr_reorder_drain(r, b, now); }
+        return;
+    }
+
+    /* -- cannot run out, there is an item for every TX pool frame -- */
+    it = r->free_items;
+    r->free_items = it->next;
+    it->f = f;
+    it->owner = owner;
+    r->held++;
+
+    /* -- after anything with the same number, to keep their order -- */
+    for ( pp = &r->pending[b]; *pp && SR_SEQ_DIFF((*pp)->f->seq, f->seq) <= 0;
+          pp = &(*pp)->next );
+    it->next = *pp;
+    *pp = it;
+
+    if ( r->wpos[b] < 0 )
+    {
+        r->wpos[b] = r->nwaiting;
+        r->waiting[r->nwaiting++] = b;
+        r->since[b] = now;
+    }
+} /* -- sr_reorder_input -- */
+
+void sr_reorder_expire(struct sr_reorder* r, unsigned long now)
+{
+    int i, b;
+
+    for ( i = r->nwaiting - 1; i >= 0; i-- )
+    {
+        b = r->waiting[i];
+        if ( now - r->since[b] >= r->wait_us )
+        {
+            r->timeouts++;
+            r->next[b] = r->pending[b]->f->seq;
+            sr_reorder_drain(r, b, now);
+        }
+    }
+} /* -- sr_reorder_expire -- */
+
+/* Send everything held, gaps or not, e.g. once the workers stopped. */
+void sr_reorder_flush(struct sr_reorder* r)
+{
+    int b;
+
+    while ( r->nwaiting > 0 )
+    {
+        b = r->waiting[0];
+        r->next[b] = r->pending[b]->f->seq;
+        sr_reorder_drain(r, b, 0);
+    }
+} /* -- sr_reorder_flush -- */
+
+void sr_reorder_stats(struct sr_reorder* r, FILE* out)
+{
+    fprintf(out, "reorder: %lu in order %lu held %lu late %lu timeouts\n",
+            r->in_order, r->held, r->late, r->timeouts);
+} /* -- sr_reorder_stats -- */
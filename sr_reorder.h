@@ -0,0 +1,100 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_reorder.h
+ *
+ * Description:
+ *
+ * Per-flow reorder buffer for the TX stage (-R).  When frames of one flow
+ * can be forwarded by several workers at once (-D steal, -D spray) their
+ * output may reach the TX thread out of order.  The dispatcher therefore
+ * numbers received frames per flow bucket, workers tag everything they
+ * send with the number of the frame being forwarded, and mark the last
+ * output for each input (an empty frame if there was none).  The buffer
+ * sends a frame once all earlier numbers of its flow are complete, so
+ * endpoints see frames in arrival order.
+ *
+ * Waiting is bounded: when a flow has been stalled for longer than the
+ * configured time (an input dropped by a worker that ran out of buffers,
+ * say) the buffer skips ahead to the oldest number it holds.  Output for
+ * a skipped number that shows up later is sent at once.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_REORDER_H
+#define SR_REORDER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_REORDER_FLOWS    4096    /* flow buckets, a power of two */
+#define SR_REORDER_WAIT_US  200     /* default bound on a stall */
+
+struct sr_wframe;
+
+/* A frame held back, with the worker it has to go back to */
+struct sr_rob_item
+{
+    struct sr_wframe* f;
+    void* owner;
+    struct sr_rob_item* next;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_reorder
+ *
+ * Owned by the TX thread, except 'ingress' which only the dispatcher
+ * writes. 'emit' sends a frame (len 0 marks an input without output) and
+ * gives it back to 'owner'.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_reorder
+{
+    uint32_t* ingress;                  /* next number per flow, dispatcher side */
+    uint32_t next[SR_REORDER_FLOWS];    /* next number to complete per flow */
+    struct sr_rob_item* pending[SR_REORDER_FLOWS];  /* held frames, by number */
+    unsigned long since[SR_REORDER_FLOWS];  /* when the flow stalled, usec */
+    int wpos[SR_REORDER_FLOWS];         /* index in 'waiting', -1 if none */
+    int waiting[SR_REORDER_FLOWS];      /* flows holding frames */
+    int nwaiting;
+    struct sr_rob_item* items;
+    struct sr_rob_item* free_items;
+    unsigned long wait_us;
+    void (*emit)(void* arg, struct sr_wframe* f, void* owner);
+    void* arg;
+    unsigned long in_order;             /* frames sent on arrival */
+    unsigned long held;                 /* frames that had to wait */
+    unsigned long late;                 /* frames of numbers already skipped */
+    unsigned long timeouts;             /* stalls given up on */
+};
+
+/* Room for 'nitems' held frames. Returns 0 on success. */
+int  sr_reorder_init(struct sr_reorder* r, unsigned int nitems, unsigned long wait_us);
+void sr_reorder_destroy(struct sr_reorder* r);
+
+/* Dispatcher: number of the next received frame of the flow with 'hash'. */
+uint32_t sr_reorder_stamp(struct sr_reorder* r, uint32_t hash);
+
+/* TX thread: a frame from a worker. 'last' is set on the final frame for
+   its input. */
+void sr_reorder_input(struct sr_reorder* r, struct sr_wframe* f, void* owner,
+                      unsigned long now);
+
+/* TX thread: give up on stalls older than the bound. */
+void sr_reorder_expire(struct sr_reorder* r, unsigned long now);
+
+/* TX thread: send everything held, gaps or not. */
+void sr_reorder_flush(struct sr_reorder* r);
+
+/* Current time in usec, from the monotonic clock. */
+unsigned long sr_reorder_now(void);
+
+void sr_reorder_stats(struct sr_reorder* r, FILE* out);
+
+#endif /* -- SR_REORDER_H -- */
@@ -0,0 +1,592 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.c
+ *
+ * Description:
+ *
+ * Offline replay harness (make sr_replay).  Builds the forwarding core
+ * without a server connection: the interfaces come from a file, the
+ * routing table from another, and a capture loaded into memory is fed
+ * through sr_handlepacket in a tight loop.  Transmitted frames go to an
+ * in-memory sink backend instead of a wire.
+ *
+ *   sr_replay -I ifaces -r rtable [-n loops] [-i iface] [-o out.pcap] capture
+ *
+ * The interfaces file has one "name ip mac" line per interface.  The
+ * capture may be legacy pcap or pcapng (as written by sr -l); frames
+ * longer than RP_FRAME_MAX are skipped.  Frames it shows the router
+ * sending, by the pcapng direction flag or, in a pcap, by a source MAC
+ * that is one of the interfaces, are the reference output; all others
+ * are input.  An input frame arrives on the interface
+ * its pcapng block names, otherwise on the one whose MAC it is addressed
+ * to, or for a broadcast ARP request the one whose IP it asks for, or
+ * else the -i interface.
+ *
+ * The first pass over the capture is a warm-up: its output is recorded,
+ * compared frame by frame with the reference and written to -o.  Then
+ * the capture is replayed -n times against the clock.  The ARP cache is
+ * emptied before every pass and there is no sweeper thread, so every
+ * pass does the same work and produces the same frames.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_io.h"
+#include "sr_worker.h"
+#include "sr_capture.h"
+#include "sr_dumper.h"
+
+#define RP_FRAME_MAX        65536
+#define RP_PCAP_MAGIC       0xa1b2c3d4
+#define RP_PCAP_MAGIC_NS    0xa1b23c4d
+#define RP_PCAPNG_SHB       0x0a0d0d0a
+#define RP_PCAPNG_IDB       0x00000001
+#define RP_PCAPNG_EPB       0x00000006
+#define RP_PCAPNG_BOM       0x1a2b3c4d
+#define RP_PCAPNG_IFACES    64
+
+struct rp_frame
+{
+    uint8_t* data;
+    unsigned int len;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+struct rp_trace
+{
+    struct rp_frame* f;
+    unsigned int n;
+    unsigned int cap;
+};
+
+/* The sink: what the router sent during the current pass */
+static struct rp_trace rp_out;
+static int rp_recording = 0;
+static unsigned long rp_sent = 0;
+
+static void rp_add(struct rp_trace* t, const uint8_t* data, unsigned int len,
+                   const char* iface)
+{
+    struct rp_frame* f;
+
+    if ( t->n == t->cap )
+    {
+        t->cap = t->cap ? t->cap * 2 : 256;
+        if ( (t->f = (struct rp_frame*)realloc(t->f, t->cap * sizeof(struct rp_frame))) == 0 )
+        {
+            perror("realloc(..):sr_replay.c::rp_add");
+            exit(1);
+        }
+    }
+    f = &t->f[t->n++];
+    if ( (f->data = (uint8_t*)malloc(len)) == 0 )
+    {
+        perror("malloc(..):sr_replay.c::rp_add");
+        exit(1);
+    }
+    memcpy(f->data, data, len);
+    f->len = len;
+    strncpy(f->iface, iface ? iface : "", sr_IFACE_NAMELEN - 1);
+    f->iface[sr_IFACE_NAMELEN - 1] = 0;
+} /* -- rp_add -- */
+
+static int rp_sink_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                        const char* iface)
+{
+    rp_sent++;
+    if ( rp_recording )
+    { rp_add(&rp_out, buf, len, iface); }
+    return 0;
+} /* -- rp_sink_send -- */
+
+static int rp_sink_flush(struct sr_instance* sr)
+{ return 0; }
+
+static struct sr_io_ops sr_io_sink =
+{
+    "sink",
+    0,                  /* open: the interfaces come from a file */
+    0,                  /* poll: the harness delivers */
+    0,
+    rp_sink_send,
+    rp_sink_flush,
+    0
+};
+
+/*---------------------------------------------------------------------
+ * Method: rp_load_ifaces(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int rp_load_ifaces(struct sr_instance* sr, const char* path)
+{
+    FILE* fp;
+    char line[256], name[sr_IFACE_NAMELEN + 1], ip[64], mac[64];
+    unsigned int m[ETHER_ADDR_LEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    struct in_addr a;
+    int i, lineno = 0;
+
+    if ( (fp = fopen(path, "r")) == 0 )
+    {
+        perror(path);
+        return -1;
+    }
+    while ( fgets(line, sizeof(line), fp) )
+    {
+        lineno++;
+        if ( line[0] == '#' || sscanf(line, "%16s %63s %63s", name, ip, mac) < 1 )
+        { continue; }
+        if ( strlen(name) >= sr_IFACE_NAMELEN || inet_aton(ip, &a) == 0 ||
+             sscanf(mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6 )
+        {
+            fprintf(stderr, "%s:%d: expected \"name ip mac\"\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+        for ( i = 0; i < ETHER_ADDR_LEN; i++ )
+        { addr[i] = (unsigned char)m[i]; }
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, addr);
+        sr_set_ether_ip(sr, a.s_addr);
+    }
+    fclose(fp);
+    return sr->if_list ? 0 : -1;
+} /* -- rp_load_ifaces -- */
+
+/* The interface with this MAC, or 0 */
+static struct sr_if* rp_iface_by_mac(struct sr_instance* sr, const uint8_t* mac)
+{
+    struct sr_if* i;
+
+    for ( i = sr->if_list; i; i = i->next )
+    {
+        if ( memcmp(i->addr, mac, ETHER_ADDR_LEN) == 0 )
+        { return i; }
+    }
+    return 0;
+} /* -- rp_iface_by_mac -- */
+
+/* The interface an input frame of a legacy pcap arrived on, or 0 */
+static const char* rp_guess_iface(struct sr_instance* sr, const uint8_t* p,
+                                  unsigned int len, const char* fallback)
+{
+    struct sr_ethernet_hdr* e = (struct sr_ethernet_hdr*)p;
+    struct sr_arp_hdr* a = (struct sr_arp_hdr*)(p + sizeof(struct sr_ethernet_hdr));
+    struct sr_if* i;
+
+    if ( (i = rp_iface_by_mac(sr, e->ether_dhost)) != 0 )
+    { return i->name; }
+    if ( ntohs(e->ether_type) == ethertype_arp &&
+         len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    {
+        for ( i = sr->if_list; i; i = i->next )
+        {
+            if ( i->ip == a->ar_tip )
+            { return i->name; }
+        }
+    }
+    return fallback;
+} /* -- rp_guess_iface -- */
+
+static uint32_t rp_swap32(uint32_t v)
+{
+    return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+} /* -- rp_swap32 -- */
+
+/*---------------------------------------------------------------------
+ * Method: rp_load_pcap(..)
+ * Scope:  Local
+ *
+ * Split a legacy pcap, in either byte order, into input and reference.
+ *
+ *---------------------------------------------------------------------*/
+
+static int rp_load_pcap(struct sr_instance* sr, const uint8_t* d, size_t size,
+                        const char* fallback, struct rp_trace* in, struct rp_trace* ref,
+                        unsigned long* skipped)
+{
+    struct pcap_file_header h;
+    struct pcap_sf_pkthdr r;
+    const char* iface;
+    size_t off = sizeof(struct pcap_file_header);
+    int swap;
+
+    memcpy(&h, d, sizeof(h));
+    swap = h.magic != RP_PCAP_MAGIC && h.magic != RP_PCAP_MAGIC_NS;
+
+    while ( off + sizeof(r) <= size )
+    {
+        memcpy(&r, d + off, sizeof(r));
+        if ( swap )
+        { r.caplen = rp_swap32(r.caplen); }
+        off += sizeof(r);
+        if ( off + r.caplen > size )
+        { break; }
+
+        /* -- rp_pass copies each frame into a buffer of RP_FRAME_MAX -- */
+        if ( r.caplen < sizeof(struct sr_ethernet_hdr) || r.caplen > RP_FRAME_MAX )
+        { (*skipped)++; }
+        else if ( rp_iface_by_mac(sr, ((struct sr_ethernet_hdr*)(d + off))->ether_shost) )
+        {
+            iface = rp_iface_by_mac(sr, ((struct sr_ethernet_hdr*)(d + off))->ether_shost)->name;
+            rp_add(ref, d + off, r.caplen, iface);
+        }
+        else if ( (iface = rp_guess_iface(sr, d + off, r.caplen, fallback)) != 0 )
+        { rp_add(in, d + off, r.caplen, iface); }
+        else
+        { (*skipped)++; }
+        off += r.caplen;
+    }
+    return 0;
+} /* -- rp_load_pcap -- */
+
+/*---------------------------------------------------------------------
+ * Method: rp_load_pcapng(..)
+ * Scope:  Local
+ *
+ * Split a pcapng written on a host of the same byte order. Reading
+ * stops at the first block that does not make sense, such as the zero
+ * tail of a capture that was not closed.
+ *
+ *---------------------------------------------------------------------*/
+
+static int rp_load_pcapng(struct sr_instance* sr, const uint8_t* d, size_t size,
+                          const char* fallback, struct rp_trace* in, struct rp_trace* ref,
+                          unsigned long* skipped)
+{
+    char names[RP_PCAPNG_IFACES][sr_IFACE_NAMELEN];
+    uint32_t type, blen, id, caplen, flags, code, olen;
+    size_t off = 0, o, end;
+    const char* iface;
+    int nifaces = 0;
+
+    while ( off + 12 <= size )
+    {
+        memcpy(&type, d + off, 4);
+        memcpy(&blen, d + off + 4, 4);
+        if ( blen < 12 || (blen & 3) || off + blen > size )
+        { break; }
+        end = off + blen - 4;
+
+        if ( type == RP_PCAPNG_SHB )
+        {
+            memcpy(&flags, d + off + 8, 4);
+            if ( flags != RP_PCAPNG_BOM )
+            {
+                fprintf(stderr, "pcapng written in the other byte order\n");
+                return -1;
+            }
+            nifaces = 0;
+        }
+        else if ( type == RP_PCAPNG_IDB && nifaces < RP_PCAPNG_IFACES )
+        {
+            names[nifaces][0] = 0;
+            for ( o = off + 16; o + 4 <= end; o += 4 + ((olen + 3) & ~3U) )
+            {
+                code = d[o] | (d[o + 1] << 8);
+                olen = d[o + 2] | (d[o + 3] << 8);
+                if ( code == 0 )
+                { break; }
+                if ( code == 2 && olen < sr_IFACE_NAMELEN )     /* if_name */
+                {
+                    memcpy(names[nifaces], d + o + 4, olen);
+                    names[nifaces][olen] = 0;
+                }
+            }
+            nifaces++;
+        }
+        else if ( type == RP_PCAPNG_EPB )
+        {
+            memcpy(&id, d + off + 8, 4);
+            memcpy(&caplen, d + off + 20, 4);
+            flags = 0;
+            for ( o = off + 28 + ((caplen + 3) & ~3U); o + 4 <= end;
+                  o += 4 + ((olen + 3) & ~3U) )
+            {
+                code = d[o] | (d[o + 1] << 8);
+                olen = d[o + 2] | (d[o + 3] << 8);
+                if ( code == 0 )
+                { break; }
+                if ( code == 2 && olen == 4 )                    /* epb_flags */
+                { memcpy(&flags, d + o + 4, 4); }
+            }
+
+            iface = (int)id < nifaces && names[id][0] ? names[id] : 0;
+            if ( off + 28 + caplen > end || caplen < sizeof(struct sr_ethernet_hdr) ||
+                 caplen > RP_FRAME_MAX )
+            { (*skipped)++; }
+            else if ( (flags & 3) == SR_CAPTURE_OUT )
+            { rp_add(ref, d + off + 28, caplen, iface); }
+            else if ( (iface && sr_get_interface(sr, iface)) ||
+                      (iface = rp_guess_iface(sr, d + off + 28, caplen, fallback)) != 0 )
+            { rp_add(in, d + off + 28, caplen, iface); }
+            else
+            { (*skipped)++; }
+        }
+        off += blen;
+    }
+    return 0;
+} /* -- rp_load_pcapng -- */
+
+static int rp_load(struct sr_instance* sr, const char* path, const char* fallback,
+                   struct rp_trace* in, struct rp_trace* ref, unsigned long* skipped)
+{
+    FILE* fp;
+    uint8_t* d;
+    long size;
+    uint32_t magic;
+    int ret;
+
+    if ( (fp = fopen(path, "rb")) == 0 )
+    {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if ( size < (long)sizeof(struct pcap_file_header) ||
+         (d = (uint8_t*)malloc(size)) == 0 || fread(d, 1, size, fp) != (size_t)size )
+    {
+        fprintf(stderr, "%s: cannot read capture\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    memcpy(&magic, d, 4);
+    if ( magic == RP_PCAPNG_SHB )
+    { ret = rp_load_pcapng(sr, d, size, fallback, in, ref, skipped); }
+    else if ( magic == RP_PCAP_MAGIC || magic == RP_PCAP_MAGIC_NS ||
+              rp_swap32(magic) == RP_PCAP_MAGIC || rp_swap32(magic) == RP_PCAP_MAGIC_NS )
+    { ret = rp_load_pcap(sr, d, size, fallback, in, ref, skipped); }
+    else
+    {
+        fprintf(stderr, "%s: not a pcap or pcapng file\n", path);
+        ret = -1;
+    }
+    free(d);
+    return ret;
+} /* -- rp_load -- */
+
+/* Forget everything learnt or queued by the previous pass. */
+static void rp_reset(struct sr_instance* sr)
+{
+    while ( sr->cache.requests )
+    { sr_arpreq_destroy(&sr->cache, sr->cache.requests); }
+    memset(sr->cache.entries, 0, sizeof(sr->cache.entries));
+} /* -- rp_reset -- */
+
+/* One pass over the input */
+static void rp_pass(struct sr_instance* sr, const struct rp_trace* in, uint8_t* buf)
+{
+    unsigned int i;
+
+    for ( i = 0; i < in->n; i++ )
+    {
+        /* -- the router rewrites frames in place -- */
+        memcpy(buf, in->f[i].data, in->f[i].len);
+        sr_handlepacket(sr, buf, in->f[i].len, (char*)in->f[i].iface);
+    }
+    sr_end_batch(sr);
+} /* -- rp_pass -- */
+
+/* Compare the warm-up output with the reference. Returns the number of
+   leading frames that are identical. */
+static unsigned int rp_compare(const struct rp_trace* out, const struct rp_trace* ref)
+{
+    unsigned int i;
+
+    for ( i = 0; i < out->n && i < ref->n; i++ )
+    {
+        if ( out->f[i].len != ref->f[i].len ||
+             memcmp(out->f[i].data, ref->f[i].data, out->f[i].len) != 0 ||
+             (ref->f[i].iface[0] && strcmp(out->f[i].iface, ref->f[i].iface) != 0) )
+        { break; }
+    }
+    return i;
+} /* -- rp_compare -- */
+
+static void rp_write(const struct rp_trace* t, const char* path)
+{
+    struct pcap_pkthdr h;
+    FILE* fp;
+    unsigned int i;
+
+    if ( (fp = sr_dump_open(path, 0, RP_FRAME_MAX)) == 0 )
+    { return; }
+    for ( i = 0; i < t->n; i++ )
+    {
+        h.ts.tv_sec = 0;
+        h.ts.tv_usec = i;
+        h.caplen = t->f[i].len;
+        h.len = t->f[i].len;
+        sr_dump(fp, &h, t->f[i].data);
+    }
+    sr_dump_close(fp);
+} /* -- rp_write -- */
+
+static void usage(char* argv0)
+{
+    printf("Format: %s -I ifaces -r rtable [-n loops] [-i iface] [-o out.pcap] [-q] capture\n",
+           argv0);
+    printf("   -I file with one \"name ip mac\" line per router interface \n");
+    printf("   -n timed passes over the capture (default 1000) \n");
+    printf("   -i interface for input frames that cannot be placed otherwise \n");
+    printf("   -o writes the output of the warm-up pass \n");
+    printf("   -q quiet: keep per-packet log messages of the router off stdout \n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    struct sr_instance sr;
+    struct rp_trace in, ref;
+    struct timespec t0, t1;
+    char* ifaces = 0;
+    char* rtable = 0;
+    char* outfile = 0;
+    char* fallback = 0;
+    unsigned long loops = 1000, l, skipped = 0, per_pass;
+    unsigned int same;
+    uint8_t* buf;
+    double secs, frames;
+    int c, quiet = 0;
+
+    while ( (c = getopt(argc, argv, "hI:r:n:i:o:q")) != EOF )
+    {
+        switch ( c )
+        {
+            case 'I':
+                ifaces = optarg;
+                break;
+            case 'r':
+                rtable = optarg;
+                break;
+            case 'n':
+                loops = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                fallback = optarg;
+                break;
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if ( ifaces == 0 || rtable == 0 || optind != argc - 1 )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* -- a single-threaded router, as -E runs it, on the sink -- */
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    sr.io = &sr_io_sink;
+    sr.event_mode = 1;
+    sr.dispatch = SR_DISPATCH_HASH;
+    sr_txq_init(&sr.txq, 0);
+    /* -- no ICMP limit, or passes would not all send the same frames -- */
+    sr_ratelimit_init(&sr.icmp_limit, 0, 0);
+
+    if ( rp_load_ifaces(&sr, ifaces) != 0 )
+    {
+        fprintf(stderr, "No interfaces in %s\n", ifaces);
+        return 1;
+    }
+    if ( sr_load_rt(&sr, rtable) != 0 )
+    {
+        fprintf(stderr, "Error loading routing table %s\n", rtable);
+        return 1;
+    }
+    if ( sr_verify_routing_table(&sr) != 0 )
+    {
+        fprintf(stderr, "Routing table not consistent with the interfaces\n");
+        return 1;
+    }
+    sr_init(&sr);
+
+    memset(&in, 0, sizeof(in));
+    memset(&ref, 0, sizeof(ref));
+    if ( rp_load(&sr, argv[optind], fallback, &in, &ref, &skipped) != 0 )
+    { return 1; }
+    if ( in.n == 0 )
+    {
+        fprintf(stderr, "%s: no input frames\n", argv[optind]);
+        return 1;
+    }
+    if ( (buf = (uint8_t*)malloc(RP_FRAME_MAX)) == 0 )
+    { return 1; }
+    if ( quiet && freopen("/dev/null", "w", stdout) == 0 )
+    { perror("freopen(..):sr_replay.c::main"); }
+
+    /* -- warm-up: record and check the output -- */
+    rp_recording = 1;
+    rp_pass(&sr, &in, buf);
+    rp_recording = 0;
+    per_pass = rp_sent;
+
+    same = rp_compare(&rp_out, &ref);
+    fprintf(stderr, "%s: %u input frames, %u reference output frames", argv[optind],
+            in.n, ref.n);
+    if ( skipped )
+    { fprintf(stderr, ", %lu frames too short, too long or without an interface skipped",
+              skipped); }
+    fprintf(stderr, "\noutput: %u frames, ", rp_out.n);
+    if ( ref.n == 0 )
+    { fprintf(stderr, "no reference to compare with\n"); }
+    else if ( same == rp_out.n && same == ref.n )
+    { fprintf(stderr, "identical to the reference\n"); }
+    else
+    { fprintf(stderr, "first %u identical to the reference, DIFFERENT from frame %u\n",
+              same, same); }
+    if ( outfile )
+    { rp_write(&rp_out, outfile); }
+
+    /* -- timed passes -- */
+    rp_sent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for ( l = 0; l < loops; l++ )
+    {
+        rp_reset(&sr);
+        rp_pass(&sr, &in, buf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    frames = (double)loops * in.n;
+    if ( loops > 0 && secs > 0 )
+    {
+        fprintf(stderr, "%lu passes, %.0f frames in %.3f s: %.0f packets/s, %.1f ns/packet, "
+                "%.0f frames out/s\n", loops, frames, secs, frames / secs,
+                secs * 1e9 / frames, rp_sent / secs);
+    }
+    if ( rp_sent != per_pass * loops )
+    {
+        fprintf(stderr, "passes not deterministic: %lu frames out, expected %lu\n",
+                rp_sent, per_pass * loops);
+        return 2;
+    }
+    return (ref.n && (same != rp_out.n || same != ref.n)) ? 2 : 0;
+} /* -- main -- */
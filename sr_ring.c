@@ -0,0 +1,105 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * Lock-free single-producer/single-consumer ring, see sr_ring.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_ring.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ring_init(struct sr_ring* r, unsigned int size)
+{
+    unsigned int n = 1;
+
+    /* -- REQUIRES -- */
+    assert(r);
+    assert(size > 0);
+
+    while ( n < size )
+    { n <<= 1; }
+
+    memset(r, 0, sizeof(struct sr_ring));
+    if ( (r->slots = (void**)calloc(n, sizeof(void*))) == 0 )
+    { return -1; }
+    r->mask = n - 1;
+
+    return 0;
+} /* -- sr_ring_init -- */
+
+void sr_ring_destroy(struct sr_ring* r)
+{
+    free(r->slots);
+    r->slots = 0;
+} /* -- sr_ring_destroy -- */
+
+int sr_ring_enqueue(struct sr_ring* r, void* obj)
+{
+    unsigned int tail = r->tail;
+
+    if ( tail - r->head_cache > r->mask )
+    {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if ( tail - r->head_cache > r->mask )
+        { return -1; }
+    }
+
+    r->slots[tail & r->mask] = obj;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+} /* -- sr_ring_enqueue -- */
+
+int sr_ring_dequeue(struct sr_ring* r, void** obj)
+{
+    return sr_ring_dequeue_burst(r, obj, 1) == 1 ? 0 : -1;
+} /* -- sr_ring_dequeue -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_dequeue_burst(..)
+ * Scope: Global
+ *
+ * One acquire of the producer index and one release of the consumer
+ * index cover the whole burst.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_ring_dequeue_burst(struct sr_ring* r, void** objs, unsigned int n)
+{
+    unsigned int head = r->head;
+    unsigned int avail = r->tail_cache - head;
+    unsigned int i;
+
+    if ( avail < n )
+    {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        avail = r->tail_cache - head;
+    }
+    if ( n > avail )
+    { n = avail; }
+    if ( n == 0 )
+    { return 0; }
+
+    for ( i = 0; i < n; i++ )
+    { objs[i] = r->slots[(head + i) & r->mask]; }
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+
+    return n;
+} /* -- sr_ring_dequeue_burst -- */
+
+unsigned int sr_ring_count(struct sr_ring* r)
+{
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+} /* -- sr_ring_count -- */
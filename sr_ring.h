@@ -0,0 +1,61 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ *
+ * Description:
+ *
+ * Bounded single-producer/single-consumer ring of pointers, used to hand
+ * frames between threads without locks.  The producer and consumer indexes
+ * live on cache lines of their own, and each side keeps a private copy of
+ * the other side's index so it only reads the shared one when the ring
+ * looks full (producer) or empty (consumer).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#define SR_CACHELINE 64
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ring
+ *
+ * 'head' is only written by the consumer, 'tail' only by the producer. Both
+ * run freely and are masked on access, so size must be a power of two.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ring
+{
+    void** slots;
+    unsigned int mask;
+    char pad0[SR_CACHELINE - sizeof(void**) - sizeof(unsigned int)];
+
+    /* -- consumer side -- */
+    unsigned int head;
+    unsigned int tail_cache;        /* last tail the consumer saw */
+    char pad1[SR_CACHELINE - 2 * sizeof(unsigned int)];
+
+    /* -- producer side -- */
+    unsigned int tail;
+    unsigned int head_cache;        /* last head the producer saw */
+    char pad2[SR_CACHELINE - 2 * sizeof(unsigned int)];
+};
+
+/* 'size' is rounded up to a power of two. Returns 0 on success. */
+int  sr_ring_init(struct sr_ring* r, unsigned int size);
+void sr_ring_destroy(struct sr_ring* r);
+
+/* Producer side. Returns 0 on success, -1 if the ring is full. */
+int  sr_ring_enqueue(struct sr_ring* r, void* obj);
+
+/* Consumer side. Returns 0 on success, -1 if the ring is empty. */
+int  sr_ring_dequeue(struct sr_ring* r, void** obj);
+
+/* Consumer side. Take up to 'n' entries, returns how many were taken. */
+unsigned int sr_ring_dequeue_burst(struct sr_ring* r, void** objs, unsigned int n);
+
+/* Entries currently queued, exact only when called from one of the two
+   sides while the other is idle. */
+unsigned int sr_ring_count(struct sr_ring* r);
+
+#endif /* -- SR_RING_H -- */
@@ -16,6 +16,7 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <signal.h>
 
 #include "sr_if.h"
 #include "sr_rt.h"
@@ -23,6 +24,10 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_worker.h"
+#include "sr_numa.h"
+#include "sr_neigh.h"
+#include "sr_log.h"
 
 /* TODO: Add constant definitions here... */
 
@@ -30,32 +35,166 @@
 
 /* See pseudo-code in sr_arpcache.h */
 void handle_arpreq(struct sr_instance* sr, struct sr_arpreq *req){
-  /* TODO: Fill this in */
-  time_t now = time(NULL);
-  pthread_mutex_lock(&sr->cache.lock);
+  struct sr_arp_work work;
+
+  sr_arp_work_init(&work);
+
+  sr_arpcache_lock(sr_neigh_cache(sr));
+  sr_arpreq_collect(sr, req, time(NULL), &work);
+  sr_arpcache_unlock(sr_neigh_cache(sr));
+
+  sr_arp_work_run(sr, &work);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpreq_collect(..)
+ * Scope:  Global
+ *
+ * Decide what to do about one ARP request, with the cache locked: send
+ * it again, or give up on it. Nothing is sent here, the decision goes
+ * into 'work' for sr_arp_work_run. On a worker, only the next hop's
+ * home shard sends requests; the others ask it once and wait.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_arpreq_collect(struct sr_instance* sr, struct sr_arpreq *req,
+                       time_t now, struct sr_arp_work *work){
+  struct sr_arpcache *cache = sr_neigh_cache(sr);
+
+  if(sr_worker_self && sr_neigh_home(sr, req->ip) != sr_worker_self->id) {
+    if(req->times_sent == 0) {
+      if(sr_neigh_post(sr, sr_neigh_home(sr, req->ip), SR_NEIGH_RESOLVE,
+                       req->ip, NULL) == 0) {
+        req->sent = now;
+        req->times_sent = 1;
+      }
+    }
+    else if(difftime(now,req->sent) > SR_NEIGH_WAIT) {
+      sr_arpreq_detach(cache, req);
+      req->next = work->failed;
+      work->failed = req;
+    }
+    return;
+  }
 
   if(difftime(now,req->sent) > 1.0) {
 
     if(req->times_sent >= 5) {
-      printf("\nTimes sent exceed >= 5, dropping ARP request");
-      struct sr_packet *temp = req->packets;
-      while(temp != NULL) {
-        sr_send_icmp_t3(sr, icmp_type_dest_unreach,
-        icmp_code_host_unreach, temp->buf, sr_get_interface(sr,temp->iface));
-        temp = temp->next;
-      }
-      sr_arpreq_destroy(&sr->cache,req);
+      sr_arpreq_detach(cache, req);
+      req->next = work->failed;
+      work->failed = req;
+      if(sr_worker_self)
+        sr_neigh_fail(sr, req->ip);
     }
-    else {
-      /* printf("\nneed to implement resending ARP reqeust here"); */
-      sr_send_request(sr, req->ip);
-      req->sent = time(NULL);
+    else if(sr_arp_work_resend(work, req->ip) == 0) {
+      req->sent = now;
       req->times_sent++;
     }
   }
-  pthread_mutex_unlock(&sr->cache.lock);
 }
 
+/*---------------------------------------------------------------------
+ * Method: sr_arp_work_run(..)
+ * Scope:  Global
+ *
+ * Carry out what sr_arpreq_collect decided, without the cache lock.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_arp_work_run(struct sr_instance* sr, struct sr_arp_work *work){
+  struct sr_arpreq *req, *next;
+  struct sr_packet *temp;
+  unsigned int i;
+
+  for(i = 0; i < work->nresend; i++)
+    sr_send_request(sr, work->resend[i]);
+
+  for(req = work->failed; req != NULL; req = next) {
+    next = req->next;
+    i = 0;
+    for(temp = req->packets; temp != NULL; temp = temp->next) {
+      sr_send_icmp_t3(sr, icmp_type_dest_unreach,
+      icmp_code_host_unreach, temp->buf, sr_get_interface(sr,temp->iface));
+      i++;
+    }
+    LogDebug("ARP request sent too often, %u frames unreachable\n", i);
+    SR_TRACE(SR_EV_ARP_GIVEUP, 0, req->ip, 0, i);
+    sr_arpreq_free(req);
+  }
+
+  sr_arp_work_init(work);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_dump_state(..)
+ * Scope:  Global
+ *
+ * What SIGUSR1 asks for: the ARP cache and the counters, to stderr.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dump_state(struct sr_instance* sr)
+{
+    int i;
+
+    /* -- with workers the entries live in their shards, not sr->cache -- */
+    if (sr->workers == 0)
+        sr_arpcache_dump(&sr->cache);
+    for (i = 0; sr->workers && i < sr->nworkers; i++) {
+        fprintf(stderr, "\nARP cache shard %d", i);
+        sr_arpcache_dump(&sr->workers[i]->neigh->cache);
+    }
+    fprintf(stderr, "txq: %lu frames in %lu writes\n",
+            sr->txq.frames, sr->txq.flushes);
+    sr_workers_stats(sr, stderr);
+    sr_ratelimit_stats(&sr->icmp_limit, stderr);
+} /* -- sr_dump_state -- */
+
+/* Only there to interrupt the main thread's wait, see sr_signal_thread */
+static void sr_wake_handler(int sig)
+{
+} /* -- sr_wake_handler -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_signal_thread(..)
+ * Scope:  Local
+ *
+ * Threaded mode's stand-in for the event loop's signalfd: SIGUSR1,
+ * SIGINT and SIGTERM are blocked everywhere and waited for here. On
+ * SIGINT or SIGTERM the main thread is told to stop and woken with
+ * SIGUSR2, which ends its wait in the backend with EINTR; it leaves the
+ * poll loop and shuts down through sr_destroy_instance. The signal may
+ * come just before the main thread starts waiting, so it is sent again
+ * every second until sr_destroy_instance blocks it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void *sr_signal_thread(void *sr_ptr)
+{
+    struct sr_instance *sr = sr_ptr;
+    sigset_t mask;
+    int sig;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    while (sigwait(&mask, &sig) == 0) {
+        if (sig == SIGUSR1) {
+            sr_dump_state(sr);
+            continue;
+        }
+        fprintf(stderr, "Caught signal %d, shutting down\n", sig);
+        __atomic_store_n(&sr->stop, 1, __ATOMIC_RELEASE);
+        break;
+    }
+    while (1) {
+        pthread_kill(sr->main_thread, SIGUSR2);
+        sleep(1);
+    }
+    return NULL;
+} /* -- sr_signal_thread -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
  * Scope:  Global
@@ -72,13 +211,56 @@ void sr_init(struct sr_instance* sr)
     /* Initialize cache and cache cleanup thread */
     sr_arpcache_init(&(sr->cache));
 
-    pthread_attr_init(&(sr->attr));
-    pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
-    pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_t thread;
+    if (sr->event_mode && sr->nworkers == 0) {
+        /* The event loop drives the cache from a timerfd on the same
+           thread as forwarding, so no locking is needed anywhere. */
+        sr->lockless = 1;
+        sr->cache.lockless = 1;
+        sr->txq.lockless = 1;
+        sr->icmp_limit.lockless = 1;
+    }
+
+    /* -- the table is final now, keep it next to the forwarding threads -- */
+    sr_rt_place(sr, sr_node_for(sr, SR_ROLE_RX, 0));
+
+    if (sr->nworkers > 0 && sr_workers_start(sr) != 0) {
+        fprintf(stderr, "Error starting forwarding workers\n");
+        exit(1);
+    }
 
-    pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
+    if (!sr->event_mode) {
+        sigset_t mask;
+        struct sigaction sa;
+
+        /* -- SIGUSR1, SIGINT and SIGTERM go to sr_signal_thread alone;
+           threads created from here on inherit the mask (workers block
+           everything) -- */
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGUSR1);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+        /* -- no SA_RESTART, so the wake interrupts the backend's wait -- */
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = sr_wake_handler;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR2, &sa, NULL);
+        sr->main_thread = pthread_self();
+
+        pthread_attr_init(&(sr->attr));
+        pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
+        pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
+        pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
+        sr_thread_attr(&(sr->attr), "arp", sr_cpu_for(sr, SR_ROLE_ARP, 0));
+        pthread_t thread;
+
+        pthread_create(&sr->arp_thread, &(sr->attr), sr_arpcache_timeout, sr);
+        pthread_create(&thread, &(sr->attr), sr_signal_thread, sr);
+    }
+
+    if (sr->ncpus > 0 || sr->nworkers > 0)
+        sr_placement_report(stdout);
 
     /* TODO: (opt) Add initialization code here */
 
@@ -137,7 +319,7 @@ void sr_handlepacket(struct sr_instance* sr,
   assert(interface);
 
 
-  printf("*** -> Received packet of length %d\n",len);
+  LogDebug("*** -> Received packet of length %d\n",len);
 
 
   /* TODO: Add forwarding logic here */
@@ -152,12 +334,13 @@ void sr_handlepacket(struct sr_instance* sr,
   /* printf("\nEthernet header is: %d, ARP header is: %d", e_hdr->ether_type,
    a_hdr); */
   uint16_t type_ = ntohs(e_hdr->ether_type);
+  SR_TRACE(SR_EV_RX, type_, len, sr_trace_name(interface), 0);
   switch(type_){
 /*------------------------------------------------------------------------------*/
     case ethertype_arp:
-      printf("\nARP, Packet type: %d, Arp type: %d",type_,ethertype_arp);
       if(!sanity_check_arp(len)){
-        printf("\nSanity check failed, ARP packet dropped.");
+        LogDebug("Sanity check failed, ARP packet dropped\n");
+        SR_TRACE(SR_EV_ARP_BAD, 0, len, 0, 0);
         break;
       }
       handle_arp(sr, e_hdr, a_hdr, iface);
@@ -165,33 +348,36 @@ void sr_handlepacket(struct sr_instance* sr,
       break;
 /*------------------------------------------------------------------------------*/
     case ethertype_ip:
-      printf("\n received IP packet");
       sr_ip_hdr_t *ip_header= get_ip_hdr(packet);
+      /* all header invariants and checksums, before anything else */
+      int drop = sr_validate_ip(packet, len);
+      if(drop){
+        LogDebug("IP packet failed validation (%d), dropped\n", drop);
+        SR_TRACE(SR_EV_IP_BAD, drop, drop == SR_IP_BAD_LEN ? 0 : ip_header->ip_src,
+                 drop == SR_IP_BAD_LEN ? 0 : ip_header->ip_dst, len);
+        break;
+      }
       /*print_hdr_ip(ip_header);*/
       uint8_t ip_type=ip_header->ip_p;
+      SR_TRACE(SR_EV_IP, ip_type, ip_header->ip_src, ip_header->ip_dst, len);
 
       switch(ip_type)
       {
         case ip_protocol_icmp:
           /*printf("\nICMP, Packet type: %d, IP type: %d",type_,ethertype_ip);*/
-          printf("\n This is a ICMP packet");
-          sr_icmp_hdr_t *icmp_hdr = get_icmp_hdr(packet);
-          if(!sanity_check_icmp(len))
-            return;
-          if(!check_icmp_chksum(ip_header->ip_len, icmp_hdr))
-            return;
+          LogDebug("ICMP packet\n");
           handle_ICMP(sr, e_hdr, len, iface);
           break;
         /*----------------------------------------------------------------------*/
         default:
-          printf("\nThis is a IP packet");
+          LogDebug("IP packet\n");
           handle_IP(sr, e_hdr, len, iface);
       }
       break;
 /*------------------------------------------------------------------------------*/
     default:
-      printf("\nUnknown Packet type. Packet dropped.");
-      printf("\nPacket type: %d,IP type: %d, ARP type: %d",type_,ethertype_ip,ethertype_arp);
+      LogDebug("Unknown packet type %d, packet dropped\n",type_);
+      SR_TRACE(SR_EV_UNKNOWN, type_, len, 0, 0);
       break;
   }
 
@@ -203,9 +389,10 @@ void handle_ICMP(struct sr_instance* sr, uint8_t *packet, unsigned int len, stru
   sr_ethernet_hdr_t* eth_header=get_eth_hdr(packet);
 
   sr_ip_hdr_t *ip_hdr = get_ip_hdr(packet);
-  ip_hdr->ip_ttl --;
+  ip_decrement_ttl(ip_hdr);
   if(ip_hdr->ip_ttl == 0){
-    printf("TTL is decremented to be 0, sending TTL expired ICMP\n");
+    LogDebug("TTL is decremented to be 0, sending TTL expired ICMP\n");
+    SR_TRACE(SR_EV_TTL, 0, ip_hdr->ip_src, ip_hdr->ip_dst, 0);
     /* send ICM type 3 message here */
     sr_send_icmp_t3(sr, icmp_type_time_exceed,
     icmp_code_ttl_expired, packet, iface);
@@ -219,17 +406,13 @@ void handle_IP(struct sr_instance* sr, uint8_t *packet, unsigned int len, struct
 {
   sr_ip_hdr_t *ip_hdr = get_ip_hdr(packet);
   sr_ip_hdr_t* eth_hdr = get_eth_hdr(packet);
-  if(!sanity_check_ip(len)) {
-    printf("Sanity check for IP failed. Dropping\n");
-  }
-  if(!check_ip_chksum(ip_hdr)){
-    printf("Checksum check for IP failed. Dropping\n");
-  }
+  /* sr_handlepacket has validated the header (sr_validate_ip) */
   struct sr_if *temp = sr->if_list;
   while(temp){
     /* Check if it matches one of our interfaces */
     if(temp->ip == ip_hdr->ip_dst){
-      printf("Got a IP packet from interface: %s\n",temp->name);
+      LogDebug("Got a IP packet from interface: %s\n",temp->name);
+      SR_TRACE(SR_EV_IP_LOCAL, ip_hdr->ip_p, ip_hdr->ip_src, ip_hdr->ip_dst, 0);
       /* handle it */
       uint8_t ip_type=ip_hdr->ip_p;
       sr_icmp_hdr_t *icmp_hdr = get_icmp_hdr(packet);
@@ -238,14 +421,12 @@ void handle_IP(struct sr_instance* sr, uint8_t *packet, unsigned int len, struct
         case ip_protocol_tcp:
           sr_send_icmp_t3(sr, icmp_type_dest_unreach, icmp_code_port_unreach,
           packet, iface);
+          return;
         case ip_protocol_udp:
           sr_send_icmp_t3(sr, icmp_type_dest_unreach, icmp_code_port_unreach,
           packet, iface);
+          return;
         case ip_protocol_icmp:
-          if(!sanity_check_icmp(len))
-            return;
-          if(!check_icmp_chksum(ip_hdr->ip_len, icmp_hdr))
-            return;
             if( (icmp_hdr->icmp_code == icmp_code_empty) &&
               (icmp_hdr->icmp_type == icmp_type_echo_req) ){
                 sr_send_icmp_t0(sr, packet, icmp_type_echo_rep,
@@ -257,11 +438,12 @@ void handle_IP(struct sr_instance* sr, uint8_t *packet, unsigned int len, struct
     temp = temp->next;
   }
   /* forward it if it is not destined to us */
-  printf("This IP packet is not for us, forwarding it\n");
+  LogDebug("This IP packet is not for us, forwarding it\n");
   /* decrement TTL, if TTL still > 0, forward it */
-  ip_hdr->ip_ttl --;
+  ip_decrement_ttl(ip_hdr);
   if(ip_hdr->ip_ttl == 0){
-    printf("TTL is decremented to be 0, sending TTL expired ICMP\n");
+    LogDebug("TTL is decremented to be 0, sending TTL expired ICMP\n");
+    SR_TRACE(SR_EV_TTL, 0, ip_hdr->ip_src, ip_hdr->ip_dst, 0);
 
     /* TODO: send ICM type 3 message here */
     sr_send_icmp_t3(sr, icmp_type_time_exceed,
@@ -279,28 +461,34 @@ void handle_arp(struct sr_instance* sr, uint8_t *packet, unsigned int len,
   struct sr_if *iface){
       sr_ethernet_hdr_t *e_hdr = get_eth_hdr(packet);
       sr_arp_hdr_t *a_hdr = get_arp_hdr(packet);
-      printf("\nAn ARP packet received! Validating...");
+      SR_TRACE(SR_EV_ARP, ntohs(a_hdr->ar_op), a_hdr->ar_sip, a_hdr->ar_tip, 0);
       switch(ntohs(a_hdr->ar_op)) {
         /* Handle ARP request */
         case arp_op_request:
-          printf("\nThis ARP is correct! Processing...");
+          LogDebug("ARP request received\n");
           /*firstly should check the arp cache using sr_arpcache_lookup
           */
           sr_send_reply(sr,e_hdr, a_hdr, iface);
           break;
         /* Handle ARP reply */
         case arp_op_reply:
-          printf("\nAn ARP reply received!");
-          pthread_mutex_lock(&sr->cache.lock);
-          sr_arpreq_t *req = sr_arpcache_insert(&sr->cache, a_hdr->ar_sha, a_hdr->ar_sip);
+          LogDebug("ARP reply received\n");
+          /* insert takes the request off the queue, so its packets are
+             ours and can be sent without holding the cache lock */
+          sr_arpreq_t *req = sr_arpcache_insert(sr_neigh_cache(sr), a_hdr->ar_sha, a_hdr->ar_sip);
+          /* the other workers' shards learn it through their message boxes */
+          if(sr_worker_self)
+            sr_neigh_publish(sr, a_hdr->ar_sip, a_hdr->ar_sha);
           if(a_hdr->ar_tip != iface->ip){
-            /* If the ARP reply is not for us */
-            printf("We are not the destination of that ARP reply packet\n");
-            break;
+            /* If the ARP reply is not for us, it still tells us the MAC
+               the packets of a request of ours wait for */
+            LogDebug("We are not the destination of that ARP reply packet\n");
+            SR_TRACE(SR_EV_ARP_NOT_US, 0, a_hdr->ar_tip, 0, 0);
           }
           if (req!=NULL)
           {
             sr_packet_t *pkg=req->packets;
+            unsigned int nsent = 0;
             while (pkg!=NULL)
             {
               sr_if_t* dst_iface=find_dst_if(sr, req->ip);
@@ -313,13 +501,13 @@ void handle_arp(struct sr_instance* sr, uint8_t *packet, unsigned int len,
               sr_forward_packet(sr, pkg->buf, pkg->len, iface,
                 a_hdr->ar_sha);
               pkg=pkg->next;
-              printf("sending pkg \n");
+              nsent++;
             }
-            printf("Sending pkg finished\n");
-            sr_arpreq_destroy(&sr->cache, req);
+            LogDebug("Sent %u packets waiting for the ARP reply\n", nsent);
+            SR_TRACE(SR_EV_ARP_FLUSH, 0, req->ip, 0, nsent);
+            sr_arpreq_free(req);
 
           }
-          pthread_mutex_unlock(&sr->cache.lock);
           /*should save into request queue*/
 
           /*The ARP reply processing code should move entries from the ARP request
@@ -333,7 +521,7 @@ void handle_arp(struct sr_instance* sr, uint8_t *packet, unsigned int len,
               arpreq_destroy(req)*/
           break;
         default:
-          printf("\nCannot recognize this ARP frame");
+          LogDebug("Cannot recognize this ARP frame\n");
           return;
       }
   }
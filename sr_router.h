@@ -16,6 +16,8 @@
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
+#include "sr_txq.h"
+#include "sr_ratelimit.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -30,10 +32,16 @@
 
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
+#define SR_RXBUF_SZ (256 * 1024) /* event loop receive buffer */
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_io_ops;
+struct sr_worker;
+struct sr_capture;
+struct sr_txstage;
+struct sr_sched;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -53,8 +61,30 @@ struct sr_instance
     struct sr_if* if_list; /* list of interfaces */
     struct sr_rt* routing_table; /* routing table */
     struct sr_arpcache cache;   /* ARP cache */
+    struct sr_txq txq;          /* batched transmit queue */
+    struct sr_ratelimit icmp_limit; /* on the ICMP messages we generate (-I) */
+    struct sr_io_ops* io;       /* frame I/O backend (-i), VNS by default */
+    void* io_priv;              /* backend private state */
+    int event_mode;             /* single-threaded epoll loop (-E) */
+    int lockless;               /* one thread does everything, skip locks */
+    int nworkers;               /* forwarding worker threads (-W), 0 = none */
+    struct sr_worker** workers;
+    int pipeline;               /* separate TX stage behind the workers (-P) */
+    struct sr_txstage* txstage;
+    int dispatch;               /* SR_DISPATCH_*, how workers share frames (-D) */
+    int flow_guard;             /* one worker at a time per flow (-D ordered) */
+    unsigned long reorder_us;   /* bound on reordering waits, 0 = no reordering (-R) */
+    struct sr_sched* sched;
+    int* cpus;                  /* CPUs threads are pinned to (-C), in order */
+    int ncpus;                  /* 0 = no pinning */
+    uint8_t* rxbuf;             /* event loop receive buffer */
+    unsigned int rxlen;         /* bytes pending in rxbuf */
     pthread_attr_t attr;
+    pthread_t main_thread;      /* runs the poll loop, woken to stop */
+    pthread_t arp_thread;       /* sr_arpcache_timeout, threaded mode */
+    int stop;                   /* SIGINT/SIGTERM seen, threaded mode */
     FILE* logfile;
+    struct sr_capture* capture; /* writer thread behind logfile (-l) */
 };
 
 /* -- sr_main.c -- */
@@ -62,11 +92,19 @@ int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+void sr_deliver_packet(struct sr_instance* , uint8_t* , unsigned int , char* );
+int sr_flush_packets(struct sr_instance* );
+int sr_end_batch(struct sr_instance* );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_read_from_server_batch(struct sr_instance* );
+
+/* -- sr_event.c -- */
+int sr_event_loop(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
+void sr_dump_state(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
 
 /* -- sr_if.c -- */
@@ -79,5 +117,8 @@ void handle_arp(struct sr_instance* sr, uint8_t *packet, unsigned int len,
   struct sr_if *iface);
 /* -- sr_arpcache.c and sr_router.c -- */
 void handle_arpreq(struct sr_instance* , struct sr_arpreq* );
+void sr_arpreq_collect(struct sr_instance* , struct sr_arpreq* , time_t ,
+                       struct sr_arp_work* );
+void sr_arp_work_run(struct sr_instance* , struct sr_arp_work* );
 
 #endif /* SR_ROUTER_H */
@@ -20,7 +20,9 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_if.h"
 #include "sr_router.h"
+#include "sr_numa.h"
 
 /*---------------------------------------------------------------------
  * Method:
@@ -131,6 +133,48 @@ struct in_addr gw, struct in_addr mask,char* if_name)
 
 } /* -- sr_add_entry -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_rt_place(..)
+ * Scope:  Global
+ *
+ * Move the loaded table into one region on 'node', so that a lookup
+ * walks adjacent entries instead of scattered heap blocks. Entries
+ * added later are malloc'ed and appended as usual.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_place(struct sr_instance* sr, int node)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_rt* next = 0;
+    struct sr_rt* table = 0;
+    int n = 0, i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for(rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    { n++; }
+    if(n == 0)
+    { return; }
+
+    table = (struct sr_rt*)sr_mem_alloc("routing table", n * sizeof(struct sr_rt), node);
+    if(table == 0)
+    { return; }
+
+    rt_walker = sr->routing_table;
+    for(i = 0; i < n; i++)
+    {
+        next = rt_walker->next;
+        table[i] = *rt_walker;
+        table[i].next = (i + 1 < n) ? &table[i + 1] : 0;
+        free(rt_walker);
+        rt_walker = next;
+    }
+    sr->routing_table = table;
+
+} /* -- sr_rt_place -- */
+
 /*---------------------------------------------------------------------
  * Method:
  *
@@ -176,3 +220,54 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\n",entry->interface);
 
 } /* -- sr_print_routing_entry -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_verify_routing_table()
+ * Scope: Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_if* if_walker = 0;
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    {
+        return 999; /* doh! */
+    }
+
+    rt_walker = sr->routing_table;
+
+    while(rt_walker)
+    {
+        /* -- check to see if interface exists -- */
+        if_walker = sr->if_list;
+        while(if_walker)
+        {
+            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
+                    == 0)
+            { break; }
+            if_walker = if_walker->next;
+        }
+        if(if_walker == 0)
+        { ret++; } /* -- interface not found! -- */
+
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
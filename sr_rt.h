@@ -42,6 +42,7 @@ int sr_load_rt(struct sr_instance*,const char*);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
 void sr_print_routing_table(struct sr_instance* sr);
+void sr_rt_place(struct sr_instance* sr, int node);
 void sr_print_routing_entry(struct sr_rt* entry);
 
 
@@ -0,0 +1,199 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_tracedump.c
+ *
+ * Description:
+ *
+ * Offline decoder for the trace files the router writes with -L (see
+ * sr_log.h).  The rings of all threads are merged into one timeline,
+ * printed one event per line with its time since the first event and
+ * the thread that recorded it:
+ *
+ *   sr_tracedump [-t tid] trace.bin
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sr_log.h"
+
+/* How an argument is printed */
+#define K_NONE  0
+#define K_DEC   1
+#define K_HEX   2
+#define K_IP    3   /* network order */
+#define K_NAME  4   /* four bytes of an interface name */
+#define K_WHY   5   /* SR_IP_BAD_* */
+
+static const char* why[SR_IP_BAD_MAX] =
+{ "?", "short", "checksum", "version", "hl", "ip_len", "icmp-short", "icmp-checksum" };
+
+struct sr_ev_arg
+{
+    const char* name;
+    int kind;
+};
+
+struct sr_ev_desc
+{
+    const char* name;
+    struct sr_ev_arg args[4];   /* x, a, b, c */
+};
+
+static const struct sr_ev_desc descs[SR_EV_MAX] =
+{
+    { "?",        { {0, K_NONE}, {0, K_NONE}, {0, K_NONE}, {0, K_NONE} } },
+    { "rx",       { {"type", K_HEX}, {"len", K_DEC}, {"iface", K_NAME}, {0, K_NONE} } },
+    { "unknown",  { {"type", K_HEX}, {"len", K_DEC}, {0, K_NONE}, {0, K_NONE} } },
+    { "arp-bad",  { {0, K_NONE}, {"len", K_DEC}, {0, K_NONE}, {0, K_NONE} } },
+    { "arp",      { {"op", K_DEC}, {"sender", K_IP}, {"target", K_IP}, {0, K_NONE} } },
+    { "arp-notus",{ {0, K_NONE}, {"target", K_IP}, {0, K_NONE}, {0, K_NONE} } },
+    { "arp-flush",{ {0, K_NONE}, {"ip", K_IP}, {0, K_NONE}, {"frames", K_DEC} } },
+    { "arp-giveup",{ {0, K_NONE}, {"ip", K_IP}, {0, K_NONE}, {"frames", K_DEC} } },
+    { "ip",       { {"proto", K_DEC}, {"src", K_IP}, {"dst", K_IP}, {"len", K_DEC} } },
+    { "ip-bad",   { {"reason", K_WHY}, {"src", K_IP}, {"dst", K_IP}, {"len", K_DEC} } },
+    { "ip-local", { {"proto", K_DEC}, {"src", K_IP}, {"dst", K_IP}, {0, K_NONE} } },
+    { "ttl",      { {0, K_NONE}, {"src", K_IP}, {"dst", K_IP}, {0, K_NONE} } },
+    { "no-route", { {0, K_NONE}, {"src", K_IP}, {"dst", K_IP}, {0, K_NONE} } },
+    { "arp-wait", { {0, K_NONE}, {"nexthop", K_IP}, {"iface", K_NAME}, {0, K_NONE} } },
+    { "forward",  { {"sum", K_HEX}, {"dst", K_IP}, {"iface", K_NAME}, {"len", K_DEC} } },
+    { "icmp-limit",{ {"type", K_DEC}, {"dst", K_IP}, {0, K_NONE}, {0, K_NONE} } }
+};
+
+/* One thread's events, merged by time */
+struct sr_ring_in
+{
+    uint32_t tid;
+    uint32_t count;
+    uint64_t recorded;
+    struct sr_trace_ev* ev;
+    uint32_t next;
+};
+
+static void print_arg(const struct sr_ev_arg* arg, uint32_t v)
+{
+    unsigned char* b = (unsigned char*)&v;
+    char name[5];
+
+    switch ( arg->kind )
+    {
+        case K_DEC:
+            printf(" %s=%u", arg->name, v);
+            break;
+        case K_HEX:
+            printf(" %s=0x%04x", arg->name, v);
+            break;
+        case K_IP:
+            printf(" %s=%u.%u.%u.%u", arg->name, b[0], b[1], b[2], b[3]);
+            break;
+        case K_NAME:
+            memcpy(name, &v, 4);
+            name[4] = 0;
+            printf(" %s=%s", arg->name, name);
+            break;
+        case K_WHY:
+            printf(" %s=%s", arg->name, why[v < SR_IP_BAD_MAX ? v : 0]);
+            break;
+    }
+} /* -- print_arg -- */
+
+static void usage(char* argv0)
+{
+    fprintf(stderr, "Format: %s [-t tid] trace\n", argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    FILE* fp;
+    char magic[8];
+    uint32_t nrings, i, only = 0;
+    struct sr_ring_in* rings;
+    struct sr_ring_in* r;
+    struct sr_trace_ev* e;
+    const struct sr_ev_desc* d;
+    uint64_t t0 = 0;
+    unsigned long lost = 0;
+    int c;
+
+    while ( (c = getopt(argc, argv, "ht:")) != EOF )
+    {
+        switch ( c )
+        {
+            case 't':
+                only = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if ( optind != argc - 1 )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( (fp = fopen(argv[optind], "rb")) == 0 )
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if ( fread(magic, 1, 8, fp) != 8 || memcmp(magic, SR_TRACE_MAGIC, 8) != 0 ||
+         fread(&nrings, sizeof(nrings), 1, fp) != 1 )
+    {
+        fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+        return 1;
+    }
+
+    rings = (struct sr_ring_in*)calloc(nrings ? nrings : 1, sizeof(struct sr_ring_in));
+    for ( i = 0; i < nrings; i++ )
+    {
+        r = &rings[i];
+        if ( fread(&r->tid, sizeof(r->tid), 1, fp) != 1 ||
+             fread(&r->count, sizeof(r->count), 1, fp) != 1 ||
+             fread(&r->recorded, sizeof(r->recorded), 1, fp) != 1 ||
+             r->count > SR_TRACE_RING ||
+             (r->ev = (struct sr_trace_ev*)malloc(r->count * sizeof(struct sr_trace_ev) + 1)) == 0 ||
+             fread(r->ev, sizeof(struct sr_trace_ev), r->count, fp) != r->count )
+        {
+            fprintf(stderr, "%s: truncated\n", argv[optind]);
+            return 1;
+        }
+        if ( r->count && (t0 == 0 || r->ev[0].ns < t0) )
+        { t0 = r->ev[0].ns; }
+        lost += (unsigned long)(r->recorded - r->count);
+    }
+    fclose(fp);
+
+    /* -- merge: the oldest pending event of any ring next -- */
+    while ( 1 )
+    {
+        r = 0;
+        for ( i = 0; i < nrings; i++ )
+        {
+            if ( rings[i].next < rings[i].count &&
+                 (r == 0 || rings[i].ev[rings[i].next].ns < r->ev[r->next].ns) )
+            { r = &rings[i]; }
+        }
+        if ( r == 0 )
+        { break; }
+
+        e = &r->ev[r->next++];
+        if ( only && r->tid != only )
+        { continue; }
+
+        d = &descs[e->id < SR_EV_MAX ? e->id : 0];
+        printf("%12.6f %6u %-10s", (double)(e->ns - t0) / 1e9, r->tid, d->name);
+        print_arg(&d->args[0], e->x);
+        print_arg(&d->args[1], e->a);
+        print_arg(&d->args[2], e->b);
+        print_arg(&d->args[3], e->c);
+        printf("\n");
+    }
+
+    if ( lost )
+    { fprintf(stderr, "%lu older events were overwritten\n", lost); }
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,230 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txq.c
+ *
+ * Description:
+ *
+ * Batched transmit path for the VNS connection, see sr_txq.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "sr_txq.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_writev_all(..)
+ * Scope: Global
+ *
+ * Gather-write every byte described by 'iov' to 'fd', picking up after
+ * short writes and signal interrupts.  Works on non-blocking descriptors
+ * by waiting for room when the socket buffer is full.
+ *
+ *---------------------------------------------------------------------*/
+
+ssize_t sr_writev_all(int fd, struct iovec* iov /* consumed */, int iovcnt)
+{
+    ssize_t total = 0, ret;
+
+    while ( iovcnt > 0 )
+    {
+        if ( (ret = writev(fd, iov, iovcnt)) == -1 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            { /* -- non-blocking socket (event loop), wait for room -- */
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            perror("writev(..):sr_txq.c::sr_writev_all");
+            return total;
+        }
+        total += ret;
+
+        /* -- skip fully written entries, trim the partial one -- */
+        while ( iovcnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return total;
+} /* -- sr_writev_all -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_init(..)
+ * Scope: Global
+ *
+ * Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_txq_init(struct sr_txq* q, unsigned int max_frames)
+{
+    /* -- REQUIRES -- */
+    assert(q);
+
+    q->max_frames   = max_frames;
+    q->max_delay_us = SR_TXQ_MAX_DELAY_US;
+    q->nframes      = 0;
+    q->used         = 0;
+    q->flushes      = 0;
+    q->frames       = 0;
+    q->lockless     = 0;
+    q->fd_lock      = 0;
+    timerclear(&q->first);
+
+    return pthread_mutex_init(&q->lock, NULL);
+} /* -- sr_txq_init -- */
+
+void sr_txq_destroy(struct sr_txq* q)
+{
+    pthread_mutex_destroy(&q->lock);
+} /* -- sr_txq_destroy -- */
+
+/* Queue lock, skipped when the router runs single-threaded */
+static void sr_txq_lock(struct sr_txq* q)
+{
+    if ( !q->lockless )
+    { pthread_mutex_lock(&q->lock); }
+}
+
+static void sr_txq_unlock(struct sr_txq* q)
+{
+    if ( !q->lockless )
+    { pthread_mutex_unlock(&q->lock); }
+}
+
+/* Write under the shared descriptor lock, if there is one */
+ssize_t sr_txq_write(struct sr_txq* q, int fd, struct iovec* iov, int iovcnt)
+{
+    ssize_t ret;
+
+    if ( q->fd_lock )
+    { pthread_mutex_lock(q->fd_lock); }
+    ret = sr_writev_all(fd, iov, iovcnt);
+    if ( q->fd_lock )
+    { pthread_mutex_unlock(q->fd_lock); }
+
+    return ret;
+} /* -- sr_txq_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_flush_locked(..)
+ * Scope: Local
+ *
+ * Write out the stage, caller holds q->lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_txq_flush_locked(struct sr_txq* q, int fd)
+{
+    struct iovec iov;
+    unsigned int used = q->used;
+
+    if ( q->nframes == 0 )
+    { return 0; }
+
+    iov.iov_base = q->stage;
+    iov.iov_len  = used;
+
+    q->flushes++;
+    q->frames += q->nframes;
+    q->nframes = 0;
+    q->used    = 0;
+
+    if ( sr_txq_write(q, fd, &iov, 1) < used )
+    {
+        fprintf(stderr, "Error writing packet batch\n");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_txq_flush_locked -- */
+
+int sr_txq_flush(struct sr_txq* q, int fd)
+{
+    int ret;
+
+    sr_txq_lock(q);
+    ret = sr_txq_flush_locked(q, fd);
+    sr_txq_unlock(q);
+
+    return ret;
+} /* -- sr_txq_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txq_push(..)
+ * Scope: Global
+ *
+ * Stage a frame.  Frames too large for the stage bypass it (after the
+ * stage is flushed, to keep ordering) and go out directly.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_txq_push(struct sr_txq* q, int fd, const c_packet_header* hdr,
+                const uint8_t* buf, unsigned int len)
+{
+    unsigned int need = sizeof(c_packet_header) + len;
+    struct timeval now, age;
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(q);
+    assert(hdr);
+    assert(buf);
+
+    sr_txq_lock(q);
+
+    if ( q->used + need > SR_TXQ_STAGE_SZ )
+    { ret = sr_txq_flush_locked(q, fd); }
+
+    if ( need > SR_TXQ_STAGE_SZ )
+    {
+        struct iovec iov[2];
+
+        iov[0].iov_base = (void*)hdr;
+        iov[0].iov_len  = sizeof(c_packet_header);
+        iov[1].iov_base = (void*)buf;
+        iov[1].iov_len  = len;
+        if ( sr_txq_write(q, fd, iov, 2) < need )
+        { ret = -1; }
+        sr_txq_unlock(q);
+        return ret;
+    }
+
+    memcpy(q->stage + q->used, hdr, sizeof(c_packet_header));
+    memcpy(q->stage + q->used + sizeof(c_packet_header), buf, len);
+    q->used += need;
+
+    gettimeofday(&now, 0);
+    if ( q->nframes++ == 0 )
+    { q->first = now; }
+
+    timersub(&now, &q->first, &age);
+    if ( q->nframes >= q->max_frames ||
+         age.tv_sec > 0 || age.tv_usec >= (long)q->max_delay_us )
+    {
+        if ( sr_txq_flush_locked(q, fd) != 0 )
+        { ret = -1; }
+    }
+
+    sr_txq_unlock(q);
+
+    return ret;
+} /* -- sr_txq_push -- */
@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txq.h
+ *
+ * Description:
+ *
+ * Transmit queue for the VNS connection.  Frames handed to sr_send_packet
+ * are staged back to back (VNS header followed by the ethernet frame) and
+ * written to the server socket in one go when the queue is flushed, either
+ * explicitly at the end of a receive batch or when a frame count, byte
+ * count or age threshold is crossed.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TXQ_H
+#define SR_TXQ_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "vnscommand.h"
+
+#define SR_TXQ_STAGE_SZ      (64 * 1024) /* bytes staged before a forced flush */
+#define SR_TXQ_MAX_DELAY_US  1000        /* oldest staged frame may wait this long */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_txq
+ *
+ * Frames are copied into 'stage' because callers of sr_send_packet are free
+ * to reuse or modify their buffer as soon as the call returns.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_txq
+{
+    pthread_mutex_t lock;
+    int lockless;                /* single-threaded, skip the lock */
+    pthread_mutex_t* fd_lock;    /* serialises writes when several queues share fd */
+    unsigned int max_frames;     /* flush after this many frames, 0 = no batching */
+    unsigned int max_delay_us;   /* latency bound for a staged frame */
+    unsigned int nframes;        /* frames currently staged */
+    unsigned int used;           /* bytes currently staged */
+    struct timeval first;        /* when the oldest staged frame was queued */
+    unsigned long flushes;       /* number of writes issued */
+    unsigned long frames;        /* number of frames sent through the queue */
+    uint8_t stage[SR_TXQ_STAGE_SZ];
+};
+
+int  sr_txq_init(struct sr_txq* q, unsigned int max_frames);
+void sr_txq_destroy(struct sr_txq* q);
+
+/* Queue one frame behind its VNS header, flushing first or afterwards as the
+   thresholds require.  Returns 0 on success, -1 if a write failed. */
+int  sr_txq_push(struct sr_txq* q, int fd, const c_packet_header* hdr,
+                 const uint8_t* buf, unsigned int len);
+
+/* Write out everything staged.  Returns 0 on success, -1 on a failed write. */
+int  sr_txq_flush(struct sr_txq* q, int fd);
+
+/* sr_writev_all under q->fd_lock, for frames that bypass the stage. */
+ssize_t sr_txq_write(struct sr_txq* q, int fd, struct iovec* iov, int iovcnt);
+
+/* Gather-write all of 'iov' to 'fd'.  Returns the number of bytes written,
+   which is less than requested on error. The iovec array is consumed. */
+ssize_t sr_writev_all(int fd, struct iovec* iov, int iovcnt);
+
+#endif /* -- SR_TXQ_H -- */
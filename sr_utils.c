@@ -1,28 +1,66 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <assert.h>
 #include "sr_protocol.h"
 #include "sr_utils.h"
 #include "sr_rt.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_neigh.h"
+#include "sr_log.h"
+#include "sr_cksum.h"
 
+/* The kernel for this CPU, see sr_cksum.h */
 uint16_t cksum (const void *_data, int len) {
-  const uint8_t *data = _data;
-  uint32_t sum;
+  return sr_cksum(_data, len);
+}
+
+/* RFC 1624 incremental update: the checksum 'sum' of a header in which
+   the 16-bit word 'old' became 'new', HC' = ~(~HC + ~m + m'). One's
+   complement sums come out the same in either byte order, so the words
+   are taken as they sit in the header. */
+uint16_t cksum_adjust(uint16_t sum, uint16_t old, uint16_t new) {
+  uint32_t acc = (uint16_t)~sum + (uint16_t)~old + (uint32_t)new;
 
-  /* add all pairs of bytes in the input buffer */
-  for (sum = 0;len >= 2; data += 2, len -= 2)
-    sum += data[0] << 8 | data[1];
-  /* handle odd number of bytes in buffer */
-  if (len > 0)
-    sum += data[0] << 8;
+  acc = (acc >> 16) + (acc & 0xffff);
+  acc += acc >> 16;
+  return (uint16_t)~acc;
+}
+
+/* The same for a 32-bit field, e.g. an address rewritten by NAT */
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old, uint32_t new) {
+  sum = cksum_adjust(sum, (uint16_t)(old >> 16), (uint16_t)(new >> 16));
+  return cksum_adjust(sum, (uint16_t)old, (uint16_t)new);
+}
 
-  /* fold 32-bit sum into 16-bit var */
-  while (sum > 0xffff)
-    sum = (sum >> 16) + (sum & 0xffff);
-  sum = htons (~sum);
-  return sum;
+/* Decrement the TTL and patch ip_sum for it, rather than summing the
+   header again. A LOGLEVEL=4 build checks the result against a full
+   recompute whenever the header came in with a valid checksum. */
+void ip_decrement_ttl(sr_ip_hdr_t *ip_hdr) {
+  uint16_t old, new;
+#if SR_LOG_LEVEL >= SR_LOG_DEBUG
+  int valid = check_ip_chksum(ip_hdr);
+  uint16_t full;
+#endif
+
+  /* -- the TTL shares a word with the protocol, ttl first on the wire -- */
+  memcpy(&old, &ip_hdr->ip_ttl, sizeof(old));
+  ip_hdr->ip_ttl--;
+  memcpy(&new, &ip_hdr->ip_ttl, sizeof(new));
+  ip_hdr->ip_sum = cksum_adjust(ip_hdr->ip_sum, old, new);
+
+#if SR_LOG_LEVEL >= SR_LOG_DEBUG
+  if (valid) {
+    old = ip_hdr->ip_sum;
+    ip_hdr->ip_sum = 0;
+    full = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+    ip_hdr->ip_sum = old;
+    if (full != old)
+      LogError("Incremental checksum %04x, recomputed %04x\n", old, full);
+    assert(full == old);
+  }
+#endif
 }
 
 uint16_t ethertype(uint8_t *buf) {
@@ -201,95 +239,89 @@ struct sr_if *find_dst_if(struct sr_instance *sr, uint32_t dst){
     return NULL;
 }
 
+/* Copy 16 bits of a header, e.g. the word a field change falls in */
+static uint16_t hdr_word(const void *p) {
+  uint16_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+/* The frames sent below start from the interface's templates (struct
+   sr_if_tmpl) copied onto the stack: sr_send_packet only borrows the
+   buffer, so nothing is allocated. */
+
 int sr_send_reply(struct sr_instance *sr, sr_ethernet_hdr_t *req_e_hdr,
   sr_arp_hdr_t *req_a_hdr, struct sr_if* iface){
-   unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-   /* allocate memory to packet */
-   uint8_t *packet = (uint8_t *)malloc(len);
-   bzero(packet, len);
-   sr_ethernet_hdr_t *rep_e_hdr = get_eth_hdr(packet);
-   sr_arp_hdr_t *rep_a_hdr = get_arp_hdr(packet);
-   memcpy(rep_e_hdr->ether_dhost, req_e_hdr->ether_shost, ETHER_ADDR_LEN);
-   memcpy(rep_e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
-   rep_e_hdr->ether_type = ntohs(ethertype_arp);
-   rep_a_hdr->ar_hln = req_a_hdr->ar_hln;
-   rep_a_hdr->ar_pln = req_a_hdr->ar_pln;
-   rep_a_hdr->ar_op = htons(arp_op_reply);
-   rep_a_hdr->ar_pro = req_a_hdr->ar_pro;
-   rep_a_hdr->ar_hrd = req_a_hdr->ar_hrd;
-   memcpy(rep_a_hdr->ar_tha, req_a_hdr->ar_sha, ETHER_ADDR_LEN);
-   memcpy(rep_a_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
-   rep_a_hdr->ar_sip = iface->ip;
-   rep_a_hdr->ar_tip = req_a_hdr->ar_sip;
-   printf("\nSending reply\n");
-   int res = sr_send_packet(sr, packet, len, iface->name);
-   return res;
+  uint8_t packet[SR_ARP_FRAME_LEN];
+  sr_ethernet_hdr_t *rep_e_hdr = get_eth_hdr(packet);
+  sr_arp_hdr_t *rep_a_hdr = get_arp_hdr(packet);
+
+  memcpy(packet, iface->tmpl.arp_reply, sizeof(packet));
+  memcpy(rep_e_hdr->ether_dhost, req_e_hdr->ether_shost, ETHER_ADDR_LEN);
+  memcpy(rep_a_hdr->ar_tha, req_a_hdr->ar_sha, ETHER_ADDR_LEN);
+  rep_a_hdr->ar_tip = req_a_hdr->ar_sip;
+  LogDebug("Sending reply\n");
+  return sr_send_packet(sr, packet, sizeof(packet), iface->name);
 }
 
 int sr_send_request(struct sr_instance *sr, uint32_t tip){
-  unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-  /* allocate memory to packet */
-  uint8_t *packet = (uint8_t *)malloc(len);
-  bzero(packet, len);
-
+  uint8_t packet[SR_ARP_FRAME_LEN];
   struct sr_if *iface = find_dst_if(sr, tip);
-  struct sr_ethernet_hdr *e_hdr = get_eth_hdr(packet);
-  struct sr_arp_hdr *a_hdr = get_arp_hdr(packet);
 
-  memset(e_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
-  memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
-  e_hdr->ether_type = htons(ethertype_arp);
-
-  a_hdr->ar_hln = ETHER_ADDR_LEN;
-  a_hdr->ar_pln = 4;
-  a_hdr->ar_op = htons(arp_op_request);
-  a_hdr->ar_pro = htons(ethertype_ip);
-  a_hdr->ar_hrd = htons(arp_hrd_ethernet);
-  memset(a_hdr->ar_tha, 0xff, ETHER_ADDR_LEN);
-  memcpy(a_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
-  a_hdr->ar_sip = iface->ip;
-  a_hdr->ar_tip = tip;
+  if(iface == NULL){
+    LogDebug("No route to the next hop, not sending ARP request\n");
+    return -1;
+  }
+  memcpy(packet, iface->tmpl.arp_request, sizeof(packet));
+  get_arp_hdr(packet)->ar_tip = tip;
+  return sr_send_packet(sr, packet, sizeof(packet), iface->name);
+}
 
-  int res = sr_send_packet(sr, packet, len, iface->name);
-  return res;
+/* Whether an ICMP message to 'dst' is within the limits of sr->icmp_limit */
+static int sr_icmp_allowed(struct sr_instance *sr, uint8_t icmp_type, uint32_t dst){
+  if(sr_ratelimit_allow(&sr->icmp_limit, dst))
+    return 1;
+  LogDebug("ICMP rate limit reached, not sending type %d\n", icmp_type);
+  SR_TRACE(SR_EV_ICMP_LIMIT, icmp_type, dst, 0, 0);
+  return 0;
 }
 
+/* An echo reply, made from the request in place */
 int sr_send_icmp_t0(struct sr_instance *sr, uint8_t *packet, uint8_t icmp_type,
   uint8_t icmp_code, unsigned int len, struct sr_if *iface){
   sr_ethernet_hdr_t *eth_hdr = get_eth_hdr(packet);
   sr_ip_hdr_t *ip_hdr = get_ip_hdr(packet);
   sr_icmp_hdr_t *icmp_hdr = get_icmp_hdr(packet);
+  uint32_t src = ip_hdr->ip_src, dst = ip_hdr->ip_dst;
+  uint16_t old = hdr_word(icmp_hdr);
+  /* Get the interface using its destination IP address */
+  struct sr_if *iface_ = find_dst_if(sr, src);
+
+  if(iface_ == NULL){
+    LogDebug("No route back to the source, not sending ICMP\n");
+    return -1;
+  }
+  if(!sr_icmp_allowed(sr, icmp_type, src))
+    return 0;
 
-  /*  */
   memcpy(eth_hdr->ether_dhost, eth_hdr->ether_shost, ETHER_ADDR_LEN);
-  /* Get the interface using its destination IP address */
-  struct sr_if *iface_ = find_dst_if(sr, ip_hdr->ip_src);
   memcpy(eth_hdr->ether_shost, iface_->addr, ETHER_ADDR_LEN);
 
-  uint32_t temp = ip_hdr->ip_src;
+  /* swap destination and source, patching the checksums for what changed */
   ip_hdr->ip_src = iface->ip;
-  /* swap destination and source */
-  ip_hdr->ip_dst = temp;
+  ip_hdr->ip_dst = src;
+  ip_hdr->ip_sum = cksum_adjust32(cksum_adjust32(ip_hdr->ip_sum, src, ip_hdr->ip_src),
+                                  dst, ip_hdr->ip_dst);
   icmp_hdr->icmp_type = icmp_type;
   icmp_hdr->icmp_code = icmp_code;
-  /* Again, set checksum to 0 first */
-  icmp_hdr->icmp_sum = 0;
-  /* Then compute the correct checksum */
-  icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_hdr_t));
+  icmp_hdr->icmp_sum = cksum_adjust(icmp_hdr->icmp_sum, old, hdr_word(icmp_hdr));
 
-  int res = sr_send_packet(sr, packet, len, iface_->name);
-  return res;
-  }
+  return sr_send_packet(sr, packet, len, iface_->name);
+}
 
 int sr_send_icmp_t3(struct sr_instance *sr, uint8_t icmp_type,
 uint8_t icmp_code, uint8_t *rcvd_packet, struct sr_if *iface){
-/* Calculate length of header */
-unsigned int len = sizeof(sr_ethernet_hdr_t) +sizeof(sr_ip_hdr_t)
-+ sizeof(sr_icmp_t3_hdr_t);
-  /* Allocate memory space for ICMP packet */
-  uint8_t *packet = (uint8_t *)malloc(len);
-  bzero(packet, len);
-  /* Assign new Headers */
+  uint8_t packet[SR_ICMP_T3_FRAME_LEN];
   sr_ethernet_hdr_t *e_hdr = get_eth_hdr(packet);
   sr_ip_hdr_t *ip_hdr = get_ip_hdr(packet);
   sr_icmp_t3_hdr_t *icmp_hdr = get_icmp_t3_hdr(packet);
@@ -298,33 +330,37 @@ unsigned int len = sizeof(sr_ethernet_hdr_t) +sizeof(sr_ip_hdr_t)
   sr_ethernet_hdr_t *rec_eth_hdr = get_eth_hdr(rcvd_packet);
   /* Use helper function to find outgoing interface by looking up route table */
   struct sr_if *new_iface = find_dst_if(sr, rec_ip_hdr->ip_src);
-  /* Assigning values to ethernet headers */
+  uint16_t sum;
+
+  if(new_iface == NULL){
+    LogDebug("No route back to the source, not sending ICMP\n");
+    return -1;
+  }
+  if(!sr_icmp_allowed(sr, icmp_type, rec_ip_hdr->ip_src))
+    return 0;
+
+  /* The template is from the receiving interface's address; the fields
+     it leaves zero go in with their checksums adjusted */
+  memcpy(packet, iface->tmpl.icmp_t3, sizeof(packet));
   memcpy(e_hdr->ether_dhost, rec_eth_hdr->ether_shost, ETHER_ADDR_LEN);
-  e_hdr->ether_type = htons(ethertype_ip);
   memcpy(e_hdr->ether_shost, new_iface->addr, ETHER_ADDR_LEN);
-  /* Assigning values to IP headers */
+
+  sum = hdr_word(ip_hdr);
+  ip_hdr->ip_tos = rec_ip_hdr->ip_tos;
+  sum = cksum_adjust(ip_hdr->ip_sum, sum, hdr_word(ip_hdr));
   /* set the packet id to equal the received packet id */
   ip_hdr->ip_id = rec_ip_hdr->ip_id;
-  ip_hdr->ip_hl = rec_ip_hdr->ip_hl;
-  ip_hdr->ip_p = ip_protocol_icmp;
-  ip_hdr->ip_tos = rec_ip_hdr->ip_tos;
-  ip_hdr->ip_v = rec_ip_hdr->ip_v;
-  ip_hdr->ip_src = iface->ip;
-  ip_hdr->ip_off = htons(IP_DF);
-  ip_hdr->ip_ttl = INIT_TTL;
-  ip_hdr->ip_sum = 0;
-  ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
   ip_hdr->ip_dst = rec_ip_hdr->ip_src;
-  ip_hdr->ip_len = htons(len - sizeof(sr_ethernet_hdr_t));
-  /* Assigning values to ICMP headers */
+  ip_hdr->ip_sum = cksum_adjust32(cksum_adjust(sum, 0, ip_hdr->ip_id), 0, ip_hdr->ip_dst);
+
   icmp_hdr->icmp_type = icmp_type;
   icmp_hdr->icmp_code = icmp_code;
   memcpy(icmp_hdr->data, rec_ip_hdr, ICMP_DATA_SIZE);
-  icmp_hdr->icmp_sum = 0;
-  icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_t3_hdr_t));
+  sum = cksum_adjust(icmp_hdr->icmp_sum, 0, hdr_word(icmp_hdr));
+  icmp_hdr->icmp_sum = cksum_adjust(sum, 0, (uint16_t)~cksum(icmp_hdr->data, ICMP_DATA_SIZE));
+
   /* Send this new constructed ICMP type 3 packet */
-  int res = sr_send_packet(sr, packet, len, new_iface->name);
-  return res;
+  return sr_send_packet(sr, packet, sizeof(packet), new_iface->name);
 }
 
 void sr_forward_packet(struct sr_instance *sr, uint8_t *packet,
@@ -334,13 +370,9 @@ void sr_forward_packet(struct sr_instance *sr, uint8_t *packet,
   sr_ip_hdr_t *ip_hdr = get_ip_hdr(packet);
   memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
   memcpy(e_hdr->ether_dhost, mac, ETHER_ADDR_LEN);
-  /* We have to set ip_sum to 0 before we compute new sum */
-  /* If we don't do that, the ip_sum will be 0 not matter how to calculate it */
-  ip_hdr->ip_sum = 0;
-  /* Compute checksum */
-  ip_hdr->ip_sum = cksum((const void *)ip_hdr, sizeof(sr_ip_hdr_t));
-  printf("\nChecksum of that packet is: %d\n",ip_hdr->ip_sum);
-  printf("\nForwarding Packet");
+  /* ip_sum already accounts for the TTL, see ip_decrement_ttl */
+  LogDebug("Forwarding packet, checksum %d\n",ip_hdr->ip_sum);
+  SR_TRACE(SR_EV_FORWARD, ip_hdr->ip_sum, ip_hdr->ip_dst, sr_trace_name(iface->name), len);
   sr_send_packet(sr, packet, len, iface->name);
   }
 
@@ -350,27 +382,27 @@ void sr_forwarding (struct sr_instance *sr, uint8_t *packet,
     struct sr_if *iface_found = find_dst_if(sr, ip_hdr->ip_dst);
     /* if we cannot find a interface for the destination ip */
     if(iface_found == NULL){
-      printf("No interfaces found for this destination ip, sending ICMP\n");
+      LogDebug("No interfaces found for this destination ip, sending ICMP\n");
+      SR_TRACE(SR_EV_NO_ROUTE, 0, ip_hdr->ip_src, ip_hdr->ip_dst, 0);
       sr_send_icmp_t3(sr, icmp_type_dest_unreach,
       icmp_code_net_unreach, packet, iface);
     }
     /* if we can find interface */
     else
       {
-        sr_arpentry_t* dst_entry = sr_arpcache_lookup(&sr->cache, ip_hdr->ip_dst);
-        if (dst_entry==NULL)
+        sr_arpentry_t dst_entry;
+        if (!sr_arpcache_get(sr_neigh_cache(sr), ip_hdr->ip_dst, &dst_entry))
         {
-          sr_arpreq_t* new_req = sr_arpcache_queuereq(&sr->cache,
+          sr_arpreq_t* new_req = sr_arpcache_queuereq(sr_neigh_cache(sr),
             ip_hdr->ip_dst, packet, len, iface_found->name);
+          SR_TRACE(SR_EV_ARP_WAIT, 0, ip_hdr->ip_dst, sr_trace_name(iface_found->name), 0);
           handle_arpreq(sr,new_req);
           return;
         }
         else
         {
           /* forward the packet */
-          sr_forward_packet(sr, packet, len, iface_found, dst_entry->mac);
-          free(dst_entry);
-          printf("Forwarding successfully\n");
+          sr_forward_packet(sr, packet, len, iface_found, dst_entry.mac);
           return;
         }
     }
@@ -432,6 +464,46 @@ int check_ip_chksum(sr_ip_hdr_t *ip_hdr) {
   }
 }
 
+/*---------------------------------------------------------------------
+ * Method: sr_validate_ip(..)
+ * Scope:  Global
+ *
+ * Everything sr_handlepacket needs to hold for an IP frame, cheapest
+ * first: the frame holds the header, version 4, a header length of at
+ * least 20 bytes and a total length between it and the frame's, then
+ * the header checksum and, for ICMP, the ICMP checksum.  A header (or
+ * message) with its checksum in sums to zero, so nothing is written.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_validate_ip(uint8_t *packet, unsigned int len) {
+  sr_ip_hdr_t *ip_hdr = get_ip_hdr(packet);
+  unsigned int hl, ip_len;
+
+  if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    return SR_IP_BAD_LEN;
+  if (ip_hdr->ip_v != 4)
+    return SR_IP_BAD_VER;
+
+  len -= sizeof(sr_ethernet_hdr_t);
+  hl = ip_hdr->ip_hl * 4;
+  ip_len = ntohs(ip_hdr->ip_len);
+  if (hl < sizeof(sr_ip_hdr_t) || hl > len)
+    return SR_IP_BAD_HL;
+  if (ip_len < hl || ip_len > len)
+    return SR_IP_BAD_TOTLEN;
+
+  if (cksum(ip_hdr, hl) != 0)
+    return SR_IP_BAD_SUM;
+  if (ip_hdr->ip_p == ip_protocol_icmp) {
+    if (ip_len - hl < sizeof(sr_icmp_hdr_t))
+      return SR_IP_BAD_ICMP_LEN;
+    if (cksum((uint8_t *)ip_hdr + hl, ip_len - hl) != 0)
+      return SR_IP_BAD_ICMP_SUM;
+  }
+  return 0;
+}
+
 int check_icmp_chksum(uint16_t len, sr_icmp_hdr_t *icmp_hdr) {
   uint16_t tmp_sum = icmp_hdr->icmp_sum;
   icmp_hdr->icmp_sum = 0;
@@ -32,6 +32,9 @@
 #include "sr_if.h"
 
 uint16_t cksum(const void *_data, int len);
+uint16_t cksum_adjust(uint16_t sum, uint16_t old, uint16_t new);
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old, uint32_t new);
+void ip_decrement_ttl(sr_ip_hdr_t *ip_hdr);
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
@@ -86,6 +89,10 @@ int sanity_check_icmp(unsigned int len);
 int check_ip_chksum(sr_ip_hdr_t *ip_hdr);
 int check_icmp_chksum(uint16_t ip_len, sr_icmp_hdr_t *icmp_hdr);
 
+/* Ingress validation of an IP frame in one pass: 0 if it may be
+   processed, else why to drop it (SR_IP_BAD_*, see sr_log.h) */
+int sr_validate_ip(uint8_t *packet, unsigned int len);
+
 
 
 
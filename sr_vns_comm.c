@@ -30,27 +30,36 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include "sr_dumper.h"
+#include "sr_capture.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_io.h"
+#include "sr_worker.h"
+#include "sr_arena.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
+static void sr_log_packet(struct sr_instance* , uint8_t* , int , const char* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
                                   char* interface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static int sr_handle_command(struct sr_instance* sr, uint8_t* buf, int len,
+                             int expected_cmd);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -334,9 +343,8 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
-    int command, len;
+    int len;
     unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
     int ret = 0, bytes_read = 0;
 
     /* REQUIRES */
@@ -377,7 +385,8 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         return -1;
     }
 
-    if((buf = malloc(len)) == 0)
+    /* -- scratch memory, given back by sr_end_batch below -- */
+    if((buf = sr_arena_alloc(len)) == 0)
     {
         fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
         return -1;
@@ -407,9 +416,38 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         } while (errno == EINTR); /* be mindful of signals */
     }
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    ret = sr_handle_command(sr, buf, len, expected_cmd);
+
+    /* -- end of receive batch, push out what it produced -- */
+    sr_end_batch(sr);
+
+    return ret;
+}/* -- sr_read_from_server -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: Local
+ *
+ * Dispatch one complete command of 'len' bytes read from the server.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep reading, 0 if the server closed the session, -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_handle_command(struct sr_instance* sr /* borrowed */,
+                             uint8_t* buf /* lent */,
+                             int len,
+                             int expected_cmd)
+{
+    int command;
+    int ret = 0;
+
+    /* convert the command type in place, buf need not be aligned */
+    memcpy(&command, buf + 4, 4);
+    command = ntohl(command);
+    memcpy(buf + 4, &command, 4);
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -425,27 +463,9 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         /* -------------        VNSPACKET     -------------------- */
 
         case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
+            sr_deliver_packet(sr, buf + sizeof(c_packet_header),
+                    len - sizeof(c_packet_header),
                     (char*)(buf + sizeof(c_base)));
-
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -454,9 +474,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -502,10 +519,82 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
-}/* -- sr_read_from_server -- */
+}/* -- sr_handle_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_batch(..)
+ * Scope: global
+ *
+ * Non-blocking counterpart of sr_read_from_server, behind sr_vns_poll.
+ * Drains whatever the socket has ready into sr->rxbuf, dispatches every
+ * complete command and flushes the transmit queue once for the whole
+ * batch.  A partial trailing command is kept for the next call.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going, 0 if the session was closed, -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_batch(struct sr_instance* sr /* borrowed */)
+{
+    int ret = 1, closed = 0, n;
+    unsigned int off = 0;
+    uint32_t len;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->rxbuf);
+
+    while ( sr->rxlen < SR_RXBUF_SZ )
+    {
+        n = recv(sr->sockfd, sr->rxbuf + sr->rxlen, SR_RXBUF_SZ - sr->rxlen,
+                 MSG_DONTWAIT);
+        if ( n == -1 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            { break; }
+            perror("recv(..):sr_client.c::sr_read_from_server_batch");
+            return -1;
+        }
+        if ( n == 0 )
+        {
+            fprintf(stderr,"VNS server closed connection.\n");
+            closed = 1;
+            break;
+        }
+        sr->rxlen += n;
+    }
+
+    while ( ret == 1 && sr->rxlen - off >= 4 )
+    {
+        memcpy(&len, sr->rxbuf + off, 4);
+        len = ntohl(len);
+
+        if ( len > 10000 || len < sizeof(c_base) )
+        {
+            fprintf(stderr,"Error: command length to large %u\n",len);
+            ret = -1;
+            break;
+        }
+        if ( sr->rxlen - off < len )
+        { break; }
+
+        ret = sr_handle_command(sr, sr->rxbuf + off, len, 0);
+        off += len;
+    }
+
+    /* -- end of receive batch, push out what it produced -- */
+    sr_end_batch(sr);
+
+    memmove(sr->rxbuf, sr->rxbuf + off, sr->rxlen - off);
+    sr->rxlen -= off;
+
+    return (ret == 1 && closed) ? 0 : ret;
+} /* -- sr_read_from_server_batch -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
@@ -553,12 +642,49 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_deliver_packet(..)
+ * Scope: Global
+ *
+ * Common receive path for every I/O backend: drop ARP requests meant for
+ * another router, log the frame and hand it to sr_handlepacket.  With
+ * forwarding workers (-W) the polling thread filters and passes the frame
+ * on to the worker owning its flow, which comes back through here.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_deliver_packet(struct sr_instance* sr /* borrowed */,
+                       uint8_t* packet /* lent */,
+                       unsigned int len,
+                       char* interface /* lent */)
+{
+    if ( sr_worker_self == 0 )
+    {
+        /* -- check if it is an ARP to another router if so drop   -- */
+        if ( sr_arp_req_not_for_us(sr, packet, len, interface) )
+        { return; }
+
+        if ( sr->nworkers > 0 )
+        {
+            sr_worker_dispatch(sr, packet, len, interface);
+            return;
+        }
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, packet, len, interface, SR_CAPTURE_IN);
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, packet, len, interface);
+} /* -- sr_deliver_packet -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Send a packet (ethernet header included!) of length 'len' out of
+ * interface 'iface' through the active I/O backend (the VNS server unless
+ * another backend was selected with -i).
  *
  *---------------------------------------------------------------------------*/
 
@@ -567,9 +693,6 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
-
     /* REQUIRES */
     assert(sr);
     assert(buf);
@@ -581,61 +704,205 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
-
     /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    sr_log_packet(sr,buf,len,iface,SR_CAPTURE_OUT);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
+    if ( sr_worker_self )
+    {
+        sr_worker_self->tx_pkts++;
+        if ( sr->pipeline )
+        { return sr_worker_send(sr, buf, len, iface); }
+    }
+
+    return sr->io->send(sr, buf, len, iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flush_packets(..)
+ * Scope: Global
+ *
+ * Push out any frames the backend has staged for transmission. Called at
+ * the end of every receive batch (by way of sr_end_batch) and by the ARP
+ * sweeper, so a staged frame never waits longer than one batch (or one
+ * sweep).
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flush_packets(struct sr_instance* sr /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    /* -- end of a receive batch, let the workers have it -- */
+    if ( sr->sched )
+    { sr_worker_dispatch_flush(sr); }
+
+    /* -- pipeline workers hold nothing back, the TX thread flushes -- */
+    if ( sr->pipeline && sr_worker_self )
+    { return 0; }
+
+    return sr->io->flush(sr);
+} /* -- sr_flush_packets -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_end_batch(..)
+ * Scope: Global
+ *
+ * End of a batch of the calling thread: every backend's poll, each worker
+ * burst and each ARP sweep ends with it.  Flushes, then gives back what
+ * the batch took from the thread's scratch arena (sr_arena.h).
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_end_batch(struct sr_instance* sr /* borrowed */)
+{
+    int ret = sr_flush_packets(sr);
+
+    sr_arena_reset();
+    return ret;
+} /* -- sr_end_batch -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send(..)
+ * Scope: Local
+ *
+ * Send a frame to the server to be injected onto the wire.  The VNS header
+ * is built on the stack and written together with the caller's frame, or
+ * staged in the transmit queue when batching (-B) is on.  Workers (-W)
+ * stage in a queue of their own.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_send(struct sr_instance* sr /* borrowed */,
+                       uint8_t* buf /* borrowed */,
+                       unsigned int len,
+                       const char* iface /* borrowed */)
+{
+    c_packet_header sr_pkt;
+    struct sr_txq* q;
+    struct iovec iov[2];
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+
+    /* Create VNS header on the stack, the frame itself is never copied */
+    memset(&sr_pkt, 0, sizeof(c_packet_header));
+    sr_pkt.mLen  = htonl(total_len);
+    sr_pkt.mType = htonl(VNSPACKET);
+    strncpy(sr_pkt.mInterfaceName,iface,16);
+
+    q = sr_worker_txq(sr);
+    if ( q->max_frames > 1 ){
+        return sr_txq_push(q, sr->sockfd, &sr_pkt, buf, len);
+    }
+
+    iov[0].iov_base = &sr_pkt;
+    iov[0].iov_len  = sizeof(c_packet_header);
+    iov[1].iov_base = buf;
+    iov[1].iov_len  = len;
+
+    if( sr_txq_write(q, sr->sockfd, iov, 2) < total_len ){
         fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
         return -1;
     }
 
-    free(sr_pkt);
-
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_send -- */
+
+static int sr_vns_flush(struct sr_instance* sr)
+{
+    return sr_txq_flush(sr_worker_txq(sr), sr->sockfd);
+} /* -- sr_vns_flush -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
+ * Method: sr_vns_poll(..)
  * Scope: Local
  *
+ * Wait up to 'timeout' ms for the socket to become readable (the event
+ * loop has already waited and passes 0), then read everything it has in
+ * one batch, so that one flush covers all the frames that arrived
+ * together.  A signal ends the wait early with nothing read.
+ *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+static int sr_vns_poll(struct sr_instance* sr, int timeout)
 {
-    struct pcap_pkthdr h;
-    int size;
+    struct pollfd pfd;
 
+    if ( sr->rxbuf == 0 )
+    {
+        if ( (sr->rxbuf = (uint8_t*)malloc(SR_RXBUF_SZ)) == 0 )
+        {
+            fprintf(stderr,"Error: out of memory (sr_vns_poll)\n");
+            return -1;
+        }
+        sr->rxlen = 0;
+        fcntl(sr->sockfd, F_SETFL, fcntl(sr->sockfd, F_GETFL) | O_NONBLOCK);
+    }
+
+    if ( timeout != 0 )
+    {
+        pfd.fd = sr->sockfd;
+        pfd.events = POLLIN;
+        if ( poll(&pfd, 1, timeout) == -1 )
+        {
+            if ( errno == EINTR )
+            { return 1; }
+            perror("poll(..):sr_vns_comm.c::sr_vns_poll");
+            return -1;
+        }
+    }
+
+    return sr_read_from_server_batch(sr);
+} /* -- sr_vns_poll -- */
+
+static int sr_vns_fd(struct sr_instance* sr)
+{
+    return sr->sockfd;
+} /* -- sr_vns_fd -- */
+
+static void sr_vns_close(struct sr_instance* sr)
+{
+    sr_vns_flush(sr);
+    if ( sr->rxbuf )
+    { free(sr->rxbuf); }
+    sr->rxbuf = 0;
+    sr->rxlen = 0;
+} /* -- sr_vns_close -- */
+
+/* The VNS server connection is opened by sr_connect_to_server, before the
+   routing table is loaded, so there is no open hook. */
+struct sr_io_ops sr_io_vns =
+{
+    "vns",
+    0,
+    sr_vns_poll,
+    sr_vns_fd,
+    sr_vns_send,
+    sr_vns_flush,
+    sr_vns_close
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   const char* iface, int dir )
+{
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(!sr->capture)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- the capture thread does the writing -- */
+    sr_capture_packet(sr, buf, (unsigned int)len, iface, dir);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -0,0 +1,1034 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_vnsgen.c
+ *
+ * Description:
+ *
+ * Local stand-in for the VNS server with a traffic generator, to load
+ * test the real sr binary end to end on one host (make sr_vnsgen).
+ *
+ *   sr_vnsgen [-p port] [-I ifaces] [-r rtable] [-k auth_key]
+ *             [-f from:to,...] [-n flows] [-l len] [-P capture]
+ *             [-R pps] [-w window] [-t secs] [-x]
+ *
+ * It listens for sr (sr -s localhost -p port), authenticates it (against
+ * -k if given, else anyone), answers VNSOPEN with a VNSHWINFO built from
+ * the interfaces file, and VNS_OPEN_TEMPLATE with VNS_RTABLE (-r) first.
+ * Each line of the interfaces file, "name ip mac host-ip host-mac", is a
+ * router interface and the one host behind it; the generator plays the
+ * hosts, answering the router's ARP requests for them.
+ *
+ * Traffic is UDP from the host behind 'from' to the host behind 'to'
+ * for every -f pair, -n flows per pair (by source port), frames of -l
+ * bytes; or, with -P, the frames of a pcap that came in to a router.
+ * Every IPv4 frame sent gets a sequence number in its IP id and a send
+ * time, so the frames the router forwards back can be matched for loss
+ * and latency.  No more than -w of them are in flight at once, so that
+ * sending as fast as possible measures the router rather than how deep
+ * the socket buffers are.  After a warm-up pass that lets the router
+ * resolve its next hops, frames are sent for -t seconds at -R frames per
+ * second (0 = as fast as the connection takes them), the stragglers are
+ * waited for, and throughput, loss and latency percentiles are printed.
+ * The session is then closed, which stops sr, unless -x keeps it open
+ * for another run.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "vnscommand.h"
+#include "sha1.h"
+
+#define VG_IFACES       16
+#define VG_NAMELEN      16
+#define VG_FRAME_MAX    1514
+#define VG_TXBUF        (256 * 1024)
+#define VG_RXBUF        (1024 * 1024)
+#define VG_BATCH        64          /* frames built per round */
+#define VG_SEQ          65536       /* send times kept, one per IP id */
+#define VG_HIST_NS      50          /* latency histogram resolution */
+#define VG_HIST         (1024 * 1024)
+#define VG_WINDOW       4096        /* frames in flight, by default */
+#define VG_STALL_MS     100         /* none back for this long: lost */
+#define VG_WARMUP_MS    1000
+#define VG_DRAIN_MS     500
+#define VG_AUTH_KEY_LEN 64
+#define VG_SHA1_LEN     20
+
+struct vg_iface
+{
+    char name[VG_NAMELEN];
+    uint32_t ip;                    /* network order */
+    uint8_t mac[ETHER_ADDR_LEN];
+    uint32_t host_ip;               /* the host behind it */
+    uint8_t host_mac[ETHER_ADDR_LEN];
+};
+
+struct vg_frame
+{
+    uint8_t data[VG_FRAME_MAX];
+    unsigned int len;
+    int iface;                      /* sent as arriving on */
+};
+
+struct vg
+{
+    int fd;
+    struct vg_iface ifs[VG_IFACES];
+    int nifs;
+    struct vg_frame* frames;        /* what is sent, in turn */
+    unsigned int nframes;
+    unsigned int next;
+
+    uint8_t* tx;                    /* VNS messages on their way out */
+    size_t txlen, txoff;
+    uint8_t* rx;
+    size_t rxlen;
+    int closed;
+
+    uint16_t seq;
+    uint64_t sent_ns[VG_SEQ];       /* 0 = nothing outstanding */
+
+    unsigned long window;
+    unsigned long sent, sent_bytes;
+    unsigned long numbered;         /* of those sent, the IPv4 frames */
+    unsigned long given_up;         /* numbered, and taken for lost */
+    unsigned long received, received_bytes;
+    unsigned long stray;            /* forwarded, but not outstanding */
+    unsigned long other;            /* anything else from the router */
+    unsigned long arps;             /* ARP requests answered */
+    uint32_t* hist;
+    unsigned long over;             /* latencies past the histogram */
+    uint64_t lat_max;
+};
+
+static uint64_t vg_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- vg_now -- */
+
+static uint16_t vg_cksum(const void* data, int len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t sum = 0;
+
+    for ( ; len > 1; len -= 2, p += 2 )
+    { sum += (p[0] << 8) | p[1]; }
+    if ( len )
+    { sum += p[0] << 8; }
+    while ( sum >> 16 )
+    { sum = (sum & 0xffff) + (sum >> 16); }
+    return htons(~sum & 0xffff);
+} /* -- vg_cksum -- */
+
+static int vg_parse_mac(const char* s, uint8_t* mac)
+{
+    unsigned int m[ETHER_ADDR_LEN];
+    int i;
+
+    if ( sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6 )
+    { return -1; }
+    for ( i = 0; i < ETHER_ADDR_LEN; i++ )
+    { mac[i] = (uint8_t)m[i]; }
+    return 0;
+} /* -- vg_parse_mac -- */
+
+/*---------------------------------------------------------------------
+ * Method: vg_load_ifaces(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int vg_load_ifaces(struct vg* g, const char* path)
+{
+    FILE* fp;
+    char line[256], name[64], ip[64], mac[64], hip[64], hmac[64];
+    struct in_addr a, h;
+    struct vg_iface* i;
+    int lineno = 0;
+
+    if ( (fp = fopen(path, "r")) == 0 )
+    {
+        perror(path);
+        return -1;
+    }
+    while ( fgets(line, sizeof(line), fp) )
+    {
+        lineno++;
+        if ( line[0] == '#' || sscanf(line, "%63s", name) != 1 )
+        { continue; }
+        i = &g->ifs[g->nifs];
+        if ( g->nifs == VG_IFACES ||
+             sscanf(line, "%63s %63s %63s %63s %63s", name, ip, mac, hip, hmac) != 5 ||
+             strlen(name) >= VG_NAMELEN || inet_aton(ip, &a) == 0 ||
+             inet_aton(hip, &h) == 0 || vg_parse_mac(mac, i->mac) != 0 ||
+             vg_parse_mac(hmac, i->host_mac) != 0 )
+        {
+            fprintf(stderr, "%s:%d: expected \"name ip mac host-ip host-mac\"\n",
+                    path, lineno);
+            fclose(fp);
+            return -1;
+        }
+        strcpy(i->name, name);
+        i->ip = a.s_addr;
+        i->host_ip = h.s_addr;
+        g->nifs++;
+    }
+    fclose(fp);
+    return g->nifs ? 0 : -1;
+} /* -- vg_load_ifaces -- */
+
+static int vg_iface_by_name(struct vg* g, const char* name)
+{
+    int i;
+
+    for ( i = 0; i < g->nifs; i++ )
+    {
+        if ( strncmp(g->ifs[i].name, name, VG_NAMELEN) == 0 )
+        { return i; }
+    }
+    return -1;
+} /* -- vg_iface_by_name -- */
+
+static struct vg_frame* vg_new_frame(struct vg* g)
+{
+    if ( (g->nframes & (g->nframes - 1)) == 0 )
+    {
+        g->frames = (struct vg_frame*)realloc(g->frames, (g->nframes ? g->nframes * 2 : 1) *
+                                              sizeof(struct vg_frame));
+        if ( g->frames == 0 )
+        {
+            perror("realloc(..):sr_vnsgen.c::vg_new_frame");
+            exit(1);
+        }
+    }
+    memset(&g->frames[g->nframes], 0, sizeof(struct vg_frame));
+    return &g->frames[g->nframes++];
+} /* -- vg_new_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: vg_make_flows(..)
+ * Scope:  Local
+ *
+ * UDP frames of 'len' bytes for 'nflows' flows per "from:to" pair.
+ *
+ *---------------------------------------------------------------------*/
+
+static int vg_make_flows(struct vg* g, char* pairs, int nflows, unsigned int len)
+{
+    struct sr_ethernet_hdr* e;
+    struct sr_ip_hdr* ip;
+    struct vg_frame* f;
+    uint16_t* udp;
+    char* pair;
+    char* to;
+    int a, b, k;
+
+    for ( pair = strtok(pairs, ","); pair; pair = strtok(0, ",") )
+    {
+        if ( (to = strchr(pair, ':')) == 0 )
+        {
+            fprintf(stderr, "Expected from:to, got %s\n", pair);
+            return -1;
+        }
+        *to++ = 0;
+        if ( (a = vg_iface_by_name(g, pair)) < 0 || (b = vg_iface_by_name(g, to)) < 0 )
+        {
+            fprintf(stderr, "Unknown interface in %s:%s\n", pair, to);
+            return -1;
+        }
+        for ( k = 0; k < nflows; k++ )
+        {
+            f = vg_new_frame(g);
+            f->len = len;
+            f->iface = a;
+            e = (struct sr_ethernet_hdr*)f->data;
+            memcpy(e->ether_dhost, g->ifs[a].mac, ETHER_ADDR_LEN);
+            memcpy(e->ether_shost, g->ifs[a].host_mac, ETHER_ADDR_LEN);
+            e->ether_type = htons(ethertype_ip);
+
+            ip = (struct sr_ip_hdr*)(f->data + sizeof(struct sr_ethernet_hdr));
+            ip->ip_v = 4;
+            ip->ip_hl = 5;
+            ip->ip_len = htons(len - sizeof(struct sr_ethernet_hdr));
+            ip->ip_ttl = 64;
+            ip->ip_p = ip_protocol_udp;
+            ip->ip_src = g->ifs[a].host_ip;
+            ip->ip_dst = g->ifs[b].host_ip;
+
+            udp = (uint16_t*)((uint8_t*)ip + sizeof(struct sr_ip_hdr));
+            udp[0] = htons(10000 + k);
+            udp[1] = htons(20000);
+            udp[2] = htons(len - sizeof(struct sr_ethernet_hdr) - sizeof(struct sr_ip_hdr));
+            udp[3] = 0;
+        }
+    }
+    return 0;
+} /* -- vg_make_flows -- */
+
+/* The interface a captured frame comes in on: the one it is addressed
+   to, else the one whose host sent it, else (an ARP request) the one it
+   asks for; -1 for what the router sent itself. */
+static int vg_pcap_iface(struct vg* g, const uint8_t* p, unsigned int len)
+{
+    const struct sr_ethernet_hdr* e = (const struct sr_ethernet_hdr*)p;
+    const struct sr_arp_hdr* a = (const struct sr_arp_hdr*)(p + sizeof(*e));
+    const struct sr_ip_hdr* ip = (const struct sr_ip_hdr*)(p + sizeof(*e));
+    uint32_t src = 0, dst = 0;
+    int i;
+
+    if ( ntohs(e->ether_type) == ethertype_arp && len >= sizeof(*e) + sizeof(*a) )
+    {
+        src = a->ar_sip;
+        dst = a->ar_tip;
+    }
+    else if ( ntohs(e->ether_type) == ethertype_ip && len >= sizeof(*e) + sizeof(*ip) )
+    { src = ip->ip_src; }
+
+    for ( i = 0; i < g->nifs; i++ )
+    {
+        if ( memcmp(e->ether_shost, g->ifs[i].mac, ETHER_ADDR_LEN) == 0 ||
+             (src && src == g->ifs[i].ip) )
+        { return -1; }
+    }
+    for ( i = 0; i < g->nifs; i++ )
+    {
+        if ( memcmp(e->ether_dhost, g->ifs[i].mac, ETHER_ADDR_LEN) == 0 )
+        { return i; }
+    }
+    for ( i = 0; i < g->nifs; i++ )
+    {
+        if ( (src && src == g->ifs[i].host_ip) || (dst && dst == g->ifs[i].ip) )
+        { return i; }
+    }
+    return -1;
+} /* -- vg_pcap_iface -- */
+
+static uint32_t vg_swap32(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+} /* -- vg_swap32 -- */
+
+/*---------------------------------------------------------------------
+ * Method: vg_load_pcap(..)
+ * Scope:  Local
+ *
+ * The frames of a legacy pcap that came in to a router, readdressed to
+ * this topology: from the host behind the interface they arrive on, to
+ * that interface (or still broadcast).  A capture sr took (-l) can so be
+ * played back at it, and one taken on another topology with the same
+ * addressing.
+ *
+ *---------------------------------------------------------------------*/
+
+static int vg_load_pcap(struct vg* g, const char* path)
+{
+    FILE* fp;
+    uint32_t h[6], r[4];
+    uint8_t data[65536];
+    struct sr_ethernet_hdr* e;
+    struct sr_arp_hdr* a;
+    struct vg_frame* f;
+    int i, swap;
+
+    if ( (fp = fopen(path, "rb")) == 0 )
+    {
+        perror(path);
+        return -1;
+    }
+    if ( fread(h, sizeof(h), 1, fp) != 1 ||
+         (h[0] != 0xa1b2c3d4 && h[0] != 0xa1b23c4d &&
+          vg_swap32(h[0]) != 0xa1b2c3d4 && vg_swap32(h[0]) != 0xa1b23c4d) )
+    {
+        fprintf(stderr, "%s: not a pcap file\n", path);
+        fclose(fp);
+        return -1;
+    }
+    swap = h[0] != 0xa1b2c3d4 && h[0] != 0xa1b23c4d;
+
+    while ( fread(r, sizeof(r), 1, fp) == 1 )
+    {
+        if ( swap )
+        { r[2] = vg_swap32(r[2]); }
+        if ( r[2] > sizeof(data) || fread(data, 1, r[2], fp) != r[2] )
+        { break; }
+        if ( r[2] < sizeof(struct sr_ethernet_hdr) || r[2] > VG_FRAME_MAX ||
+             (i = vg_pcap_iface(g, data, r[2])) < 0 )
+        { continue; }
+
+        f = vg_new_frame(g);
+        memcpy(f->data, data, r[2]);
+        f->len = r[2];
+        f->iface = i;
+        e = (struct sr_ethernet_hdr*)f->data;
+        if ( !(e->ether_dhost[0] & 1) )
+        { memcpy(e->ether_dhost, g->ifs[i].mac, ETHER_ADDR_LEN); }
+        memcpy(e->ether_shost, g->ifs[i].host_mac, ETHER_ADDR_LEN);
+        a = (struct sr_arp_hdr*)(e + 1);
+        if ( ntohs(e->ether_type) == ethertype_arp &&
+             r[2] >= sizeof(*e) + sizeof(*a) && a->ar_sip == g->ifs[i].host_ip )
+        { memcpy(a->ar_sha, g->ifs[i].host_mac, ETHER_ADDR_LEN); }
+    }
+    fclose(fp);
+    return g->nframes ? 0 : -1;
+} /* -- vg_load_pcap -- */
+
+/* ----------------------------------------------------------------------------
+ * The connection
+ * -------------------------------------------------------------------------- */
+
+/* Queue a VNS message: a header of 'type' followed by 'len' bytes. */
+static uint8_t* vg_msg(struct vg* g, uint32_t type, unsigned int len)
+{
+    uint8_t* m;
+    uint32_t v;
+
+    if ( g->txlen + 8 + len > VG_TXBUF )
+    { return 0; }
+    m = g->tx + g->txlen;
+    v = htonl(8 + len);
+    memcpy(m, &v, 4);
+    v = htonl(type);
+    memcpy(m + 4, &v, 4);
+    g->txlen += 8 + len;
+    return m + 8;
+} /* -- vg_msg -- */
+
+/* Write out what is queued. Returns -1 when the connection failed. */
+static int vg_flush(struct vg* g, int wait)
+{
+    ssize_t n;
+
+    while ( g->txoff < g->txlen )
+    {
+        n = send(g->fd, g->tx + g->txoff, g->txlen - g->txoff,
+                 wait ? 0 : MSG_DONTWAIT);
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            { break; }
+            perror("send(..):sr_vnsgen.c::vg_flush");
+            return -1;
+        }
+        g->txoff += n;
+    }
+    if ( g->txoff == g->txlen )
+    { g->txoff = g->txlen = 0; }
+    else if ( g->txoff > VG_TXBUF / 2 )
+    {
+        memmove(g->tx, g->tx + g->txoff, g->txlen - g->txoff);
+        g->txlen -= g->txoff;
+        g->txoff = 0;
+    }
+    return 0;
+} /* -- vg_flush -- */
+
+/* Read one whole message, blocking, during the handshake. Returns its
+   type and leaves it at g->rx, or -1. */
+static int vg_read_msg(struct vg* g)
+{
+    uint32_t len, type;
+    size_t got = 0;
+    ssize_t n;
+
+    while ( got < 8 || got < len )
+    {
+        n = recv(g->fd, g->rx + got, (got < 8 ? 8 : len) - got, 0);
+        if ( n <= 0 )
+        {
+            if ( n < 0 && errno == EINTR )
+            { continue; }
+            fprintf(stderr, "Router closed the connection during the handshake\n");
+            return -1;
+        }
+        got += n;
+        if ( got >= 4 )
+        {
+            memcpy(&len, g->rx, 4);
+            len = ntohl(len);
+            if ( len < 8 || len > VG_RXBUF )
+            { return -1; }
+        }
+    }
+    memcpy(&type, g->rx + 4, 4);
+    return ntohl(type);
+} /* -- vg_read_msg -- */
+
+/*---------------------------------------------------------------------
+ * Method: vg_handshake(..)
+ * Scope:  Local
+ *
+ * What the VNS server does for a new client: authenticate it, wait for
+ * it to open a topology and describe the hardware (and for a template,
+ * send the routing table first).
+ *
+ *---------------------------------------------------------------------*/
+
+static int vg_handshake(struct vg* g, const char* keyfile, const char* rtable)
+{
+    char key[VG_AUTH_KEY_LEN + 1];
+    uint8_t salt[8];
+    uint8_t* m;
+    c_auth_reply* ar;
+    c_open_template* ot;
+    c_hw_entry* hw;
+    SHA1Context sha1;
+    FILE* fp;
+    long size;
+    uint32_t ulen, v;
+    int i, type, ok = 1;
+
+    for ( i = 0; i < (int)sizeof(salt); i++ )
+    { salt[i] = (uint8_t)rand(); }
+    memcpy(vg_msg(g, VNS_AUTH_REQUEST, sizeof(salt)), salt, sizeof(salt));
+    if ( vg_flush(g, 1) != 0 || (type = vg_read_msg(g)) != VNS_AUTH_REPLY )
+    {
+        fprintf(stderr, "Expected an authentication reply\n");
+        return -1;
+    }
+
+    ar = (c_auth_reply*)g->rx;
+    ulen = ntohl(ar->usernameLen);
+    if ( ulen > ntohl(ar->mLen) - sizeof(c_auth_reply) - VG_SHA1_LEN )
+    { return -1; }
+    fprintf(stderr, "Router of %.*s connected\n", (int)ulen, ar->username);
+
+    if ( keyfile )
+    {
+        if ( (fp = fopen(keyfile, "r")) == 0 || fgets(key, sizeof(key), fp) != key )
+        {
+            perror(keyfile);
+            return -1;
+        }
+        fclose(fp);
+        SHA1Reset(&sha1);
+        SHA1Input(&sha1, salt, sizeof(salt));
+        SHA1Input(&sha1, (unsigned char*)key, VG_AUTH_KEY_LEN);
+        SHA1Result(&sha1);
+        for ( i = 0; i < 5; i++ )
+        {
+            v = htonl(sha1.Message_Digest[i]);
+            if ( memcmp(&v, ar->username + ulen + i * 4, 4) != 0 )
+            { ok = 0; }
+        }
+    }
+    m = vg_msg(g, VNS_AUTH_STATUS, 1 + 16);
+    m[0] = ok;
+    strcpy((char*)m + 1, ok ? "welcome" : "bad credentials");
+    if ( !ok )
+    { fprintf(stderr, "Router's credentials do not match %s\n", keyfile); }
+    if ( vg_flush(g, 1) != 0 || !ok )
+    { return -1; }
+
+    /* -- the topology: a template gets its routing table first -- */
+    type = vg_read_msg(g);
+    if ( type == VNS_OPEN_TEMPLATE )
+    {
+        ot = (c_open_template*)g->rx;
+        if ( rtable == 0 || (fp = fopen(rtable, "r")) == 0 )
+        {
+            fprintf(stderr, "Template %.30s needs a routing table (-r)\n", ot->templateName);
+            return -1;
+        }
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        rewind(fp);
+        if ( (m = vg_msg(g, VNS_RTABLE, IDSIZE + size)) == 0 ||
+             fread(m + IDSIZE, 1, size, fp) != (size_t)size )
+        {
+            fclose(fp);
+            return -1;
+        }
+        fclose(fp);
+        memcpy(m, ot->mVirtualHostID, IDSIZE);
+    }
+    else if ( type != VNSOPEN )
+    {
+        fprintf(stderr, "Expected the router to open a topology\n");
+        return -1;
+    }
+
+    hw = (c_hw_entry*)vg_msg(g, VNSHWINFO, g->nifs * 3 * sizeof(c_hw_entry));
+    memset(hw, 0, g->nifs * 3 * sizeof(c_hw_entry));
+    for ( i = 0; i < g->nifs; i++, hw += 3 )
+    {
+        hw[0].mKey = htonl(HWINTERFACE);
+        strcpy(hw[0].value, g->ifs[i].name);
+        hw[1].mKey = htonl(HWETHER);
+        memcpy(hw[1].value, g->ifs[i].mac, ETHER_ADDR_LEN);
+        hw[2].mKey = htonl(HWETHIP);
+        memcpy(hw[2].value, &g->ifs[i].ip, 4);
+    }
+    return vg_flush(g, 1);
+} /* -- vg_handshake -- */
+
+/* ----------------------------------------------------------------------------
+ * Traffic
+ * -------------------------------------------------------------------------- */
+
+/* Queue the next frame, numbered and stamped. Returns -1 if there is no
+   room for it now. */
+static int vg_send_next(struct vg* g)
+{
+    struct vg_frame* f = &g->frames[g->next];
+    struct sr_ip_hdr* ip;
+    uint8_t* m;
+
+    if ( (m = vg_msg(g, VNSPACKET, VG_NAMELEN + f->len)) == 0 )
+    { return -1; }
+    memset(m, 0, VG_NAMELEN);
+    strcpy((char*)m, g->ifs[f->iface].name);
+    memcpy(m + VG_NAMELEN, f->data, f->len);
+
+    ip = (struct sr_ip_hdr*)(m + VG_NAMELEN + sizeof(struct sr_ethernet_hdr));
+    if ( f->len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) &&
+         ntohs(((struct sr_ethernet_hdr*)(m + VG_NAMELEN))->ether_type) == ethertype_ip &&
+         f->len >= sizeof(struct sr_ethernet_hdr) + ip->ip_hl * 4 )
+    {
+        ip->ip_id = htons(g->seq);
+        ip->ip_sum = 0;
+        ip->ip_sum = vg_cksum(ip, ip->ip_hl * 4);
+        g->sent_ns[g->seq++] = vg_now();
+        g->numbered++;
+    }
+
+    g->sent++;
+    g->sent_bytes += f->len;
+    g->next = (g->next + 1) % g->nframes;
+    return 0;
+} /* -- vg_send_next -- */
+
+/* Play the host behind 'i' answering the router's ARP request */
+static void vg_arp_reply(struct vg* g, int i, const struct sr_arp_hdr* req)
+{
+    struct sr_ethernet_hdr* e;
+    struct sr_arp_hdr* a;
+    uint8_t* m;
+
+    if ( (m = vg_msg(g, VNSPACKET, VG_NAMELEN + sizeof(*e) + sizeof(*a))) == 0 )
+    { return; }
+    memset(m, 0, VG_NAMELEN);
+    strcpy((char*)m, g->ifs[i].name);
+    e = (struct sr_ethernet_hdr*)(m + VG_NAMELEN);
+    a = (struct sr_arp_hdr*)(e + 1);
+    memcpy(e->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+    memcpy(e->ether_shost, g->ifs[i].host_mac, ETHER_ADDR_LEN);
+    e->ether_type = htons(ethertype_arp);
+    a->ar_hrd = htons(arp_hrd_ethernet);
+    a->ar_pro = htons(ethertype_ip);
+    a->ar_hln = ETHER_ADDR_LEN;
+    a->ar_pln = 4;
+    a->ar_op = htons(arp_op_reply);
+    memcpy(a->ar_sha, g->ifs[i].host_mac, ETHER_ADDR_LEN);
+    a->ar_sip = g->ifs[i].host_ip;
+    memcpy(a->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+    a->ar_tip = req->ar_sip;
+    g->arps++;
+} /* -- vg_arp_reply -- */
+
+/*---------------------------------------------------------------------
+ * Method: vg_frame_in(..)
+ * Scope:  Local
+ *
+ * A frame the router sent out of interface 'name'.
+ *
+ *---------------------------------------------------------------------*/
+
+static void vg_frame_in(struct vg* g, const char* name, const uint8_t* p, unsigned int len,
+                        uint64_t now)
+{
+    const struct sr_ethernet_hdr* e = (const struct sr_ethernet_hdr*)p;
+    const struct sr_arp_hdr* a = (const struct sr_arp_hdr*)(p + sizeof(*e));
+    const struct sr_ip_hdr* ip = (const struct sr_ip_hdr*)(p + sizeof(*e));
+    uint64_t t, lat;
+    uint16_t id;
+    int i;
+
+    if ( len < sizeof(*e) || (i = vg_iface_by_name(g, name)) < 0 )
+    {
+        g->other++;
+        return;
+    }
+
+    if ( ntohs(e->ether_type) == ethertype_arp && len >= sizeof(*e) + sizeof(*a) &&
+         ntohs(a->ar_op) == arp_op_request && a->ar_tip == g->ifs[i].host_ip )
+    {
+        vg_arp_reply(g, i, a);
+        return;
+    }
+
+    if ( ntohs(e->ether_type) != ethertype_ip || len < sizeof(*e) + sizeof(*ip) ||
+         memcmp(e->ether_dhost, g->ifs[i].host_mac, ETHER_ADDR_LEN) != 0 )
+    {
+        g->other++;
+        return;
+    }
+
+    id = ntohs(ip->ip_id);
+    if ( (t = g->sent_ns[id]) == 0 )
+    {
+        g->stray++;
+        return;
+    }
+    g->sent_ns[id] = 0;
+    g->received++;
+    g->received_bytes += len;
+
+    lat = now - t;
+    if ( lat > g->lat_max )
+    { g->lat_max = lat; }
+    if ( lat / VG_HIST_NS < VG_HIST )
+    { g->hist[lat / VG_HIST_NS]++; }
+    else
+    { g->over++; }
+} /* -- vg_frame_in -- */
+
+/* Take in whatever the router sent. Returns the number of frames, -1
+   once the connection is gone. */
+static int vg_receive(struct vg* g)
+{
+    uint32_t len, type;
+    size_t off = 0;
+    ssize_t n;
+    uint64_t now;
+    int frames = 0;
+
+    n = recv(g->fd, g->rx + g->rxlen, VG_RXBUF - g->rxlen, MSG_DONTWAIT);
+    if ( n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) )
+    {
+        g->closed = 1;
+        return -1;
+    }
+    if ( n < 0 )
+    { return 0; }
+    g->rxlen += n;
+
+    now = vg_now();
+    while ( g->rxlen - off >= 8 )
+    {
+        memcpy(&len, g->rx + off, 4);
+        len = ntohl(len);
+        if ( len < 8 || len > VG_RXBUF )
+        {
+            fprintf(stderr, "Bad message length %u from the router\n", len);
+            g->closed = 1;
+            return -1;
+        }
+        if ( g->rxlen - off < len )
+        { break; }
+        memcpy(&type, g->rx + off + 4, 4);
+        if ( ntohl(type) == VNSPACKET && len >= sizeof(c_packet_header) )
+        {
+            vg_frame_in(g, (const char*)(g->rx + off + 8), g->rx + off + sizeof(c_packet_header),
+                        len - sizeof(c_packet_header), now);
+            frames++;
+        }
+        off += len;
+    }
+    memmove(g->rx, g->rx + off, g->rxlen - off);
+    g->rxlen -= off;
+    return frames;
+} /* -- vg_receive -- */
+
+/* Numbered frames neither back nor given up for lost */
+static unsigned long vg_in_flight(struct vg* g)
+{
+    unsigned long done = g->received + g->given_up;
+
+    return g->numbered > done ? g->numbered - done : 0;
+} /* -- vg_in_flight -- */
+
+/*---------------------------------------------------------------------
+ * Method: vg_run(..)
+ * Scope:  Local
+ *
+ * Send for 'ns', 'pps' frames a second or as fast as possible, then wait
+ * 'drain_ns' for the rest to come back.
+ *
+ *---------------------------------------------------------------------*/
+
+static void vg_run(struct vg* g, uint64_t ns, unsigned long pps, uint64_t drain_ns,
+                   unsigned long limit)
+{
+    struct pollfd pfd;
+    uint64_t start = vg_now(), now, due, last = start;
+    unsigned long sent0 = g->sent, back = g->received + g->stray;
+    int i, busy;
+
+    pfd.fd = g->fd;
+    while ( !g->closed )
+    {
+        now = vg_now();
+        busy = 0;
+        if ( now - start < ns && (limit == 0 || g->sent - sent0 < limit) )
+        {
+            due = pps ? (now - start) * pps / 1000000000ULL + 1 - (g->sent - sent0)
+                      : VG_BATCH;
+            if ( limit && due > limit - (g->sent - sent0) )
+            { due = limit - (g->sent - sent0); }
+            for ( i = 0; i < VG_BATCH && (uint64_t)i < due; i++ )
+            {
+                if ( vg_in_flight(g) >= g->window || vg_send_next(g) != 0 )
+                { break; }
+            }
+            busy = i > 0;
+
+            /* -- a full window that nothing comes back for: give it up -- */
+            if ( g->received + g->stray != back )
+            {
+                back = g->received + g->stray;
+                last = now;
+            }
+            else if ( !busy && now - last > (uint64_t)VG_STALL_MS * 1000000 )
+            {
+                g->given_up += vg_in_flight(g);
+                last = now;
+            }
+        }
+        else if ( now - start >= ns + drain_ns || g->received >= g->numbered )
+        {
+            if ( now - start >= ns || (limit && g->sent - sent0 >= limit) )
+            { break; }
+        }
+
+        if ( vg_flush(g, 0) != 0 )
+        { break; }
+        if ( vg_receive(g) > 0 )
+        { busy = 1; }
+
+        if ( !busy )
+        {
+            pfd.events = POLLIN | (g->txlen ? POLLOUT : 0);
+            poll(&pfd, 1, 1);
+        }
+    }
+    vg_flush(g, 1);
+} /* -- vg_run -- */
+
+static uint64_t vg_percentile(struct vg* g, double q)
+{
+    unsigned long want = (unsigned long)(q * (g->received - 1)), seen = 0;
+    unsigned long i;
+
+    for ( i = 0; i < VG_HIST; i++ )
+    {
+        seen += g->hist[i];
+        if ( seen > want )
+        { return i * VG_HIST_NS + VG_HIST_NS / 2; }
+    }
+    return g->lat_max;
+} /* -- vg_percentile -- */
+
+static void vg_reset(struct vg* g)
+{
+    memset(g->sent_ns, 0, sizeof(g->sent_ns));
+    memset(g->hist, 0, VG_HIST * sizeof(uint32_t));
+    g->sent = g->sent_bytes = 0;
+    g->numbered = g->given_up = 0;
+    g->received = g->received_bytes = 0;
+    g->stray = g->other = g->over = 0;
+    g->lat_max = 0;
+} /* -- vg_reset -- */
+
+static void vg_report(struct vg* g, double secs)
+{
+    fprintf(stderr, "sent      %lu frames in %.3f s, %.0f frames/s, %.1f Mbit/s\n",
+            g->sent, secs, g->sent / secs, g->sent_bytes * 8 / secs / 1e6);
+    fprintf(stderr, "received  %lu frames, %.0f frames/s, %.1f Mbit/s\n",
+            g->received, g->received / secs, g->received_bytes * 8 / secs / 1e6);
+    fprintf(stderr, "lost      %lu of %lu numbered (%.3f%%), %lu stray, %lu other frames, "
+            "%lu ARP replies\n",
+            g->numbered > g->received ? g->numbered - g->received : 0, g->numbered,
+            g->numbered > g->received ? 100.0 * (g->numbered - g->received) / g->numbered : 0.0,
+            g->stray, g->other, g->arps);
+    if ( g->received )
+    {
+        fprintf(stderr, "latency   p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+                "max %.1f us\n",
+                vg_percentile(g, 0.50) / 1e3, vg_percentile(g, 0.90) / 1e3,
+                vg_percentile(g, 0.99) / 1e3, vg_percentile(g, 0.999) / 1e3,
+                g->lat_max / 1e3);
+    }
+} /* -- vg_report -- */
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-p port] [-I ifaces] [-r rtable] [-k auth_key] \n", argv0);
+    printf("           [-f from:to,...] [-n flows] [-l len] [-P capture] \n");
+    printf("           [-R pps] [-w window] [-t secs] [-x] \n");
+    printf("   -I file of \"name ip mac host-ip host-mac\" lines (default ifaces) \n");
+    printf("   -r routing table sent to a router that opens a template \n");
+    printf("   -k checks the router's credentials against this key \n");
+    printf("   -f UDP from the host behind one interface to the host behind \n");
+    printf("      another (default the first two interfaces) \n");
+    printf("   -n flows per pair, by source port (default 1) \n");
+    printf("   -l frame length (default 64) \n");
+    printf("   -P sends the frames of a pcap instead \n");
+    printf("   -R frames per second, 0 = as fast as possible (default) \n");
+    printf("   -w frames in flight at most (default %d) \n", VG_WINDOW);
+    printf("   -t seconds to send for (default 5) \n");
+    printf("   -x keeps the session open afterwards \n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    struct vg* g;
+    struct sockaddr_in addr;
+    char* ifaces = "ifaces";
+    char* rtable = 0;
+    char* keyfile = 0;
+    char* pairs = 0;
+    char* pcap = 0;
+    char defpairs[2 * VG_NAMELEN + 2];
+    unsigned short port = 8888;
+    unsigned long pps = 0, window = VG_WINDOW;
+    unsigned int len = 64;
+    int nflows = 1, keep = 0, lfd, c, one = 1;
+    double secs = 5;
+    uint64_t t0, t1;
+    uint8_t* m;
+
+    while ( (c = getopt(argc, argv, "hp:I:r:k:f:n:l:P:R:w:t:x")) != EOF )
+    {
+        switch ( c )
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'I': ifaces = optarg; break;
+            case 'r': rtable = optarg; break;
+            case 'k': keyfile = optarg; break;
+            case 'f': pairs = optarg; break;
+            case 'n': nflows = atoi(optarg); break;
+            case 'l': len = atoi(optarg); break;
+            case 'P': pcap = optarg; break;
+            case 'R': pps = strtoul(optarg, NULL, 10); break;
+            case 'w': window = strtoul(optarg, NULL, 10); break;
+            case 't': secs = atof(optarg); break;
+            case 'x': keep = 1; break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if ( (g = (struct vg*)calloc(1, sizeof(struct vg))) == 0 ||
+         (g->tx = (uint8_t*)malloc(VG_TXBUF)) == 0 ||
+         (g->rx = (uint8_t*)malloc(VG_RXBUF)) == 0 ||
+         (g->hist = (uint32_t*)calloc(VG_HIST, sizeof(uint32_t))) == 0 )
+    { return 1; }
+    if ( window < 1 || window > VG_SEQ / 2 )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    g->window = window;
+    if ( vg_load_ifaces(g, ifaces) != 0 )
+    {
+        fprintf(stderr, "No interfaces in %s\n", ifaces);
+        return 1;
+    }
+
+    /* -- what to send -- */
+    if ( pcap )
+    {
+        if ( vg_load_pcap(g, pcap) != 0 )
+        {
+            fprintf(stderr, "%s: no frames into a router interface\n", pcap);
+            return 1;
+        }
+    }
+    else
+    {
+        if ( len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) + 8 ||
+             len > VG_FRAME_MAX || nflows < 1 || (pairs == 0 && g->nifs < 2) )
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        if ( pairs == 0 )
+        {
+            sprintf(defpairs, "%s:%s", g->ifs[0].name, g->ifs[1].name);
+            pairs = defpairs;
+        }
+        if ( vg_make_flows(g, pairs, nflows, len) != 0 )
+        { return 1; }
+    }
+
+    /* -- wait for the router -- */
+    srand(time(0));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ( (lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+         setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+         bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 1) != 0 )
+    {
+        perror("listen(..):sr_vnsgen.c::main");
+        return 1;
+    }
+    fprintf(stderr, "Waiting for sr -s localhost -p %u\n", port);
+    if ( (g->fd = accept(lfd, 0, 0)) < 0 )
+    {
+        perror("accept(..):sr_vnsgen.c::main");
+        return 1;
+    }
+    close(lfd);
+    setsockopt(g->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if ( vg_handshake(g, keyfile, rtable) != 0 )
+    { return 1; }
+
+    /* -- warm-up: one of each, until the router knows its next hops -- */
+    vg_run(g, (uint64_t)VG_WARMUP_MS * 1000000, 0, 0, g->nframes);
+    vg_run(g, 0, 0, (uint64_t)VG_WARMUP_MS * 1000000, 0);
+    if ( g->closed )
+    {
+        fprintf(stderr, "Router closed the connection\n");
+        return 1;
+    }
+    fprintf(stderr, "warm-up   %lu of %lu frames back\n", g->received, g->sent);
+    vg_reset(g);
+
+    t0 = vg_now();
+    vg_run(g, (uint64_t)(secs * 1e9), pps, (uint64_t)VG_DRAIN_MS * 1000000, 0);
+    t1 = vg_now();
+    vg_report(g, secs < (t1 - t0) / 1e9 ? secs : (t1 - t0) / 1e9);
+
+    if ( !keep && !g->closed )
+    {
+        m = vg_msg(g, VNSCLOSE, 256);
+        memset(m, 0, 256);
+        strcpy((char*)m, "load test finished");
+        vg_flush(g, 1);
+    }
+    else if ( keep )
+    {
+        fprintf(stderr, "Keeping the session open, interrupt to end it\n");
+        while ( !g->closed )
+        {
+            vg_flush(g, 0);
+            if ( vg_receive(g) == 0 )
+            { usleep(1000); }
+        }
+    }
+    close(g->fd);
+    return 0;
+} /* -- main -- */
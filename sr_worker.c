@@ -0,0 +1,1085 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.c
+ *
+ * Description:
+ *
+ * Flow-sharded forwarding workers, see sr_worker.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_io.h"
+#include "sr_worker.h"
+#include "sr_numa.h"
+
+__thread struct sr_worker* sr_worker_self = 0;
+
+/* Set on the TX thread, whose frames go out through its own queue. */
+static __thread struct sr_txstage* sr_txstage_self = 0;
+
+/* Serialises writes to the VNS socket, which every worker's transmit
+   queue and sr->txq share. */
+static pthread_mutex_t sr_worker_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set on the thread that dispatches, so batch ends seen by others (the
+   ARP sweeper) leave the open vectors alone. */
+static __thread int sr_sched_dispatcher = 0;
+
+#define SR_HASH_MUL 0x9e3779b1U
+
+/*---------------------------------------------------------------------
+ * Method: sr_sleeper_wake(..)
+ * Scope:  Local
+ *
+ * Called after publishing work. The fence pairs with the one in
+ * sr_sleeper_sleep: either the sleeper sees the work, or we see it
+ * asleep and post.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_sleeper_wake(struct sr_sleeper* s)
+{
+    int sleeping = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( __atomic_load_n(&s->sleeping, __ATOMIC_RELAXED) &&
+         __atomic_compare_exchange_n(&s->sleeping, &sleeping, 0, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+    { sem_post(&s->sem); }
+} /* -- sr_sleeper_wake -- */
+
+/* Sleep until woken, unless 'has_work' finds work after announcing it. */
+static void sr_sleeper_sleep(struct sr_sleeper* s, int (*has_work)(void*), void* arg)
+{
+    __atomic_store_n(&s->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( !has_work(arg) )
+    {
+        while ( sem_wait(&s->sem) == -1 && errno == EINTR );
+    }
+    __atomic_store_n(&s->sleeping, 0, __ATOMIC_RELAXED);
+} /* -- sr_sleeper_sleep -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_hash(..)
+ * Scope:  Global
+ *
+ * Ports are left out for fragments, since only the first one carries
+ * them and every fragment of a datagram must land on the same worker.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_flow_hash(const uint8_t* packet, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)packet;
+    const sr_ip_hdr_t* ip;
+    unsigned int hl;
+    uint32_t h, ports;
+
+    if ( len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+         eth->ether_type != htons(ethertype_ip) )
+    { return 0; }
+
+    ip = (const sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    h = ip->ip_src;
+    h = h * SR_HASH_MUL ^ ip->ip_dst;
+    h = h * SR_HASH_MUL ^ ip->ip_p;
+
+    hl = ip->ip_hl * 4;
+    if ( (ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+         (ip->ip_off & htons(IP_MF | IP_OFFMASK)) == 0 &&
+         len >= sizeof(sr_ethernet_hdr_t) + hl + 4 )
+    {
+        memcpy(&ports, packet + sizeof(sr_ethernet_hdr_t) + hl, 4);
+        h = h * SR_HASH_MUL ^ ports;
+    }
+
+    /* -- final avalanche, so that 'h % n' uses every bit -- */
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return h;
+} /* -- sr_flow_hash -- */
+
+struct sr_txq* sr_worker_txq(struct sr_instance* sr)
+{
+    if ( sr_worker_self )
+    { return &sr_worker_self->txq; }
+    if ( sr_txstage_self )
+    { return &sr_txstage_self->txq; }
+    return &sr->txq;
+} /* -- sr_worker_txq -- */
+
+/* Take back the vectors (and their frames) the workers are done with. */
+static void sr_sched_collect(struct sr_sched* s)
+{
+    struct sr_wvec* v;
+    unsigned int i;
+
+    v = __atomic_exchange_n(&s->done, (struct sr_wvec*)0, __ATOMIC_ACQUIRE);
+    for ( ; v; v = v->next )
+    {
+        for ( i = 0; i < v->n; i++ )
+        { s->free_frames[s->nfree_frames++] = v->frames[i]; }
+        v->n = 0;
+        s->free_vecs[s->nfree_vecs++] = v;
+    }
+} /* -- sr_sched_collect -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_sched_push(..)
+ * Scope:  Local
+ *
+ * Queue worker 't's open vector. If that leaves a backlog on its deque,
+ * also wake a sleeping worker that can steal from it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_sched_push(struct sr_instance* sr, int t)
+{
+    struct sr_sched* s = sr->sched;
+    struct sr_worker* w = sr->workers[t];
+    struct sr_worker* o;
+    int k;
+
+    /* -- cannot fail, every deque has room for all vectors -- */
+    sr_deque_push(&w->dq, s->open[t]);
+    s->open[t] = 0;
+    sr_sleeper_wake(&w->wake);
+
+    if ( sr->dispatch == SR_DISPATCH_SPRAY )
+    { s->spray = (t + 1) % sr->nworkers; }
+
+    if ( sr_deque_size(&w->dq) > 1 )
+    {
+        for ( k = 1; k < sr->nworkers; k++ )
+        {
+            o = sr->workers[(t + k) % sr->nworkers];
+            if ( __atomic_load_n(&o->wake.sleeping, __ATOMIC_RELAXED) )
+            {
+                sr_sleeper_wake(&o->wake);
+                break;
+            }
+        }
+    }
+} /* -- sr_sched_push -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_sched_dispatch(..)
+ * Scope:  Local
+ *
+ * -D steal: add the frame to the open vector of the worker owning its
+ * flow, and queue the vector once it is full. Partly filled vectors are
+ * queued at the end of the receive batch by sr_worker_dispatch_flush.
+ * -D spray fills one vector at a time and moves on to the next worker
+ * whenever one is queued.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_sched_dispatch(struct sr_instance* sr, const uint8_t* packet,
+                             unsigned int len, const char* iface)
+{
+    struct sr_sched* s = sr->sched;
+    struct sr_wframe* f;
+    struct sr_wvec* v;
+    uint32_t hash;
+    int t;
+
+    sr_sched_dispatcher = 1;
+
+    hash = sr_flow_hash(packet, len);
+    if ( sr->dispatch == SR_DISPATCH_SPRAY )
+    { t = s->spray; }
+    else
+    { t = hash % (uint32_t)sr->nworkers; }
+
+    if ( s->nfree_frames == 0 || (s->open[t] == 0 && s->nfree_vecs == 0) )
+    { sr_sched_collect(s); }
+    if ( len > SR_WORKER_FRAME_SZ || s->nfree_frames == 0 ||
+         (s->open[t] == 0 && s->nfree_vecs == 0) )
+    {
+        sr->workers[t]->drops++;
+        return -1;
+    }
+
+    if ( (v = s->open[t]) == 0 )
+    { v = s->open[t] = s->free_vecs[--s->nfree_vecs]; }
+
+    f = s->free_frames[--s->nfree_frames];
+    memcpy(f->data, packet, len);
+    f->len = len;
+    f->hash = hash;
+    if ( sr->reorder_us )
+    { f->seq = sr_reorder_stamp(sr->txstage->rob, hash); }
+    strncpy(f->iface, iface, sr_IFACE_NAMELEN);
+    v->frames[v->n++] = f;
+
+    if ( v->n == SR_WORKER_BURST )
+    { sr_sched_push(sr, t); }
+
+    return 0;
+} /* -- sr_sched_dispatch -- */
+
+static void sr_sched_flush(struct sr_instance* sr)
+{
+    int t;
+
+    for ( t = 0; t < sr->nworkers; t++ )
+    {
+        if ( sr->sched->open[t] )
+        { sr_sched_push(sr, t); }
+    }
+} /* -- sr_sched_flush -- */
+
+void sr_worker_dispatch_flush(struct sr_instance* sr)
+{
+    if ( sr->sched && sr_sched_dispatcher )
+    { sr_sched_flush(sr); }
+} /* -- sr_worker_dispatch_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_dispatch(..)
+ * Scope:  Global
+ *
+ * Called by the thread polling the backend. The frame is copied since
+ * the backend reuses its buffer as soon as the receive batch is done.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_worker_dispatch(struct sr_instance* sr, const uint8_t* packet,
+                       unsigned int len, const char* iface)
+{
+    struct sr_worker* w;
+    struct sr_wframe* f;
+    uint32_t hash;
+
+    if ( sr->sched )
+    { return sr_sched_dispatch(sr, packet, len, iface); }
+
+    hash = sr_flow_hash(packet, len);
+    w = sr->workers[hash % (uint32_t)sr->nworkers];
+
+    if ( len > SR_WORKER_FRAME_SZ ||
+         sr_ring_dequeue(&w->freeq, (void**)&f) != 0 )
+    {
+        w->drops++;
+        return -1;
+    }
+
+    memcpy(f->data, packet, len);
+    f->len = len;
+    f->hash = hash;
+    if ( sr->reorder_us )
+    { f->seq = sr_reorder_stamp(sr->txstage->rob, hash); }
+    strncpy(f->iface, iface, sr_IFACE_NAMELEN);
+
+    /* -- cannot fail, the ring has room for the whole pool -- */
+    sr_ring_enqueue(&w->rxq, f);
+
+    sr_sleeper_wake(&w->wake);
+
+    return 0;
+} /* -- sr_worker_dispatch -- */
+
+/* Give the TX pool frames the TX thread is done with back to 'w'. */
+static void sr_worker_reclaim(struct sr_worker* w)
+{
+    w->nspare += sr_ring_dequeue_burst(&w->txdone, (void**)(w->spare + w->nspare),
+                                       SR_WORKER_TXPOOL - w->nspare);
+} /* -- sr_worker_reclaim -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_send(..)
+ * Scope:  Global
+ *
+ * Copy the frame into a TX pool buffer and queue it for the TX thread.
+ * The copy keeps the sr_send_packet contract: callers may reuse or
+ * change their buffer as soon as it returns.
+ *
+ * With -R the frame carries the number of the input being forwarded and
+ * is held until the next send or the end of the input, so that the last
+ * frame for each input can be marked. Frames sent outside an input (for
+ * neighbor messages) have no place in any flow and go straight through.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_worker_send(struct sr_instance* sr, const uint8_t* buf,
+                   unsigned int len, const char* iface)
+{
+    struct sr_worker* w = sr_worker_self;
+    struct sr_wframe* f;
+
+    /* -- REQUIRES -- */
+    assert(w);
+
+    if ( w->nspare == 0 )
+    { sr_worker_reclaim(w); }
+    if ( w->nspare == 0 || len > SR_WORKER_FRAME_SZ )
+    {
+        w->tx_drops++;
+        return -1;
+    }
+
+    f = w->spare[--w->nspare];
+    memcpy(f->data, buf, len);
+    f->len = len;
+    strncpy(f->iface, iface, sr_IFACE_NAMELEN);
+
+    if ( sr->reorder_us && w->in_input )
+    {
+        f->hash = w->cur_hash;
+        f->seq = w->cur_seq;
+        f->last = 0;
+        if ( w->held == 0 )
+        {
+            w->held = f;
+            return 0;
+        }
+        sr_ring_enqueue(&w->txr, w->held);
+        w->held = f;
+    }
+    else
+    {
+        f->last = -1;
+        /* -- cannot fail, the ring has room for the whole TX pool -- */
+        sr_ring_enqueue(&w->txr, f);
+    }
+    sr_sleeper_wake(&sr->txstage->wake);
+
+    return 0;
+} /* -- sr_worker_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_send_done(..)
+ * Scope:  Local
+ *
+ * -R: the current input is forwarded. Mark its last output, or queue an
+ * empty frame if it had none, so the reorder stage can move past it. If
+ * the TX pool is empty the input is lost to the reorder stage, which
+ * gets over it when its wait times out.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_worker_send_done(struct sr_worker* w)
+{
+    struct sr_wframe* f = w->held;
+
+    w->in_input = 0;
+    if ( f == 0 )
+    {
+        if ( w->nspare == 0 )
+        { sr_worker_reclaim(w); }
+        if ( w->nspare == 0 )
+        {
+            w->tx_drops++;
+            return;
+        }
+        f = w->spare[--w->nspare];
+        f->len = 0;
+        f->hash = w->cur_hash;
+        f->seq = w->cur_seq;
+    }
+    f->last = 1;
+    w->held = 0;
+
+    sr_ring_enqueue(&w->txr, f);
+    sr_sleeper_wake(&w->sr->txstage->wake);
+} /* -- sr_worker_send_done -- */
+
+void sr_worker_kick(struct sr_worker* w)
+{
+    sr_sleeper_wake(&w->wake);
+} /* -- sr_worker_kick -- */
+
+static int sr_worker_has_work(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+
+    return sr_ring_count(&w->rxq) != 0 || sr_neigh_pending(w->neigh) ||
+           __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+} /* -- sr_worker_has_work -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_main(..)
+ * Scope:  Local
+ *
+ * Take bursts off the ring, forward them and flush what they produced.
+ * An idle worker spins briefly, then sleeps until the dispatcher posts.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_worker_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_instance* sr = w->sr;
+    struct sr_wframe* f;
+    void* burst[SR_WORKER_BURST];
+    sigset_t all;
+    unsigned int n, i, idle = 0;
+
+    /* -- signals are for the main thread (and its signalfd) -- */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    sr_worker_self = w;
+
+    while ( 1 )
+    {
+        /* -- neighbor updates first, they may release queued packets -- */
+        if ( sr_neigh_poll(sr, w->neigh) > 0 )
+        { idle = 0; }
+
+        n = sr_ring_dequeue_burst(&w->rxq, burst, SR_WORKER_BURST);
+
+        if ( n == 0 )
+        {
+            if ( __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) )
+            { break; }
+            if ( ++idle < SR_WORKER_SPIN )
+            {
+                sched_yield();
+                continue;
+            }
+
+            sr_sleeper_sleep(&w->wake, sr_worker_has_work, w);
+            idle = 0;
+            continue;
+        }
+        idle = 0;
+
+        for ( i = 0; i < n; i++ )
+        {
+            f = (struct sr_wframe*)burst[i];
+            if ( sr->reorder_us )
+            {
+                w->cur_hash = f->hash;
+                w->cur_seq = f->seq;
+                w->in_input = 1;
+            }
+            sr_deliver_packet(sr, f->data, f->len, f->iface);
+            if ( sr->reorder_us )
+            { sr_worker_send_done(w); }
+            sr_ring_enqueue(&w->freeq, f);
+        }
+        w->rx_pkts += n;
+        w->batches++;
+
+        /* -- end of this worker's batch -- */
+        sr_end_batch(sr);
+        if ( sr->pipeline )
+        { sr_worker_reclaim(w); }
+    }
+
+    sr_flush_packets(sr);
+
+    return NULL;
+} /* -- sr_worker_main -- */
+
+static int sr_worker_steal_has_work(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    int i;
+
+    if ( __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) || sr_neigh_pending(w->neigh) )
+    { return 1; }
+    for ( i = 0; i < w->sr->nworkers; i++ )
+    {
+        if ( sr_deque_size(&w->sr->workers[i]->dq) != 0 )
+        { return 1; }
+    }
+    return 0;
+} /* -- sr_worker_steal_has_work -- */
+
+/* Next vector: from our own deque if we can, else from another worker's. */
+static struct sr_wvec* sr_worker_take(struct sr_worker* w)
+{
+    struct sr_instance* sr = w->sr;
+    void* v;
+    int k, ret;
+
+    for ( k = 0; k < sr->nworkers; k++ )
+    {
+        while ( (ret = sr_deque_steal(&sr->workers[(w->id + k) % sr->nworkers]->dq,
+                                      &v)) == SR_DEQUE_ABORT );
+        if ( ret == SR_DEQUE_OK )
+        {
+            if ( k > 0 )
+            { w->steals++; }
+            return (struct sr_wvec*)v;
+        }
+    }
+    return 0;
+} /* -- sr_worker_take -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_steal_main(..)
+ * Scope:  Local
+ *
+ * sr_worker_main for -D steal. With -D ordered every frame first claims
+ * its flow's bucket in the guard table, so two workers never forward
+ * frames of the same flow at the same time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_worker_steal_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_instance* sr = w->sr;
+    struct sr_sched* s = sr->sched;
+    struct sr_wframe* f;
+    struct sr_wvec* v;
+    sigset_t all;
+    unsigned int i, idle = 0;
+    int* bucket = 0;
+    int owner;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    sr_worker_self = w;
+
+    while ( 1 )
+    {
+        if ( sr_neigh_poll(sr, w->neigh) > 0 )
+        { idle = 0; }
+
+        if ( (v = sr_worker_take(w)) == 0 )
+        {
+            if ( __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) )
+            { break; }
+            if ( ++idle < SR_WORKER_SPIN )
+            {
+                sched_yield();
+                continue;
+            }
+
+            sr_sleeper_sleep(&w->wake, sr_worker_steal_has_work, w);
+            idle = 0;
+            continue;
+        }
+        idle = 0;
+
+        for ( i = 0; i < v->n; i++ )
+        {
+            f = v->frames[i];
+            if ( sr->flow_guard )
+            {
+                bucket = &s->guard[f->hash & (SR_FLOW_GUARD_SZ - 1)];
+                owner = 0;
+                if ( !__atomic_compare_exchange_n(bucket, &owner, w->id + 1, 0,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+                {
+                    w->guard_waits++;
+                    do
+                    {
+                        sched_yield();
+                        owner = 0;
+                    } while ( !__atomic_compare_exchange_n(bucket, &owner, w->id + 1, 0,
+                                                           __ATOMIC_ACQUIRE,
+                                                           __ATOMIC_RELAXED) );
+                }
+            }
+
+            if ( sr->reorder_us )
+            {
+                w->cur_hash = f->hash;
+                w->cur_seq = f->seq;
+                w->in_input = 1;
+            }
+            sr_deliver_packet(sr, f->data, f->len, f->iface);
+            if ( sr->reorder_us )
+            { sr_worker_send_done(w); }
+
+            if ( sr->flow_guard )
+            { __atomic_store_n(bucket, 0, __ATOMIC_RELEASE); }
+        }
+        w->rx_pkts += v->n;
+        w->batches++;
+
+        /* -- hand the vector back to the dispatcher -- */
+        v->next = __atomic_load_n(&s->done, __ATOMIC_RELAXED);
+        while ( !__atomic_compare_exchange_n(&s->done, &v->next, v, 1,
+                                             __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+        sr_end_batch(sr);
+        if ( sr->pipeline )
+        { sr_worker_reclaim(w); }
+    }
+
+    sr_flush_packets(sr);
+
+    return NULL;
+} /* -- sr_worker_steal_main -- */
+
+static int sr_txstage_has_work(void* arg)
+{
+    struct sr_txstage* tx = (struct sr_txstage*)arg;
+    int i;
+
+    if ( __atomic_load_n(&tx->stop, __ATOMIC_ACQUIRE) )
+    { return 1; }
+    for ( i = 0; i < tx->sr->nworkers; i++ )
+    {
+        if ( sr_ring_count(&tx->sr->workers[i]->txr) != 0 )
+        { return 1; }
+    }
+    return 0;
+} /* -- sr_txstage_has_work -- */
+
+/* Send a frame (empty ones only mark the end of an input) and return it. */
+static void sr_txstage_emit(void* arg, struct sr_wframe* f, void* owner)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+
+    if ( f->len > 0 )
+    { sr->io->send(sr, f->data, f->len, f->iface); }
+    sr_ring_enqueue(&((struct sr_worker*)owner)->txdone, f);
+} /* -- sr_txstage_emit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_txstage_main(..)
+ * Scope:  Local
+ *
+ * Take a burst from every worker in turn, hand the frames to the
+ * backend (through the reorder buffer with -R), flush once per pass and
+ * return the buffers. While the reorder buffer holds frames the thread
+ * keeps polling, so that their wait stays bounded.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_txstage_main(void* arg)
+{
+    struct sr_txstage* tx = (struct sr_txstage*)arg;
+    struct sr_instance* sr = tx->sr;
+    struct sr_reorder* rob = tx->rob;
+    struct sr_worker* w;
+    struct sr_wframe* f;
+    void* burst[SR_WORKER_BURST];
+    sigset_t all;
+    unsigned int n, i, total, idle = 0;
+    unsigned long now = 0, timeouts;
+    int j;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    sr_txstage_self = tx;
+
+    while ( 1 )
+    {
+        total = 0;
+        if ( rob )
+        { now = sr_reorder_now(); }
+        for ( j = 0; j < sr->nworkers; j++ )
+        {
+            w = sr->workers[j];
+            n = sr_ring_dequeue_burst(&w->txr, burst, SR_WORKER_BURST);
+            for ( i = 0; i < n; i++ )
+            {
+                f = (struct sr_wframe*)burst[i];
+                if ( rob && f->last >= 0 )
+                { sr_reorder_input(rob, f, w, now); }
+                else
+                {
+                    sr->io->send(sr, f->data, f->len, f->iface);
+                    sr_ring_enqueue(&w->txdone, f);
+                }
+            }
+            total += n;
+        }
+
+        if ( rob && rob->nwaiting > 0 )
+        {
+            timeouts = rob->timeouts;
+            sr_reorder_expire(rob, now);
+            if ( total == 0 && rob->timeouts != timeouts )
+            { sr->io->flush(sr); }
+        }
+
+        if ( total > 0 )
+        {
+            sr->io->flush(sr);
+            tx->frames += total;
+            tx->rounds++;
+            idle = 0;
+            continue;
+        }
+
+        if ( __atomic_load_n(&tx->stop, __ATOMIC_ACQUIRE) )
+        { break; }
+        if ( ++idle < SR_WORKER_SPIN || (rob && rob->nwaiting > 0) )
+        {
+            sched_yield();
+            continue;
+        }
+        sr_sleeper_sleep(&tx->wake, sr_txstage_has_work, tx);
+        idle = 0;
+    }
+
+    /* -- the workers are gone, nothing held can complete any more -- */
+    if ( rob && rob->nwaiting > 0 )
+    {
+        sr_reorder_flush(rob);
+        sr->io->flush(sr);
+    }
+
+    return NULL;
+} /* -- sr_txstage_main -- */
+
+static void sr_worker_free(struct sr_worker* w)
+{
+    sr_txq_destroy(&w->txq);
+    sem_destroy(&w->wake.sem);
+    sr_ring_destroy(&w->rxq);
+    sr_ring_destroy(&w->freeq);
+    sr_ring_destroy(&w->txr);
+    sr_ring_destroy(&w->txdone);
+    sr_deque_destroy(&w->dq);
+    if ( w->neigh )
+    {
+        sr_neigh_destroy(w->neigh);
+        sr_mem_free(w->neigh);
+    }
+    sr_mem_free(w->pool);
+    sr_mem_free(w->txpool);
+    free(w->spare);
+    sr_mem_free(w);
+} /* -- sr_worker_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_sched_init(..)
+ * Scope:  Local
+ *
+ * One vector per frame covers the worst case of every vector holding a
+ * single frame, plus one open vector per worker.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_sched_init(struct sr_instance* sr)
+{
+    struct sr_sched* s;
+    unsigned int i;
+
+    if ( (s = (struct sr_sched*)calloc(1, sizeof(struct sr_sched))) == 0 )
+    { return -1; }
+    sr->sched = s;
+
+    s->nframes = SR_WORKER_POOL * sr->nworkers;
+    s->nvecs = s->nframes + sr->nworkers;
+    if ( (s->frames = (struct sr_wframe*)sr_mem_alloc("frame pool",
+                                                      s->nframes * sizeof(struct sr_wframe),
+                                                      sr_node_for(sr, SR_ROLE_RX, 0))) == 0 ||
+         (s->free_frames = (struct sr_wframe**)malloc(s->nframes *
+                                                      sizeof(struct sr_wframe*))) == 0 ||
+         (s->vecs = (struct sr_wvec*)calloc(s->nvecs, sizeof(struct sr_wvec))) == 0 ||
+         (s->free_vecs = (struct sr_wvec**)malloc(s->nvecs *
+                                                  sizeof(struct sr_wvec*))) == 0 ||
+         (s->guard = (int*)calloc(SR_FLOW_GUARD_SZ, sizeof(int))) == 0 )
+    { return -1; }
+
+    for ( i = 0; i < s->nframes; i++ )
+    { s->free_frames[i] = &s->frames[i]; }
+    s->nfree_frames = s->nframes;
+    for ( i = 0; i < s->nvecs; i++ )
+    { s->free_vecs[i] = &s->vecs[i]; }
+    s->nfree_vecs = s->nvecs;
+
+    return 0;
+} /* -- sr_sched_init -- */
+
+static void sr_sched_free(struct sr_instance* sr)
+{
+    struct sr_sched* s = sr->sched;
+
+    if ( s == 0 )
+    { return; }
+    sr_mem_free(s->frames);
+    free(s->free_frames);
+    free(s->vecs);
+    free(s->free_vecs);
+    free(s->guard);
+    free(s);
+    sr->sched = 0;
+} /* -- sr_sched_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_workers_start(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_workers_start(struct sr_instance* sr)
+{
+    struct sr_worker* w;
+    pthread_attr_t attr;
+    unsigned int batch;
+    char name[32];
+    int i, j, node;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(sr->nworkers > 0);
+
+    if ( sr->nworkers > SR_WORKER_MAX )
+    {
+        fprintf(stderr, "Too many workers, using %d\n", SR_WORKER_MAX);
+        sr->nworkers = SR_WORKER_MAX;
+    }
+
+    sr->workers = (struct sr_worker**)calloc(sr->nworkers, sizeof(struct sr_worker*));
+    if ( sr->workers == 0 )
+    { return -1; }
+
+    if ( sr->dispatch != SR_DISPATCH_HASH && sr_sched_init(sr) != 0 )
+    {
+        fprintf(stderr, "Error: out of memory (sr_workers_start)\n");
+        return -1;
+    }
+
+    /* -- workers batch on their own even without -B -- */
+    batch = sr->txq.max_frames > 1 ? sr->txq.max_frames : SR_WORKER_BURST;
+    sr->txq.fd_lock = &sr_worker_fd_lock;
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        /* -- page aligned, so each worker's rings start on a cache line of
+              their own, and on the worker's node like everything it owns -- */
+        node = sr_node_for(sr, SR_ROLE_WORKER, i);
+        snprintf(name, sizeof(name), "worker %d", i);
+        if ( (w = (struct sr_worker*)sr_mem_alloc(name, sizeof(struct sr_worker),
+                                                  node)) == 0 )
+        { return -1; }
+        w->id = i;
+        w->sr = sr;
+
+        snprintf(name, sizeof(name), "worker %d neigh", i);
+        if ( (w->neigh = (struct sr_neigh*)sr_mem_alloc(name, sizeof(struct sr_neigh),
+                                                        node)) == 0 ||
+             sr_neigh_init(w->neigh, i) != 0 )
+        {
+            fprintf(stderr, "Error: out of memory (sr_workers_start)\n");
+            return -1;
+        }
+
+        if ( sr->sched )
+        {
+            /* -- frames live in the scheduler's pool, vectors in deques -- */
+            if ( sr_deque_init(&w->dq, sr->sched->nvecs) != 0 )
+            {
+                fprintf(stderr, "Error: out of memory (sr_workers_start)\n");
+                return -1;
+            }
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "worker %d pool", i);
+            if ( sr_ring_init(&w->rxq, SR_WORKER_POOL) != 0 ||
+                 sr_ring_init(&w->freeq, SR_WORKER_POOL) != 0 ||
+                 (w->pool = (struct sr_wframe*)sr_mem_alloc(name,
+                                                            SR_WORKER_POOL *
+                                                            sizeof(struct sr_wframe),
+                                                            node)) == 0 )
+            {
+                fprintf(stderr, "Error: out of memory (sr_workers_start)\n");
+                return -1;
+            }
+            for ( j = 0; j < SR_WORKER_POOL; j++ )
+            { sr_ring_enqueue(&w->freeq, &w->pool[j]); }
+        }
+
+        if ( sr->pipeline )
+        {
+            snprintf(name, sizeof(name), "worker %d tx pool", i);
+            if ( sr_ring_init(&w->txr, SR_WORKER_TXPOOL) != 0 ||
+                 sr_ring_init(&w->txdone, SR_WORKER_TXPOOL) != 0 ||
+                 (w->txpool = (struct sr_wframe*)sr_mem_alloc(name, SR_WORKER_TXPOOL *
+                                                              sizeof(struct sr_wframe),
+                                                              node)) == 0 ||
+                 (w->spare = (struct sr_wframe**)malloc(SR_WORKER_TXPOOL *
+                                                        sizeof(struct sr_wframe*))) == 0 )
+            {
+                fprintf(stderr, "Error: out of memory (sr_workers_start)\n");
+                return -1;
+            }
+            for ( j = 0; j < SR_WORKER_TXPOOL; j++ )
+            { w->spare[j] = &w->txpool[j]; }
+            w->nspare = SR_WORKER_TXPOOL;
+        }
+
+        sr_txq_init(&w->txq, batch);
+        w->txq.lockless = 1;
+        w->txq.fd_lock = &sr_worker_fd_lock;
+        sem_init(&w->wake.sem, 0, 0);
+
+        sr->workers[i] = w;
+        pthread_attr_init(&attr);
+        snprintf(name, sizeof(name), "worker %d", i);
+        sr_thread_attr(&attr, name, sr_cpu_for(sr, SR_ROLE_WORKER, i));
+        j = pthread_create(&w->thread, &attr,
+                           sr->sched ? sr_worker_steal_main : sr_worker_main, w);
+        pthread_attr_destroy(&attr);
+        if ( j != 0 )
+        {
+            perror("pthread_create(..):sr_worker.c::sr_workers_start");
+            sr->workers[i] = 0;
+            sr_worker_free(w);
+            sr->nworkers = i;
+            return -1;
+        }
+    }
+
+    if ( sr->pipeline )
+    {
+        if ( (sr->txstage = (struct sr_txstage*)calloc(1, sizeof(struct sr_txstage))) == 0 )
+        { return -1; }
+        sr->txstage->sr = sr;
+        if ( sr->reorder_us )
+        {
+            if ( (sr->txstage->rob = (struct sr_reorder*)sr_mem_alloc("reorder buffer",
+                                                                      sizeof(struct sr_reorder),
+                                                                      sr_node_for(sr, SR_ROLE_TX, 0))) == 0 ||
+                 sr_reorder_init(sr->txstage->rob, SR_WORKER_TXPOOL * sr->nworkers,
+                                 sr->reorder_us) != 0 )
+            {
+                fprintf(stderr, "Error: out of memory (sr_workers_start)\n");
+                sr_mem_free(sr->txstage->rob);
+                free(sr->txstage);
+                sr->txstage = 0;
+                return -1;
+            }
+            sr->txstage->rob->emit = sr_txstage_emit;
+            sr->txstage->rob->arg = sr;
+        }
+        /* -- batches like the workers did before the stage took over -- */
+        sr_txq_init(&sr->txstage->txq, batch);
+        sr->txstage->txq.lockless = 1;
+        sr->txstage->txq.fd_lock = &sr_worker_fd_lock;
+        sem_init(&sr->txstage->wake.sem, 0, 0);
+        pthread_attr_init(&attr);
+        sr_thread_attr(&attr, "tx", sr_cpu_for(sr, SR_ROLE_TX, 0));
+        j = pthread_create(&sr->txstage->thread, &attr, sr_txstage_main, sr->txstage);
+        pthread_attr_destroy(&attr);
+        if ( j != 0 )
+        {
+            perror("pthread_create(..):sr_worker.c::sr_workers_start");
+            sr_txq_destroy(&sr->txstage->txq);
+            sem_destroy(&sr->txstage->wake.sem);
+            if ( sr->txstage->rob )
+            {
+                sr_reorder_destroy(sr->txstage->rob);
+                sr_mem_free(sr->txstage->rob);
+            }
+            free(sr->txstage);
+            sr->txstage = 0;
+            return -1;
+        }
+    }
+
+    printf("Started %d forwarding workers%s%s%s\n", sr->nworkers,
+           sr->dispatch == SR_DISPATCH_SPRAY ? ", spraying" :
+           sr->sched ? (sr->flow_guard ? ", stealing, flow ordered" : ", stealing") : "",
+           sr->pipeline ? " and a TX thread" : "",
+           sr->reorder_us ? " with a reorder stage" : "");
+
+    return 0;
+} /* -- sr_workers_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_workers_stop(..)
+ * Scope:  Global
+ *
+ * The dispatcher must have stopped; the workers finish what is queued.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_workers_stop(struct sr_instance* sr)
+{
+    struct sr_worker* w;
+    int i;
+
+    if ( sr->workers == 0 )
+    { return; }
+
+    /* -- queue what the last batch left in open vectors -- */
+    if ( sr->sched )
+    { sr_sched_flush(sr); }
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        w = sr->workers[i];
+        __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+        sem_post(&w->wake.sem);
+        pthread_join(w->thread, NULL);
+    }
+
+    /* -- the workers are done, so the TX stage sees everything they sent -- */
+    if ( sr->txstage )
+    {
+        __atomic_store_n(&sr->txstage->stop, 1, __ATOMIC_RELEASE);
+        sem_post(&sr->txstage->wake.sem);
+        pthread_join(sr->txstage->thread, NULL);
+    }
+
+    sr_workers_stats(sr, stderr);
+
+    if ( sr->txstage )
+    {
+        sr_txq_destroy(&sr->txstage->txq);
+        sem_destroy(&sr->txstage->wake.sem);
+        if ( sr->txstage->rob )
+        {
+            sr_reorder_destroy(sr->txstage->rob);
+            sr_mem_free(sr->txstage->rob);
+        }
+        free(sr->txstage);
+        sr->txstage = 0;
+    }
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    { sr_worker_free(sr->workers[i]); }
+    sr_sched_free(sr);
+    free(sr->workers);
+    sr->workers = 0;
+    sr->nworkers = 0;
+} /* -- sr_workers_stop -- */
+
+void sr_workers_stats(struct sr_instance* sr, FILE* out)
+{
+    struct sr_worker* w;
+    int i;
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        w = sr->workers[i];
+        fprintf(out, "worker %d: rx %lu tx %lu drops %lu tx drops %lu batches %lu",
+                w->id, w->rx_pkts, w->tx_pkts, w->drops, w->tx_drops, w->batches);
+        if ( sr->sched )
+        { fprintf(out, " steals %lu guard waits %lu", w->steals, w->guard_waits); }
+        fprintf(out, " neigh updates %lu resolves %lu fails %lu lost %lu",
+                w->neigh->updates, w->neigh->resolves, w->neigh->fails,
+                __atomic_load_n(&w->neigh->lost, __ATOMIC_RELAXED));
+        fputc('\n', out);
+    }
+    if ( sr->txstage )
+    {
+        fprintf(out, "tx stage: %lu frames in %lu flushes, %lu writes\n",
+                sr->txstage->frames, sr->txstage->rounds,
+                sr->txstage->txq.flushes);
+        if ( sr->txstage->rob )
+        { sr_reorder_stats(sr->txstage->rob, out); }
+    }
+} /* -- sr_workers_stats -- */
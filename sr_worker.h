@@ -0,0 +1,219 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.h
+ *
+ * Description:
+ *
+ * Forwarding worker pool (-W n).  The thread that polls the I/O backend
+ * becomes a dispatcher: every received frame is copied into a buffer of
+ * the worker chosen by a hash of its IPv4 5-tuple and queued on that
+ * worker's ring, so all frames of one flow are handled, in order, by the
+ * same thread.  Each worker owns its frame pool, its counters and (with
+ * the VNS backend) its transmit queue, and runs sr_handlepacket on its
+ * own.  The routing table is read-only once the router runs and each
+ * worker has an ARP cache shard of its own (see sr_neigh.h), so the
+ * forwarding fast path takes no locks.
+ *
+ * Pipeline mode (-P) adds a transmit stage: instead of calling into the
+ * backend, workers copy outgoing frames into buffers of their own TX
+ * pool and pass them over a second ring to a single TX thread, which
+ * does the backend sends and flushes and hands the buffers back.  The
+ * system call cost and jitter of transmission then stay off the
+ * forwarding threads, and each stage can be sized on its own.
+ *
+ * With -D steal the dispatcher gathers frames into vectors per worker (by
+ * flow hash, as before) and pushes them on the worker's Chase-Lev deque
+ * instead of its ring.  Workers take vectors from their own deque first
+ * and, when it runs dry, steal whole vectors from the others, so an
+ * elephant flow or a hot next hop no longer leaves the other workers
+ * idle.  Frames of one flow can then run on two workers at once; -D
+ * ordered adds a per-flow guard that lets only one worker at a time
+ * handle a frame of a given flow.  -D spray deals vectors to the workers
+ * in turn, whatever their flows, and relies on the reorder stage (-R, see
+ * sr_reorder.h) in front of the backend to put each flow back in order.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_WORKER_H
+#define SR_WORKER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "sr_protocol.h"
+#include "sr_ring.h"
+#include "sr_deque.h"
+#include "sr_txq.h"
+#include "sr_reorder.h"
+#include "sr_neigh.h"
+
+#define SR_WORKER_MAX      64
+#define SR_WORKER_POOL     1024     /* frames owned by each worker */
+#define SR_WORKER_FRAME_SZ 2048     /* largest frame a worker accepts */
+#define SR_WORKER_BURST    32       /* frames taken off the ring at once */
+#define SR_WORKER_SPIN     64       /* empty polls before going to sleep */
+#define SR_WORKER_TXPOOL   512      /* frames each worker can have in the TX stage */
+#define SR_FLOW_GUARD_SZ   4096     /* flow buckets of the ordering guard */
+
+/* How the dispatcher shares frames among the workers (-D) */
+#define SR_DISPATCH_HASH    0       /* each flow sticks to one worker */
+#define SR_DISPATCH_STEAL   1       /* flow affinity, idle workers steal vectors */
+#define SR_DISPATCH_SPRAY   2       /* vectors dealt round robin, needs reorder */
+
+struct sr_instance;
+
+/* A frame in transit from the dispatcher to a worker */
+struct sr_wframe
+{
+    unsigned int len;
+    uint32_t hash;                  /* flow hash */
+    uint32_t seq;                   /* number within the flow, -R only */
+    int last;                       /* last output for its input, -1 if it has
+                                       none (neighbor messages), -R only */
+    char iface[sr_IFACE_NAMELEN];
+    uint8_t data[SR_WORKER_FRAME_SZ];
+};
+
+/* A batch of frames, the unit of work stealing */
+struct sr_wvec
+{
+    unsigned int n;
+    struct sr_wvec* next;           /* on the dispatcher's return stack */
+    struct sr_wframe* frames[SR_WORKER_BURST];
+};
+
+/* A thread that sleeps when it runs out of work. Producers call
+   sr_sleeper_wake after publishing work, which only costs a system call
+   when the consumer actually sleeps. */
+struct sr_sleeper
+{
+    sem_t sem;
+    int sleeping;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_worker
+ *
+ * 'rxq' carries filled frames to the worker, 'freeq' returns them to the
+ * dispatcher. In pipeline mode 'txr' carries frames from 'txpool' to the
+ * TX thread and 'txdone' brings them back. Counters are written by one
+ * thread each: 'drops' by the dispatcher, the rest by the worker.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_worker
+{
+    struct sr_ring rxq;
+    struct sr_ring freeq;
+    struct sr_ring txr;
+    struct sr_ring txdone;
+    struct sr_deque dq;             /* vectors, -D steal */
+    int id;
+    pthread_t thread;
+    struct sr_instance* sr;
+    struct sr_wframe* pool;
+    struct sr_wframe* txpool;
+    struct sr_wframe** spare;       /* txpool frames not in the TX stage */
+    unsigned int nspare;
+    struct sr_wframe* held;         /* -R: latest output, not yet queued */
+    uint32_t cur_hash;              /* -R: input being forwarded */
+    uint32_t cur_seq;
+    int in_input;                   /* -R: cur_hash and cur_seq are valid */
+    struct sr_txq txq;              /* VNS transmit queue of this worker */
+    struct sr_neigh* neigh;         /* ARP cache shard */
+    struct sr_sleeper wake;
+    int stop;
+    unsigned long rx_pkts;
+    unsigned long tx_pkts;
+    unsigned long batches;
+    unsigned long drops;
+    unsigned long tx_drops;
+    unsigned long steals;           /* vectors taken from other workers */
+    unsigned long guard_waits;      /* frames that waited for their flow */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_sched
+ *
+ * Dispatcher side of -D steal. All frames and vectors belong to the
+ * dispatcher; workers return finished vectors on the 'done' stack, which
+ * the dispatcher empties in one exchange when it runs short.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_sched
+{
+    struct sr_wframe* frames;
+    struct sr_wframe** free_frames;
+    unsigned int nframes;
+    unsigned int nfree_frames;
+    struct sr_wvec* vecs;
+    struct sr_wvec** free_vecs;
+    unsigned int nvecs;
+    unsigned int nfree_vecs;
+    struct sr_wvec* open[SR_WORKER_MAX];    /* vector being filled per worker */
+    int spray;                      /* worker receiving vectors, -D spray */
+    struct sr_wvec* done;
+    int* guard;                     /* owner + 1 per flow bucket, 0 if free */
+};
+
+/* Transmit stage of pipeline mode */
+struct sr_txstage
+{
+    pthread_t thread;
+    struct sr_instance* sr;
+    struct sr_sleeper wake;
+    int stop;
+    struct sr_reorder* rob;         /* -R only */
+    struct sr_txq txq;              /* VNS transmit queue of the TX thread */
+    unsigned long frames;
+    unsigned long rounds;           /* passes that found frames, one flush each */
+};
+
+/* Worker running on the calling thread, 0 on any other thread. */
+extern __thread struct sr_worker* sr_worker_self;
+
+/* Start sr->nworkers workers, and the TX thread if sr->pipeline is set.
+   Returns 0 on success. */
+int  sr_workers_start(struct sr_instance* sr);
+
+/* Stop and join the workers (and TX thread), after they drained their
+   rings. */
+void sr_workers_stop(struct sr_instance* sr);
+
+/* Queue a received frame on the worker owning its flow. Returns 0 if it
+   was queued, -1 if it was dropped. */
+int  sr_worker_dispatch(struct sr_instance* sr, const uint8_t* packet,
+                        unsigned int len, const char* iface);
+
+/* Hash of the IPv4 5-tuple (addresses only for fragments and other
+   protocols), 0 for non-IP frames. */
+uint32_t sr_flow_hash(const uint8_t* packet, unsigned int len);
+
+/* End of a receive batch: queue the vectors -D steal has been filling.
+   Only acts on the dispatching thread. */
+void sr_worker_dispatch_flush(struct sr_instance* sr);
+
+/* Wake worker 'w' if it sleeps, after posting it something. */
+void sr_worker_kick(struct sr_worker* w);
+
+/* Pipeline mode: hand a frame to the TX stage. Returns 0 if it was queued,
+   -1 if it was dropped. */
+int  sr_worker_send(struct sr_instance* sr, const uint8_t* buf,
+                    unsigned int len, const char* iface);
+
+/* Transmit queue of the calling thread: its worker's, or sr->txq. */
+struct sr_txq* sr_worker_txq(struct sr_instance* sr);
+
+/* Per worker counters. */
+void sr_workers_stats(struct sr_instance* sr, FILE* out);
+
+#endif /* -- SR_WORKER_H -- */